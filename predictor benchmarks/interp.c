@@ -0,0 +1,129 @@
+#include "lib.h"
+
+// A small stack-machine interpreter. Every bytecode runs through a table
+// of handler functions, so the loop makes one indirect call per bytecode,
+// and which handler comes next depends on the bytecodes before it: work
+// for an indirect target predictor (sim -btb ... -indirect). With a second
+// argument "switch" the bytecodes are dispatched by a switch instead,
+// which compiles to a jump table (indirect jumps rather than calls).
+//
+// The bytecode program sums the Collatz step counts of 1..n.
+
+enum { PUSH, LOAD, STORE, ADD, MUL, DIV, MOD, EQ, GT, JMP, JNZ, HALT, NUM_OPS };
+
+struct insn { int op; int arg; };
+
+struct vm {
+  const struct insn* code;
+  int pc;
+  int sp;
+  int stack[8];
+  int vars[4];
+  int running;
+};
+
+static void op_push(struct vm* vm, int arg) { vm->stack[vm->sp++] = arg; }
+static void op_load(struct vm* vm, int arg) { vm->stack[vm->sp++] = vm->vars[arg]; }
+static void op_store(struct vm* vm, int arg) { vm->vars[arg] = vm->stack[--vm->sp]; }
+static void op_add(struct vm* vm, int arg) { (void)arg; vm->sp--; vm->stack[vm->sp - 1] += vm->stack[vm->sp]; }
+static void op_mul(struct vm* vm, int arg) { (void)arg; vm->sp--; vm->stack[vm->sp - 1] *= vm->stack[vm->sp]; }
+static void op_div(struct vm* vm, int arg) { (void)arg; vm->sp--; vm->stack[vm->sp - 1] /= vm->stack[vm->sp]; }
+static void op_mod(struct vm* vm, int arg) { (void)arg; vm->sp--; vm->stack[vm->sp - 1] %= vm->stack[vm->sp]; }
+static void op_eq(struct vm* vm, int arg) { (void)arg; vm->sp--; vm->stack[vm->sp - 1] = vm->stack[vm->sp - 1] == vm->stack[vm->sp]; }
+static void op_gt(struct vm* vm, int arg) { (void)arg; vm->sp--; vm->stack[vm->sp - 1] = vm->stack[vm->sp - 1] > vm->stack[vm->sp]; }
+static void op_jmp(struct vm* vm, int arg) { vm->pc = arg; }
+static void op_jnz(struct vm* vm, int arg) { if (vm->stack[--vm->sp]) vm->pc = arg; }
+static void op_halt(struct vm* vm, int arg) { (void)arg; vm->running = 0; }
+
+static void (*const handlers[NUM_OPS])(struct vm*, int) = {
+  op_push, op_load, op_store, op_add, op_mul, op_div, op_mod, op_eq, op_gt, op_jmp, op_jnz, op_halt
+};
+
+// one indirect call per bytecode
+static void run_calls(struct vm* vm) {
+  while (vm->running) {
+    const struct insn* i = &vm->code[vm->pc++];
+    handlers[i->op](vm, i->arg);
+  }
+}
+
+// one indirect jump per bytecode
+static void run_switch(struct vm* vm) {
+  while (vm->running) {
+    const struct insn* i = &vm->code[vm->pc++];
+    int* top = vm->stack + vm->sp;    // one past the top of the stack
+    switch (i->op) {
+      case PUSH:  *top = i->arg; vm->sp++; break;
+      case LOAD:  *top = vm->vars[i->arg]; vm->sp++; break;
+      case STORE: vm->vars[i->arg] = top[-1]; vm->sp--; break;
+      case ADD:   top[-2] += top[-1]; vm->sp--; break;
+      case MUL:   top[-2] *= top[-1]; vm->sp--; break;
+      case DIV:   top[-2] /= top[-1]; vm->sp--; break;
+      case MOD:   top[-2] %= top[-1]; vm->sp--; break;
+      case EQ:    top[-2] = top[-2] == top[-1]; vm->sp--; break;
+      case GT:    top[-2] = top[-2] > top[-1]; vm->sp--; break;
+      case JMP:   vm->pc = i->arg; break;
+      case JNZ:   if (top[-1]) vm->pc = i->arg; vm->sp--; break;
+      default:    vm->running = 0; break;
+    }
+  }
+}
+
+// variables of the bytecode program
+enum { I, N, X, STEPS };
+
+static struct insn program[64];
+static int size;
+
+static int emit(int op, int arg) {
+  program[size].op = op;
+  program[size].arg = arg;
+  return size++;
+}
+
+// for (i = 1; i <= n; i++)
+//   for (x = i; x != 1; steps++) x = x % 2 ? 3 * x + 1 : x / 2;
+static void assemble(void) {
+  emit(PUSH, 1); emit(STORE, I);
+  int loop_i = emit(LOAD, I); emit(LOAD, N); emit(GT, 0);
+  int to_end = emit(JNZ, 0);
+  emit(LOAD, I); emit(STORE, X);
+  int loop_x = emit(LOAD, X); emit(PUSH, 1); emit(EQ, 0);
+  int to_next = emit(JNZ, 0);
+  emit(LOAD, X); emit(PUSH, 2); emit(MOD, 0);
+  int to_odd = emit(JNZ, 0);
+  emit(LOAD, X); emit(PUSH, 2); emit(DIV, 0); emit(STORE, X);
+  int to_count = emit(JMP, 0);
+  program[to_odd].arg = emit(LOAD, X); emit(PUSH, 3); emit(MUL, 0); emit(PUSH, 1); emit(ADD, 0); emit(STORE, X);
+  program[to_count].arg = emit(LOAD, STEPS); emit(PUSH, 1); emit(ADD, 0); emit(STORE, STEPS);
+  emit(JMP, loop_x);
+  program[to_next].arg = emit(LOAD, I); emit(PUSH, 1); emit(ADD, 0); emit(STORE, I);
+  emit(JMP, loop_i);
+  program[to_end].arg = emit(HALT, 0);
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    print_string("interp() missing arguments\n");
+    terminate(1);
+  }
+  struct vm vm;
+  vm.code = program;
+  vm.pc = 0;
+  vm.sp = 0;
+  vm.running = 1;
+  for (int k = 0; k < 4; k++) vm.vars[k] = 0;
+  vm.vars[N] = str_to_uns(argv[1]);
+  assemble();
+  if (argc > 2 && argv[2][0] == 's') run_switch(&vm);
+  else run_calls(&vm);
+
+  char buffer[20];
+  uns_to_str(buffer, vm.vars[STEPS]);
+  print_string("Collatz steps of 1..");
+  print_string(argv[1]);
+  print_string(": ");
+  print_string(buffer);
+  print_string("\n");
+  return 0;
+}
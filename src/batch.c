@@ -0,0 +1,306 @@
+#include "batch.h"
+#include "libsim.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_JOB_ARGS 64
+
+struct job {
+    int line;                   // in the job file
+    char* text;                 // the line; the fields below point into it
+    const char* elf;
+    const char* predictor;      // NULL for none
+    int size;
+    int argc;                   // program args, "--" included as for sim
+    const char* argv[MAX_JOB_ARGS];
+
+    // results
+    const char* error;          // NULL if the job ran
+    enum sim_event event;
+    int32_t exit_code;          // a0 at the exit ecall
+    long insns;
+    struct BPStats stats;
+    long output_bytes;
+    double seconds;
+};
+
+// Jobs of one thread, by index; the owner works at the tail, thieves at
+// the head
+struct deque {
+    pthread_mutex_t lock;
+    int* jobs;
+    int head, tail;
+};
+
+struct batch {
+    struct job* jobs;
+    int num_jobs;
+    struct deque* deques;
+    int threads;
+    enum sim_engine engine;
+};
+
+struct worker {
+    struct batch* batch;
+    int id;
+};
+
+// --- Job file --------------------------------------------------------------
+
+static int parse_job(struct job* j, char* text, int line) {
+    memset(j, 0, sizeof(struct job));
+    j->line = line;
+    j->text = text;
+
+    const char* fields[MAX_JOB_ARGS + 4];
+    int n = 0;
+    char* save;
+    for (char* tok = strtok_r(text, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        if (n == MAX_JOB_ARGS + 4) return -1;
+        fields[n++] = tok;
+    }
+    if (n == 0) return -1;
+    int i = 0;
+    j->elf = fields[i++];
+    if (i < n && strcmp(fields[i], "--")) {
+        j->predictor = fields[i++];
+        if (predictor_has_size(j->predictor)) {
+            if (i == n) return -1;
+            j->size = atoi(fields[i++]);
+        } else if (!strcmp(j->predictor, "none")) {
+            j->predictor = NULL;
+        }
+    }
+    if (i < n) {
+        if (strcmp(fields[i], "--") || n - i > MAX_JOB_ARGS) return -1;
+        for (; i < n; i++) j->argv[j->argc++] = fields[i];
+    }
+    return 0;
+}
+
+// Returns the number of jobs, or -1
+static int read_jobs(const char* name, struct job** jobs) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        fprintf(stderr, "Could not open job file %s\n", name);
+        return -1;
+    }
+    int n = 0, capacity = 0, line = 0;
+    char buf[4096];
+    *jobs = NULL;
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+        const char* p = buf + strspn(buf, " \t\r\n");
+        if (*p == '\0' || *p == '#') continue;
+        if (n == capacity) {
+            capacity = capacity ? 2 * capacity : 64;
+            *jobs = realloc(*jobs, capacity * sizeof(struct job));
+            if (!*jobs) {
+                fprintf(stderr, "Out of memory reading job file\n");
+                exit(-1);
+            }
+        }
+        char* text = strdup(buf);
+        if (!text || parse_job(&(*jobs)[n], text, line)) {
+            fprintf(stderr, "%s:%d: bad job line\n", name, line);
+            free(text);
+            for (int k = 0; k < n; k++) free((*jobs)[k].text);
+            free(*jobs);
+            *jobs = NULL;
+            fclose(f);
+            return -1;
+        }
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+// --- Running jobs ----------------------------------------------------------
+
+static int no_input(void* user) {
+    (void)user;
+    return -1;
+}
+
+static void count_output(void* user, int ch) {
+    (void)ch;
+    ((struct job*)user)->output_bytes++;
+}
+
+static void run_job(struct job* j, enum sim_engine engine) {
+    struct timespec before, after;
+    clock_gettime(CLOCK_MONOTONIC, &before);
+
+    struct sim_machine* m = sim_machine_create();
+    struct sim_console console = { no_input, count_output, j };
+    if (!m) {
+        j->error = "out of memory";
+    } else if (sim_machine_load_elf(m, j->elf)) {
+        j->error = "could not load ELF file";
+    } else if (j->predictor && sim_machine_set_predictor(m, j->predictor, j->size)) {
+        j->error = "bad predictor";
+    } else {
+        if (j->argc) sim_machine_set_args(m, j->argc, j->argv);
+        sim_machine_set_engine(m, engine, 1);
+        sim_machine_set_console(m, &console);
+        j->event = sim_machine_run(m, 0);
+        j->exit_code = sim_machine_reg(m, 10);
+        j->insns = sim_machine_stat(m)->insns;
+        j->stats = *sim_machine_bpstats(m);
+    }
+    sim_machine_delete(m);
+
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    j->seconds = (after.tv_sec - before.tv_sec) + 1e-9 * (after.tv_nsec - before.tv_nsec);
+}
+
+static int take(struct deque* q, int own) {
+    int job = -1;
+    pthread_mutex_lock(&q->lock);
+    if (q->head < q->tail) job = own ? q->jobs[--q->tail] : q->jobs[q->head++];
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+static void* worker_main(void* arg) {
+    struct worker* w = arg;
+    struct batch* b = w->batch;
+    for (;;) {
+        int job = take(&b->deques[w->id], 1);
+        // jobs are never added, so once every deque is empty we are done
+        for (int k = 1; job < 0 && k < b->threads; k++)
+            job = take(&b->deques[(w->id + k) % b->threads], 0);
+        if (job < 0) return NULL;
+        run_job(&b->jobs[job], b->engine);
+    }
+}
+
+// --- Report ----------------------------------------------------------------
+
+static const char* job_status(const struct job* j) {
+    if (j->error) return "error";
+    return j->event == SIM_EVENT_EXIT ? "exit" : "illegal";
+}
+
+static double job_mpki(const struct job* j) {
+    return j->insns ? 1000.0 * (double)j->stats.mispredictions / (double)j->insns : 0.0;
+}
+
+// text for inside a quoted field: quotes are doubled for CSV, and quotes
+// and backslashes escaped for JSON
+static void write_escaped(FILE* out, const char* text, int json) {
+    for (const char* c = text; *c; c++) {
+        if (*c == '"') fputc(json ? '\\' : '"', out);
+        else if (*c == '\\' && json) fputc('\\', out);
+        fputc(*c, out);
+    }
+}
+
+// program args without the leading "--", separated by spaces
+static void write_args(FILE* out, const struct job* j, int json) {
+    for (int a = 1; a < j->argc; a++) {
+        if (a > 1) fputc(' ', out);
+        write_escaped(out, j->argv[a], json);
+    }
+}
+
+static void write_csv(FILE* out, const struct batch* b) {
+    fprintf(out, "job,line,elf,predictor,size,args,status,exit_code,instructions,"
+                 "branches,mispredictions,mpki,output_bytes,seconds\n");
+    for (int i = 0; i < b->num_jobs; i++) {
+        const struct job* j = &b->jobs[i];
+        fprintf(out, "%d,%d,\"", i, j->line);
+        write_escaped(out, j->elf, 0);
+        fprintf(out, "\",\"");
+        write_escaped(out, j->predictor ? j->predictor : "none", 0);
+        fprintf(out, "\",%d,\"", j->size);
+        write_args(out, j, 0);
+        fprintf(out, "\",%s,%d,%ld,%ld,%ld,%.3f,%ld,%.3f\n", job_status(j), (int)j->exit_code,
+                j->insns, j->stats.total_branches, j->stats.mispredictions, job_mpki(j),
+                j->output_bytes, j->seconds);
+    }
+}
+
+static void write_json(FILE* out, const struct batch* b) {
+    fprintf(out, "[\n");
+    for (int i = 0; i < b->num_jobs; i++) {
+        const struct job* j = &b->jobs[i];
+        fprintf(out, "  {\"job\": %d, \"line\": %d, \"elf\": \"", i, j->line);
+        write_escaped(out, j->elf, 1);
+        fprintf(out, "\", \"predictor\": \"");
+        write_escaped(out, j->predictor ? j->predictor : "none", 1);
+        fprintf(out, "\", \"size\": %d, \"args\": \"", j->size);
+        write_args(out, j, 1);
+        fprintf(out, "\", \"status\": \"%s\", \"exit_code\": %d, \"instructions\": %ld, "
+                     "\"branches\": %ld, \"mispredictions\": %ld, \"mpki\": %.3f, "
+                     "\"output_bytes\": %ld, \"seconds\": %.3f}%s\n",
+                job_status(j), (int)j->exit_code, j->insns, j->stats.total_branches,
+                j->stats.mispredictions, job_mpki(j), j->output_bytes, j->seconds,
+                i + 1 < b->num_jobs ? "," : "");
+    }
+    fprintf(out, "]\n");
+}
+
+int batch_run(const char* job_file, int threads, enum sim_engine engine,
+              FILE* report, int json) {
+    struct batch b = { .threads = threads, .engine = engine };
+    b.num_jobs = read_jobs(job_file, &b.jobs);
+    if (b.num_jobs < 0) return -1;
+    if (b.threads > b.num_jobs) b.threads = b.num_jobs > 0 ? b.num_jobs : 1;
+
+    // deal the jobs out round robin
+    b.deques = calloc(b.threads, sizeof(struct deque));
+    struct worker* workers = calloc(b.threads, sizeof(struct worker));
+    pthread_t* ids = calloc(b.threads, sizeof(pthread_t));
+    if (!b.deques || !workers || !ids) {
+        fprintf(stderr, "Out of memory in batch runner\n");
+        exit(-1);
+    }
+    for (int t = 0; t < b.threads; t++) {
+        pthread_mutex_init(&b.deques[t].lock, NULL);
+        b.deques[t].jobs = malloc((b.num_jobs / b.threads + 1) * sizeof(int));
+        if (!b.deques[t].jobs) {
+            fprintf(stderr, "Out of memory in batch runner\n");
+            exit(-1);
+        }
+    }
+    // in reverse, so that each owner starts with its earliest job
+    for (int i = b.num_jobs - 1; i >= 0; i--) {
+        struct deque* q = &b.deques[i % b.threads];
+        q->jobs[q->tail++] = i;
+    }
+
+    for (int t = 0; t < b.threads; t++) {
+        workers[t] = (struct worker){ &b, t };
+        if (pthread_create(&ids[t], NULL, worker_main, &workers[t])) {
+            fprintf(stderr, "Could not start batch thread\n");
+            exit(-1);
+        }
+    }
+    for (int t = 0; t < b.threads; t++) pthread_join(ids[t], NULL);
+
+    if (json) write_json(report, &b);
+    else write_csv(report, &b);
+
+    int ok = 1;
+    for (int i = 0; i < b.num_jobs; i++) {
+        struct job* j = &b.jobs[i];
+        if (j->error) fprintf(stderr, "%s (line %d): %s\n", j->elf, j->line, j->error);
+        if (j->error || j->event != SIM_EVENT_EXIT) ok = 0;
+        free(j->text);
+    }
+    for (int t = 0; t < b.threads; t++) {
+        pthread_mutex_destroy(&b.deques[t].lock);
+        free(b.deques[t].jobs);
+    }
+    free(ids);
+    free(workers);
+    free(b.deques);
+    free(b.jobs);
+    return ok ? 0 : -1;
+}
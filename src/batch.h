@@ -0,0 +1,31 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "simulate.h"
+#include <stdio.h>
+
+// --- Batch runner ----------------------------------------------------------
+//
+// Runs every job of a job file on its own libsim machine, spread over
+// 'threads' host threads, and writes one report line per job (in job file
+// order) as CSV, or as JSON if 'json' is set. A job line is
+//
+//   prog.elf [nt | btfnt | bimodal <size> | gshare <size> | bimode <size> |
+//             agree <size> | yags <size> | tage <kb> |
+//             perceptron[/history] <rows> | local[/history[/bht size]] <pht size> |
+//             tournament[/local+global] <size> | none] [-- args...]
+//
+// Blank lines and lines starting with # are skipped. Jobs have no console
+// input, and their console output is only counted.
+//
+// Each thread owns a deque of jobs, dealt out round robin. It takes jobs
+// from the back of its own deque and, once that is empty, steals from the
+// front of the others', so threads that drew short jobs help out the ones
+// with long ones.
+
+// Returns 0 if every job ran to its exit ecall, -1 otherwise (or if the job
+// file could not be read)
+int batch_run(const char* job_file, int threads, enum sim_engine engine,
+              FILE* report, int json);
+
+#endif
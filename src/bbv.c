@@ -0,0 +1,131 @@
+#include "bbv.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct bbv_entry {
+    uint32_t pc;
+    uint32_t id;        // 0 = free slot
+};
+
+struct bbv {
+    FILE* out;
+    long interval;
+    long insns;         // in the whole run
+    long next_end;      // end of the current interval
+    long intervals;
+
+    // open-addressing map from block pc to id
+    struct bbv_entry* map;
+    uint32_t map_mask;
+    uint32_t num_ids;
+
+    // per id (index id - 1): instructions in the current interval, and
+    // the ids touched in it, in the order they were first touched
+    long* counts;
+    uint32_t* touched;
+    uint32_t num_touched;
+    uint32_t capacity;
+};
+
+static void* xrealloc(void* p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "Out of memory in basic-block vectors\n");
+        exit(-1);
+    }
+    return p;
+}
+
+struct bbv* bbv_create(FILE* out, long interval) {
+    struct bbv* bbv = calloc(1, sizeof(struct bbv));
+    if (!bbv) return NULL;
+    bbv->out = out;
+    bbv->interval = interval;
+    bbv->next_end = interval;
+    bbv->map_mask = 4095;
+    bbv->map = calloc(bbv->map_mask + 1, sizeof(struct bbv_entry));
+    if (!bbv->map) {
+        free(bbv);
+        return NULL;
+    }
+    return bbv;
+}
+
+static void flush_interval(struct bbv* bbv) {
+    if (bbv->num_touched == 0) return;
+    fputc('T', bbv->out);
+    for (uint32_t i = 0; i < bbv->num_touched; i++) {
+        uint32_t id = bbv->touched[i];
+        fprintf(bbv->out, ":%u:%ld ", id, bbv->counts[id - 1]);
+        bbv->counts[id - 1] = 0;
+    }
+    fputc('\n', bbv->out);
+    bbv->num_touched = 0;
+    bbv->intervals++;
+}
+
+void bbv_delete(struct bbv* bbv) {
+    if (!bbv) return;
+    flush_interval(bbv);
+    free(bbv->map);
+    free(bbv->counts);
+    free(bbv->touched);
+    free(bbv);
+}
+
+static void grow_map(struct bbv* bbv) {
+    uint32_t old_mask = bbv->map_mask;
+    struct bbv_entry* old = bbv->map;
+    bbv->map_mask = 2 * old_mask + 1;
+    bbv->map = calloc(bbv->map_mask + 1, sizeof(struct bbv_entry));
+    if (!bbv->map) {
+        fprintf(stderr, "Out of memory in basic-block vectors\n");
+        exit(-1);
+    }
+    for (uint32_t i = 0; i <= old_mask; i++) {
+        if (!old[i].id) continue;
+        uint32_t j = (old[i].pc >> 2) & bbv->map_mask;
+        while (bbv->map[j].id) j = (j + 1) & bbv->map_mask;
+        bbv->map[j] = old[i];
+    }
+    free(old);
+}
+
+static uint32_t block_id(struct bbv* bbv, uint32_t pc) {
+    uint32_t j = (pc >> 2) & bbv->map_mask;
+    while (bbv->map[j].id) {
+        if (bbv->map[j].pc == pc) return bbv->map[j].id;
+        j = (j + 1) & bbv->map_mask;
+    }
+    uint32_t id = ++bbv->num_ids;
+    bbv->map[j].pc = pc;
+    bbv->map[j].id = id;
+    if (id > bbv->capacity) {
+        bbv->capacity = bbv->capacity ? 2 * bbv->capacity : 1024;
+        bbv->counts = xrealloc(bbv->counts, bbv->capacity * sizeof(long));
+        bbv->touched = xrealloc(bbv->touched, bbv->capacity * sizeof(uint32_t));
+    }
+    bbv->counts[id - 1] = 0;
+    // keep the load factor below one half
+    if (2 * bbv->num_ids > bbv->map_mask) grow_map(bbv);
+    return id;
+}
+
+void bbv_add(struct bbv* bbv, uint32_t pc, uint32_t n) {
+    uint32_t id = block_id(bbv, pc);
+    if (bbv->counts[id - 1] == 0)
+        bbv->touched[bbv->num_touched++] = id;
+    bbv->counts[id - 1] += n;
+    bbv->insns += n;
+    if (bbv->insns >= bbv->next_end) {
+        flush_interval(bbv);
+        // intervals stay aligned to multiples of 'interval'
+        while (bbv->next_end <= bbv->insns) bbv->next_end += bbv->interval;
+    }
+}
+
+long bbv_intervals(struct bbv* bbv) {
+    return bbv->intervals;
+}
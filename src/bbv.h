@@ -0,0 +1,32 @@
+#ifndef __BBV_H__
+#define __BBV_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// --- Basic-block vectors ---------------------------------------------------
+//
+// Counts the instructions executed in each basic block (by start address)
+// and writes one vector per interval of 'interval' instructions, in the
+// SimPoint .bb format:
+//
+//   T:<block id>:<instructions> :<block id>:<instructions> ...
+//
+// Block ids are 1, 2, ... in the order the blocks were first seen. An
+// interval ends at the first block boundary at or after a multiple of
+// 'interval' instructions, so interval k covers roughly the instructions
+// [k * interval, (k + 1) * interval) of the run.
+
+struct bbv;
+
+struct bbv* bbv_create(FILE* out, long interval);
+// writes the last, partial interval
+void bbv_delete(struct bbv* bbv);
+
+// 'n' instructions executed in the block starting at 'pc'
+void bbv_add(struct bbv* bbv, uint32_t pc, uint32_t n);
+
+// number of intervals written so far
+long bbv_intervals(struct bbv* bbv);
+
+#endif
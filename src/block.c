@@ -0,0 +1,117 @@
+#include "block.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_SIZE   (8u << 20)
+#define NUM_BUCKETS  (1u << 16)
+
+struct block_cache* block_cache_create(struct memory* mem, const void* const* handlers, int fuse) {
+    struct block_cache* bc = calloc(1, sizeof(struct block_cache));
+    if (!bc) return NULL;
+    bc->mem = mem;
+    bc->handlers = handlers;
+    bc->fuse = fuse;
+    bc->stop_pc = DECODE_NO_PC;
+    bc->arena_size = ARENA_SIZE;
+    bc->arena = malloc(bc->arena_size);
+    bc->buckets = calloc(NUM_BUCKETS, sizeof(struct block*));
+    bc->bucket_mask = NUM_BUCKETS - 1;
+    if (!bc->arena || !bc->buckets) {
+        block_cache_delete(bc);
+        return NULL;
+    }
+    return bc;
+}
+
+void block_cache_delete(struct block_cache* bc) {
+    if (!bc) return;
+    for (int j = 0; j < 0x10000; ++j) {
+        if (bc->code_bits[j]) free(bc->code_bits[j]);
+    }
+    free(bc->arena);
+    free(bc->buckets);
+    free(bc);
+}
+
+void block_cache_flush(struct block_cache* bc) {
+    bc->arena_used = 0;
+    memset(bc->buckets, 0, (bc->bucket_mask + 1) * sizeof(struct block*));
+    for (int j = 0; j < 0x10000; ++j) {
+        if (bc->code_bits[j]) memset(bc->code_bits[j], 0, DECODE_PAGE_WORDS / 8);
+    }
+    bc->flushes++;
+}
+
+static void mark_code(struct block_cache* bc, uint32_t addr) {
+    uint32_t** bits = &bc->code_bits[addr >> 16];
+    if (*bits == NULL) {
+        *bits = calloc(DECODE_PAGE_WORDS / 32, sizeof(uint32_t));
+        if (!*bits) {
+            fprintf(stderr, "Out of memory in block cache\n");
+            exit(-1);
+        }
+    }
+    uint32_t word = (addr >> 2) & (DECODE_PAGE_WORDS - 1);
+    (*bits)[word >> 5] |= 1u << (word & 31);
+}
+
+static int ends_block(int op) {
+    switch (op) {
+        case OP_BEQ: case OP_BNE: case OP_BLT:
+        case OP_BGE: case OP_BLTU: case OP_BGEU:
+        case OP_JAL: case OP_JALR:
+        case OP_ECALL: case OP_ILLEGAL:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+struct block* block_cache_translate(struct block_cache* bc, uint32_t pc) {
+    size_t max_size = sizeof(struct block) + (BLOCK_MAX_INSNS + 1) * sizeof(struct decoded);
+    if (bc->arena_used + max_size > bc->arena_size)
+        block_cache_flush(bc);
+
+    struct block* b = (struct block*)(bc->arena + bc->arena_used);
+    b->pc = pc;
+    b->next[BLOCK_FALLTHROUGH] = NULL;
+    b->next[BLOCK_TAKEN] = NULL;
+    b->heat = 0;
+    b->native = NULL;
+
+    uint32_t n = 0;
+    uint32_t addr = pc;
+    while (n < BLOCK_MAX_INSNS) {
+        if (n > 0 && addr == bc->stop_pc) break;
+        // memory_rd_w reports (and exits on) a misaligned fetch for us
+        uint32_t inst = (uint32_t) memory_rd_w(bc->mem, (int)addr);
+        struct decoded* d = &b->insns[n++];
+        decode_insn(addr, inst, d);
+        if (bc->handlers) d->handler = bc->handlers[d->op];
+        if (bc->fuse && n >= 2) {
+            struct decoded* prev = d - 1;
+            prev->op = (uint8_t)decode_fuse(prev, d, addr);
+            if (bc->handlers) prev->handler = bc->handlers[prev->op];
+        }
+        mark_code(bc, addr);
+        addr += 4;
+        if (ends_block(d->op)) break;
+    }
+    struct decoded* end = &b->insns[n];
+    memset(end, 0, sizeof(*end));
+    end->op = OP_UNDECODED;
+    if (bc->handlers) end->handler = bc->handlers[OP_UNDECODED];
+    b->n = n;
+
+    // keep records 8-byte aligned for the next block
+    size_t size = sizeof(struct block) + (n + 1) * sizeof(struct decoded);
+    bc->arena_used += (size + 7) & ~(size_t)7;
+
+    struct block** bucket = &bc->buckets[(pc >> 2) & bc->bucket_mask];
+    b->hash_next = *bucket;
+    *bucket = b;
+    bc->translations++;
+    return b;
+}
@@ -0,0 +1,93 @@
+#ifndef __BLOCK_H__
+#define __BLOCK_H__
+
+#include "memory.h"
+#include "decode.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Basic-block translation cache -----------------------------------------
+//
+// A block is a straight-line run of predecoded instructions starting at
+// 'pc' and ending with the first branch, JAL, JALR, ECALL or illegal
+// instruction (or when BLOCK_MAX_INSNS is reached, or in front of
+// stop_pc, so that an engine can stop there). insns[n] is always an
+// extra OP_UNDECODED record, which an engine can bind to its "fell off the
+// end of the block" handler. With fusion on, a record may hold a
+// superinstruction whose second half is the record after it.
+//
+// Blocks are chained: next[BLOCK_FALLTHROUGH] is the block at the
+// not-taken / next-instruction address, next[BLOCK_TAKEN] the block at the
+// branch or jump target (for JALR the last target seen, which must be
+// checked against the computed pc before use).
+//
+// All blocks live in one arena. When it fills up, or when a store hits a
+// translated instruction, the whole cache is flushed in one go: the arena
+// is reset, the hash table cleared and 'flushes' incremented. Engines must
+// not chain (or otherwise touch) a block obtained before a flush.
+
+#define BLOCK_MAX_INSNS 256
+#define BLOCK_FALLTHROUGH 0
+#define BLOCK_TAKEN 1
+
+// heat/native are the JIT tier's state: executions counted so far, and the
+// compiled code for the block once it is hot (see jit.h).
+struct block {
+    uint32_t pc;
+    uint32_t n;
+    struct block* next[2];
+    struct block* hash_next;
+    uint32_t heat;
+    void* native;
+    struct decoded insns[];
+};
+
+struct block_cache {
+    struct memory* mem;
+    const void* const* handlers;   // engine handler per op, or NULL
+    int fuse;                      // fuse instruction pairs (see decode.h)
+    uint32_t stop_pc;              // blocks end in front of this address
+
+    char* arena;
+    size_t arena_size;
+    size_t arena_used;
+
+    struct block** buckets;
+    uint32_t bucket_mask;
+
+    // one bit per word that is part of a translated block
+    uint32_t* code_bits[0x10000];
+
+    long flushes;
+    long translations;
+};
+
+// 'handlers' (indexed by op, may be NULL) is stored into every translated
+// record so that engines can dispatch directly on it.
+struct block_cache* block_cache_create(struct memory* mem, const void* const* handlers, int fuse);
+void block_cache_delete(struct block_cache* bc);
+
+// Drop every translated block
+void block_cache_flush(struct block_cache* bc);
+
+// slow path of block_cache_lookup - translates the block at pc
+struct block* block_cache_translate(struct block_cache* bc, uint32_t pc);
+
+static inline struct block* block_cache_lookup(struct block_cache* bc, uint32_t pc) {
+    struct block* b = bc->buckets[(pc >> 2) & bc->bucket_mask];
+    while (b) {
+        if (b->pc == pc) return b;
+        b = b->hash_next;
+    }
+    return block_cache_translate(bc, pc);
+}
+
+// Does a store to 'addr' hit a translated instruction?
+static inline int block_cache_is_code(struct block_cache* bc, uint32_t addr) {
+    uint32_t* bits = bc->code_bits[addr >> 16];
+    if (!bits) return 0;
+    uint32_t word = (addr >> 2) & (DECODE_PAGE_WORDS - 1);
+    return (bits[word >> 5] >> (word & 31)) & 1;
+}
+
+#endif
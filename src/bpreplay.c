@@ -0,0 +1,135 @@
+// bpreplay - runs a branch predictor over a recorded branch trace
+//
+//   sim prog.elf -trace prog.bt
+//   bpreplay prog.bt -b gshare 1024 [-p prof]
+//   bpreplay prog.bt -b bimodal:256,gshare:1024,nt
+//   bpreplay prog.bt -sweep specs [-j threads] [-o out.csv]
+//
+// The trace (see trace.h), plain or compressed, is memory-mapped and every
+// record is fed to the predictor's predict and update, so predictors can be
+// compared without simulating the program again. The report has the same lines as the
+// branch part of sim's -p profile, with the instruction count the trace
+// was recorded over, and goes to stdout unless -p names a file.
+//
+// -sweep runs every predictor spec of a file instead, spread over the host
+// cores, and writes one CSV line per spec (see replay_sweep in replay.h).
+// -scalar keeps the counter banks off AVX2, for checking it.
+//
+#include "predictor.h"
+#include "replay.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static void terminate(const char *error)
+{
+  printf("%s\n", error);
+  printf("Branch trace replay: Usage:\n");
+  printf("  bpreplay trace -b <nt|btfnt|bimodal|gshare|bimode|agree|yags|tage|\n"
+         "                   perceptron[/history]|\n"
+         "                   local[/history[/bht size]]|tournament[/local+global]> [size] [-p prof]\n");
+  printf("  bpreplay trace -b name[:size],name[:size],... [-p prof]\n");
+  printf("  bpreplay trace -sweep specs [-j threads] [-scalar] [-o out.csv]\n");
+  exit(-1);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) terminate("Missing operands");
+
+  const char* pred_name = NULL;
+  int pred_size = 0;
+  int pred_list = 0;
+  const char* prof_name = NULL;
+  const char* sweep_specs = NULL;
+  const char* csv_name = NULL;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int simd = 1;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-b")) {
+      if (i + 1 >= argc) terminate("Missing predictor after -b");
+      pred_name = argv[++i];
+      pred_list = strchr(pred_name, ':') || strchr(pred_name, ',');
+      if (!pred_list && predictor_has_size(pred_name)) {
+        if (i + 1 >= argc) terminate("Missing predictor size");
+        pred_size = atoi(argv[++i]);
+      }
+    } else if (!strcmp(argv[i], "-p")) {
+      if (i + 1 >= argc) terminate("Missing file name after -p");
+      prof_name = argv[++i];
+    } else if (!strcmp(argv[i], "-sweep")) {
+      if (i + 1 >= argc) terminate("Missing spec file after -sweep");
+      sweep_specs = argv[++i];
+    } else if (!strcmp(argv[i], "-j")) {
+      if (i + 1 >= argc) terminate("Missing thread count after -j");
+      threads = atoi(argv[++i]);
+      if (threads < 1) terminate("Thread count must be at least 1");
+    } else if (!strcmp(argv[i], "-scalar")) {
+      simd = 0;
+    } else if (!strcmp(argv[i], "-o")) {
+      if (i + 1 >= argc) terminate("Missing file name after -o");
+      csv_name = argv[++i];
+    } else {
+      terminate("Unknown option");
+    }
+  }
+  if (!pred_name == !sweep_specs) terminate("Give either -b or -sweep");
+  if (threads < 1) threads = 1;
+
+  struct trace_file trace;
+  if (trace_open(argv[1], &trace)) exit(-1);
+
+  if (sweep_specs) {
+    FILE* csv = stdout;
+    if (csv_name) {
+      csv = fopen(csv_name, "w");
+      if (!csv) terminate("Could not open CSV file, terminating.");
+    }
+    if (replay_sweep(&trace, sweep_specs, (int)threads, simd, csv)) exit(-1);
+    if (csv_name) fclose(csv);
+    trace_close(&trace);
+    return 0;
+  }
+
+  struct Predictor* predictor = pred_list ? predictor_create_list(pred_name)
+                                          : predictor_create(pred_name, pred_size);
+  if (!predictor) terminate("Unknown predictor or bad size");
+  // the profile is always printed, so always with the aliasing part
+  if (predictor_track_aliasing(predictor)) terminate("Could not allocate aliasing statistics");
+
+  struct timespec before, after;
+  clock_gettime(CLOCK_MONOTONIC, &before);
+  struct BPStats bpstats = { (long)trace.header->count, 0 };
+  struct trace_decoder* dec = trace.records ? NULL : trace_decoder_create();
+  for (uint64_t b = 0; b < trace.num_blocks; b++) {
+    uint32_t n;
+    const struct trace_record* r = trace_block(&trace, b, dec, &n);
+    bpstats.mispredictions += replay(predictor, r, n);
+  }
+  trace_decoder_delete(dec);
+  clock_gettime(CLOCK_MONOTONIC, &after);
+  double seconds = (after.tv_sec - before.tv_sec) + 1e-9 * (after.tv_nsec - before.tv_nsec);
+  long num_insns = (long)trace.header->insns;
+
+  FILE* prof_file = stdout;
+  if (prof_name) {
+    prof_file = fopen(prof_name, "w");
+    if (!prof_file) terminate("Could not open profile file, terminating.");
+  }
+  fprintf(prof_file, "Predictor: %s\n", pred_name);
+  if (!pred_list && predictor_has_size(pred_name)) {
+    fprintf(prof_file, "Size: %d\n", pred_size);
+  }
+  fprintf(prof_file, "Instructions: %ld\n", num_insns);
+  predictor_print_stats(prof_file, predictor, &bpstats, num_insns);
+  if (prof_name) fclose(prof_file);
+  fprintf(stderr, "Replayed %ld branches in %.3f s (%.1f M branches/s)\n", bpstats.total_branches,
+          seconds, seconds > 0.0 ? bpstats.total_branches / seconds / 1e6 : 0.0);
+
+  trace_close(&trace);
+  predictor->destroy(predictor);
+  return 0;
+}
@@ -0,0 +1,235 @@
+#include "btb.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct btb_entry {
+    uint32_t pc;
+    uint32_t target;
+    uint64_t stamp;     // last use (LRU) or allocation (FIFO); 0 = free
+};
+
+struct indirect_entry {
+    uint32_t target;
+    uint16_t tag;
+    uint8_t miss;       // the last prediction from this entry was wrong
+    uint64_t stamp;     // last use, for LRU; 0 = free
+};
+
+struct btb {
+    int sets, ways;
+    enum btb_replacement replacement;
+    struct btb_entry* entries;  // sets * ways, one set after the other
+    uint64_t clock;
+    uint64_t random;            // xorshift64 state for BTB_RANDOM
+
+    uint32_t* ras;
+    int ras_entries;
+    int ras_top;                // next free slot, mod ras_entries
+    int ras_count;              // valid entries, up to ras_entries
+
+    struct indirect_entry* indirect;    // NULL for none; BTB_INDIRECT_WAYS per set
+    int indirect_entries;
+    int path_length;
+    uint32_t path[BTB_MAX_PATH];        // last indirect targets, circular
+    int path_pos;                       // slot of the next one
+
+    struct btb_stats stats;
+};
+
+static const char* const replacement_names[] = {
+    [BTB_LRU]    = "lru",
+    [BTB_FIFO]   = "fifo",
+    [BTB_RANDOM] = "random",
+};
+
+struct btb* btb_create(int sets, int ways, enum btb_replacement replacement, int ras_entries,
+                       int indirect_entries, int path) {
+    if (sets < 1 || (sets & (sets - 1)) || ways < 1 || ras_entries < 1) return NULL;
+    if (indirect_entries < 0 || (indirect_entries & (indirect_entries - 1))) return NULL;
+    if (indirect_entries && indirect_entries < BTB_INDIRECT_WAYS) return NULL;
+    if (path < 0 || path > BTB_MAX_PATH) return NULL;
+    struct btb* btb = calloc(1, sizeof(struct btb));
+    if (!btb) return NULL;
+    btb->sets = sets;
+    btb->ways = ways;
+    btb->replacement = replacement;
+    btb->random = 0x9e3779b97f4a7c15ull;
+    btb->entries = calloc((size_t)sets * (size_t)ways, sizeof(struct btb_entry));
+    btb->ras = calloc((size_t)ras_entries, sizeof(uint32_t));
+    btb->ras_entries = ras_entries;
+    btb->indirect_entries = indirect_entries;
+    btb->path_length = path;
+    if (indirect_entries) btb->indirect = calloc((size_t)indirect_entries, sizeof(struct indirect_entry));
+    if (!btb->entries || !btb->ras || (indirect_entries && !btb->indirect)) {
+        btb_delete(btb);
+        return NULL;
+    }
+    return btb;
+}
+
+void btb_delete(struct btb* btb) {
+    if (!btb) return;
+    free(btb->entries);
+    free(btb->ras);
+    free(btb->indirect);
+    free(btb);
+}
+
+int btb_parse_replacement(const char* name) {
+    for (int k = 0; k <= BTB_RANDOM; k++) {
+        if (!strcmp(name, replacement_names[k])) return k;
+    }
+    return -1;
+}
+
+// Entry of the set for pc that is replaced on a miss
+static struct btb_entry* victim(struct btb* btb, struct btb_entry* set) {
+    for (int w = 0; w < btb->ways; w++) {
+        if (set[w].stamp == 0) return &set[w];
+    }
+    if (btb->replacement == BTB_RANDOM) {
+        btb->random ^= btb->random << 13;
+        btb->random ^= btb->random >> 7;
+        btb->random ^= btb->random << 17;
+        return &set[btb->random % (uint64_t)btb->ways];
+    }
+    // LRU and FIFO differ only in when the stamp is set
+    struct btb_entry* oldest = &set[0];
+    for (int w = 1; w < btb->ways; w++) {
+        if (set[w].stamp < oldest->stamp) oldest = &set[w];
+    }
+    return oldest;
+}
+
+// Predicts the indirect jump at pc from the target cache, falling back to
+// 'guess' (the BTB's target, or 0 on a BTB miss), then trains the entry
+// and the path history with the actual target
+static uint32_t indirect_predict_update(struct btb* btb, uint32_t pc, uint32_t target, uint32_t guess) {
+    if (!btb->indirect) return guess;
+    // the pc goes through the multiplier too, so the tag depends on it
+    // even without a path
+    uint64_t h = (uint64_t)(pc >> 2) * 0x9e3779b97f4a7c15ull;
+    for (int k = 1; k <= btb->path_length; k++) {
+        uint32_t t = btb->path[(btb->path_pos + BTB_MAX_PATH - k) % BTB_MAX_PATH];
+        h = (h ^ (t >> 2)) * 0x9e3779b97f4a7c15ull;
+    }
+    h ^= h >> 29;
+    uint64_t sets = (uint64_t)(btb->indirect_entries / BTB_INDIRECT_WAYS);
+    struct indirect_entry* set = &btb->indirect[(h & (sets - 1)) * BTB_INDIRECT_WAYS];
+    uint16_t tag = (uint16_t)(h >> 48);
+    struct indirect_entry* e = NULL;
+    for (int w = 0; w < BTB_INDIRECT_WAYS && !e; w++) {
+        if (set[w].stamp != 0 && set[w].tag == tag) e = &set[w];
+    }
+    uint32_t predicted = guess;
+    if (e) {
+        predicted = e->target;
+        if (predicted == target) e->miss = 0;
+        else if (e->miss) e->target = target;
+        else e->miss = 1;
+    } else {
+        e = &set[0];
+        for (int w = 1; w < BTB_INDIRECT_WAYS; w++) {
+            if (set[w].stamp < e->stamp) e = &set[w];
+        }
+        *e = (struct indirect_entry){ .target = target, .tag = tag };
+    }
+    e->stamp = btb->clock;
+    btb->path[btb->path_pos] = target;
+    btb->path_pos = (btb->path_pos + 1) % BTB_MAX_PATH;
+    return predicted;
+}
+
+void btb_transfer(struct btb* btb, uint32_t pc, uint32_t target, enum btb_kind kind) {
+    struct btb_stats* s = &btb->stats;
+    btb->clock++;
+
+    s->lookups[kind]++;
+    struct btb_entry* set = &btb->entries[(size_t)((pc >> 2) & (uint32_t)(btb->sets - 1)) * (size_t)btb->ways];
+    struct btb_entry* e = NULL;
+    for (int w = 0; w < btb->ways; w++) {
+        if (set[w].stamp != 0 && set[w].pc == pc) {
+            e = &set[w];
+            break;
+        }
+    }
+    uint32_t btb_target = e ? e->target : 0;
+    if (e) {
+        s->hits[kind]++;
+        if (kind != BTB_RETURN && e->target != target) s->wrong_targets++;
+        if (btb->replacement == BTB_LRU) e->stamp = btb->clock;
+    } else {
+        e = victim(btb, set);
+        e->pc = pc;
+        e->stamp = btb->clock;
+    }
+    e->target = target;
+
+    if (kind == BTB_INDIRECT || kind == BTB_INDIRECT_CALL) {
+        s->indirect++;
+        s->indirect_btb += btb_target == target;
+        s->indirect_correct += indirect_predict_update(btb, pc, target, btb_target) == target;
+    }
+    if (kind == BTB_CALL || kind == BTB_INDIRECT_CALL) {
+        if (btb->ras_count == btb->ras_entries) s->ras_overflows++;
+        else btb->ras_count++;
+        btb->ras[btb->ras_top] = pc + 4;
+        btb->ras_top = (btb->ras_top + 1) % btb->ras_entries;
+    } else if (kind == BTB_RETURN) {
+        s->returns++;
+        if (btb->ras_count > 0) {
+            btb->ras_top = (btb->ras_top + btb->ras_entries - 1) % btb->ras_entries;
+            btb->ras_count--;
+            if (btb->ras[btb->ras_top] == target) s->ras_correct++;
+        }
+    }
+}
+
+const struct btb_stats* btb_stats(const struct btb* btb) {
+    return &btb->stats;
+}
+
+static double percent(long part, long whole) {
+    return whole ? (100.0 * (double)part) / (double)whole : 0.0;
+}
+
+void btb_report(const struct btb* btb, FILE* f) {
+    static const char* const kind_names[BTB_KINDS] = {
+        [BTB_BRANCH]        = "branches",
+        [BTB_JUMP]          = "jumps",
+        [BTB_CALL]          = "calls",
+        [BTB_RETURN]        = "returns",
+        [BTB_INDIRECT]      = "indirect jumps",
+        [BTB_INDIRECT_CALL] = "indirect calls",
+    };
+    const struct btb_stats* s = &btb->stats;
+    long lookups = 0, hits = 0;
+    for (int k = 0; k < BTB_KINDS; k++) {
+        lookups += s->lookups[k];
+        hits += s->hits[k];
+    }
+    fprintf(f, "BTB: %d sets, %d ways, %s replacement\n", btb->sets, btb->ways,
+            replacement_names[btb->replacement]);
+    fprintf(f, "BTB lookups: %ld\n", lookups);
+    fprintf(f, "BTB hits: %ld (%.2f%%)\n", hits, percent(hits, lookups));
+    for (int k = 0; k < BTB_KINDS; k++) {
+        fprintf(f, "BTB hits, %s: %ld of %ld (%.2f%%)\n", kind_names[k], s->hits[k], s->lookups[k],
+                percent(s->hits[k], s->lookups[k]));
+    }
+    fprintf(f, "BTB wrong targets: %ld\n", s->wrong_targets);
+    fprintf(f, "RAS: %d entries\n", btb->ras_entries);
+    fprintf(f, "RAS returns: %ld\n", s->returns);
+    fprintf(f, "RAS correct: %ld (%.2f%%)\n", s->ras_correct, percent(s->ras_correct, s->returns));
+    fprintf(f, "RAS overflows: %ld\n", s->ras_overflows);
+    fprintf(f, "Indirect jumps and calls: %ld\n", s->indirect);
+    fprintf(f, "Indirect correct, BTB target: %ld (%.2f%%)\n", s->indirect_btb,
+            percent(s->indirect_btb, s->indirect));
+    if (btb->indirect) {
+        fprintf(f, "Indirect target cache: %d entries, path of %d targets\n", btb->indirect_entries,
+                btb->path_length);
+        fprintf(f, "Indirect correct, target cache: %ld (%.2f%%)\n", s->indirect_correct,
+                percent(s->indirect_correct, s->indirect));
+    }
+}
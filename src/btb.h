@@ -0,0 +1,94 @@
+#ifndef __BTB_H__
+#define __BTB_H__
+
+#include "decode.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// --- Branch target buffer and return address stack -------------------------
+//
+// Models the front end's target prediction for every control transfer the
+// program takes. The BTB is set associative: 'sets' sets (a power of two,
+// indexed by pc >> 2) of 'ways' entries, each holding a full pc as tag and
+// the target the transfer went to last time. Only taken transfers are
+// looked up, since those are the ones where a miss costs a redirect; a
+// miss allocates an entry, picking the victim by the replacement policy.
+//
+// Calls (JAL/JALR with rd = ra) push their return address on the return
+// address stack, and returns (jalr x0, 0(ra)) pop it as their predicted
+// target. The stack is circular: a push on a full stack overwrites the
+// oldest entry, as in hardware. Returns are still looked up in the BTB,
+// which is where the front end learns that the instruction is a return,
+// but their target comes from the stack.
+//
+// Other JALRs (function pointers, switch tables) can also get an indirect
+// target cache: a tagged, set-associative LRU table indexed by the pc
+// hashed with the path of the last few indirect targets, so one JALR can
+// have a different target for each way the program got to it. An entry
+// only changes its target after missing twice in a row. On a tag miss,
+// and without a target cache, the prediction is the target the BTB holds.
+
+enum btb_replacement {
+    BTB_LRU,
+    BTB_FIFO,
+    BTB_RANDOM,
+};
+
+// How a transfer is predicted
+enum btb_kind {
+    BTB_BRANCH,         // taken conditional branch
+    BTB_JUMP,           // JAL that is not a call
+    BTB_CALL,           // JAL with rd = ra: pushes the RAS
+    BTB_RETURN,         // jalr x0, 0(ra): pops the RAS
+    BTB_INDIRECT,       // any other JALR but an indirect call
+    BTB_INDIRECT_CALL,  // JALR with rd = ra: pushes the RAS
+    BTB_KINDS
+};
+
+struct btb_stats {
+    long lookups[BTB_KINDS];
+    long hits[BTB_KINDS];       // the pc was in the BTB
+    long wrong_targets;         // hits with a stale target (not returns)
+    long returns;
+    long ras_correct;           // returns that went where the RAS said
+    long ras_overflows;         // pushes that overwrote the oldest entry
+    long indirect;              // BTB_INDIRECT and BTB_INDIRECT_CALL
+    long indirect_btb;          // of those, where the BTB's last target was right
+    long indirect_correct;      // predicted right by the target cache (or BTB)
+};
+
+// longest path the indirect target cache hashes in, and its associativity
+#define BTB_MAX_PATH 16
+#define BTB_INDIRECT_WAYS 4
+
+struct btb;
+
+// NULL if out of memory. 'sets' must be a power of two, 'ways' and
+// 'ras_entries' at least 1. 'indirect_entries' is the size of the indirect
+// target cache (a power of two of at least BTB_INDIRECT_WAYS, or 0 for
+// none), and 'path' the number of targets (0 .. BTB_MAX_PATH) in its path
+// history.
+struct btb* btb_create(int sets, int ways, enum btb_replacement replacement, int ras_entries,
+                       int indirect_entries, int path);
+void btb_delete(struct btb* btb);
+
+// "lru", "fifo" or "random"; -1 for anything else
+int btb_parse_replacement(const char* name);
+
+// One taken transfer from pc to target
+void btb_transfer(struct btb* btb, uint32_t pc, uint32_t target, enum btb_kind kind);
+
+const struct btb_stats* btb_stats(const struct btb* btb);
+
+// Configuration and statistics, for the -p profile
+void btb_report(const struct btb* btb, FILE* f);
+
+// Kind of a JAL or JALR record (rd == x0 is REG_SINK, see decode.h)
+static inline enum btb_kind btb_kind(const struct decoded* d) {
+    if (d->op == OP_JAL) return d->rd == 1 ? BTB_CALL : BTB_JUMP;
+    if (d->rd == 1) return BTB_INDIRECT_CALL;
+    if (d->rd == REG_SINK && d->rs1 == 1 && d->imm == 0) return BTB_RETURN;
+    return BTB_INDIRECT;
+}
+
+#endif
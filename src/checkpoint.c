@@ -0,0 +1,70 @@
+#include "checkpoint.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// File layout:
+//   "RVCKPT1\n"
+//   pc, regs[32], insns
+//   memory (see memory_save)
+//   predictor kind (enum predictor_kind, -1 for none), tables flag,
+//   tables (see Predictor.save) if the flag is set
+static const char magic[8] = "RVCKPT1\n";
+
+int checkpoint_save(const char* name, const struct checkpoint* cp,
+                    struct memory* mem, struct Predictor* predictor) {
+    FILE* f = fopen(name, "wb");
+    if (!f) {
+        fprintf(stderr, "Could not create checkpoint %s\n", name);
+        return -1;
+    }
+    int32_t kind = predictor ? (int32_t)predictor->kind : -1;
+    int32_t tables = predictor && predictor->save;
+    int ok = fwrite(magic, sizeof(magic), 1, f) == 1
+          && fwrite(&cp->pc, sizeof(cp->pc), 1, f) == 1
+          && fwrite(cp->regs, sizeof(cp->regs), 1, f) == 1
+          && fwrite(&cp->insns, sizeof(cp->insns), 1, f) == 1
+          && memory_save(mem, f) == 0
+          && fwrite(&kind, sizeof(kind), 1, f) == 1
+          && fwrite(&tables, sizeof(tables), 1, f) == 1
+          && (!tables || predictor->save(predictor, f) == 0);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "Could not write checkpoint %s\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+int checkpoint_load(const char* name, struct checkpoint* cp,
+                    struct memory* mem, struct Predictor* predictor) {
+    FILE* f = fopen(name, "rb");
+    if (!f) {
+        fprintf(stderr, "Could not open checkpoint %s\n", name);
+        return -1;
+    }
+    char m[sizeof(magic)];
+    int32_t kind, tables;
+    int ok = fread(m, sizeof(m), 1, f) == 1 && !memcmp(m, magic, sizeof(magic))
+          && fread(&cp->pc, sizeof(cp->pc), 1, f) == 1
+          && fread(cp->regs, sizeof(cp->regs), 1, f) == 1
+          && fread(&cp->insns, sizeof(cp->insns), 1, f) == 1
+          && memory_load(mem, f) == 0
+          && fread(&kind, sizeof(kind), 1, f) == 1
+          && fread(&tables, sizeof(tables), 1, f) == 1;
+    if (!ok) {
+        fprintf(stderr, "Checkpoint %s is damaged or not a checkpoint\n", name);
+        fclose(f);
+        return -1;
+    }
+    if (predictor && tables) {
+        if (kind != (int32_t)predictor->kind || !predictor->load ||
+            predictor->load(predictor, f) != 0) {
+            fprintf(stderr, "Checkpoint %s holds tables for a different predictor\n", name);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include "memory.h"
+#include "predictor.h"
+#include <stdint.h>
+
+// --- Machine checkpoints ---------------------------------------------------
+//
+// A checkpoint file holds the architectural state of a run (pc, x0..x31
+// and every allocated memory page) and, if the run had a predictor with
+// tables, those tables, so that a later run can skip both the program's
+// start-up and the predictor warm-up. The file is in host byte order and
+// only meant to be read back by the same simulator build.
+
+struct checkpoint {
+    uint32_t pc;
+    int32_t regs[32];
+    long insns;         // executed up to the checkpoint, since program start
+};
+
+// Returns 0 on success; on failure reports why on stderr and returns -1
+int checkpoint_save(const char* name, const struct checkpoint* cp,
+                    struct memory* mem, struct Predictor* predictor);
+
+// Restores memory and, if 'predictor' is given and the checkpoint has
+// tables for the same kind and size of predictor, its tables. A checkpoint
+// without predictor tables leaves 'predictor' as it is (cold).
+int checkpoint_load(const char* name, struct checkpoint* cp,
+                    struct memory* mem, struct Predictor* predictor);
+
+#endif
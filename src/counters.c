@@ -0,0 +1,178 @@
+#include "counters.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// steps between folds of the 32-bit miss counters
+#define FOLD_STEPS (1u << 30)
+
+static void fold(struct counters_state* s) {
+    for (int i = 0; i < s->n; i++) {
+        s->miss[i] += s->miss32[i];
+        s->miss32[i] = 0;
+    }
+    s->steps = 0;
+}
+
+static inline int finish_step(struct counters_state* s, int taken, int first) {
+    s->ghr = (s->ghr << 1) | (taken ? 1u : 0u);
+    s->branches++;
+    if (++s->steps == FOLD_STEPS) fold(s);
+    return first;
+}
+
+static int step_scalar(struct counters_state* s, uint32_t instr_pc, int taken) {
+    uint32_t pc_index = instr_pc >> 2;
+    int first = NOT_TAKEN;
+    for (int i = 0; i < s->n; i++) {
+        uint32_t idx = (pc_index ^ (s->ghr & s->hist_mask[i])) & s->idx_mask[i];
+        uint8_t* ctr = &s->tables[s->offset[i] + idx];
+        int predicted = *ctr >= 2 ? TAKEN : NOT_TAKEN;
+        s->miss32[i] += predicted != taken;
+        *ctr = counter_next(*ctr, taken);
+        if (i == 0) first = predicted;
+    }
+    return finish_step(s, taken, first);
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static int step_avx2(struct counters_state* s, uint32_t instr_pc, int taken) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i three = _mm256_set1_epi32(3);
+    const __m256i low_byte = _mm256_set1_epi32(0xff);
+    __m256i pc_index = _mm256_set1_epi32((int)(instr_pc >> 2));
+    __m256i ghr = _mm256_set1_epi32((int)s->ghr);
+    __m256i outcome = _mm256_set1_epi32(taken ? -1 : 0);
+    int first = NOT_TAKEN;
+    for (int v = 0; v < s->lanes; v += 8) {
+        __m256i hist = _mm256_and_si256(ghr, _mm256_loadu_si256((const __m256i*)&s->hist_mask[v]));
+        __m256i idx = _mm256_and_si256(_mm256_xor_si256(pc_index, hist),
+                                       _mm256_loadu_si256((const __m256i*)&s->idx_mask[v]));
+        __m256i addr = _mm256_add_epi32(idx, _mm256_loadu_si256((const __m256i*)&s->offset[v]));
+        // 4-byte gathers; the arena is padded so the last counter can be read
+        __m256i ctr = _mm256_and_si256(_mm256_i32gather_epi32((const int*)s->tables, addr, 1), low_byte);
+
+        // all ones where the lane predicts taken, and where it was wrong
+        __m256i predicted = _mm256_cmpgt_epi32(ctr, one);
+        __m256i wrong = _mm256_xor_si256(predicted, outcome);
+        __m256i* miss = (__m256i*)&s->miss32[v];
+        _mm256_storeu_si256(miss, _mm256_sub_epi32(_mm256_loadu_si256(miss), wrong));
+        if (v == 0) first = _mm256_cvtsi256_si32(predicted) & 1;
+
+        __m256i next = taken ? _mm256_min_epi32(_mm256_add_epi32(ctr, one), three)
+                             : _mm256_max_epi32(_mm256_sub_epi32(ctr, one), _mm256_setzero_si256());
+        // saturated counters do not change, so most steps write nothing back
+        unsigned changed = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(next, ctr))) & 0xffu;
+        if (changed) {
+            uint32_t a[8], c[8];
+            _mm256_storeu_si256((__m256i*)a, addr);
+            _mm256_storeu_si256((__m256i*)c, next);
+            for (; changed; changed &= changed - 1) {
+                int lane = __builtin_ctz(changed);
+                s->tables[a[lane]] = (uint8_t)c[lane];
+            }
+        }
+    }
+    return finish_step(s, taken, first);
+}
+#endif
+
+static int counters_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct counters_state* s = (struct counters_state*) self->state;
+    (void)target_pc;
+    uint32_t idx = ((instr_pc >> 2) ^ (s->ghr & s->hist_mask[0])) & s->idx_mask[0];
+    return s->tables[s->offset[0] + idx] >= 2 ? TAKEN : NOT_TAKEN;
+}
+static void counters_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct counters_state* s = (struct counters_state*) self->state;
+    (void)target_pc;
+    s->step(s, instr_pc, taken);
+}
+static void counters_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct counters_state* s = (struct counters_state*) self->state;
+    if (s) {
+        free(s->tables);
+        free(s);
+    }
+    free(self);
+}
+
+// the tables of the lanes in use, without the padding
+static size_t tables_size(const struct counters_state* s) {
+    return s->offset[s->n - 1] + s->sizes[s->n - 1];
+}
+static int counters_save(struct Predictor* self, FILE* f) {
+    struct counters_state* s = (struct counters_state*) self->state;
+    if (fwrite(&s->n, sizeof(s->n), 1, f) != 1) return -1;
+    if (fwrite(s->sizes, sizeof(int), s->n, f) != (size_t)s->n) return -1;
+    if (fwrite(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    return fwrite(s->tables, 1, tables_size(s), f) == tables_size(s) ? 0 : -1;
+}
+static int counters_load(struct Predictor* self, FILE* f) {
+    struct counters_state* s = (struct counters_state*) self->state;
+    int n, sizes[COUNTERS_MAX];
+    if (fread(&n, sizeof(n), 1, f) != 1 || n != s->n) return -1;
+    if (fread(sizes, sizeof(int), n, f) != (size_t)n || memcmp(sizes, s->sizes, n * sizeof(int))) return -1;
+    if (fread(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    return fread(s->tables, 1, tables_size(s), f) == tables_size(s) ? 0 : -1;
+}
+
+struct Predictor* predictor_counters(const enum predictor_kind* kinds, const int* sizes, int n, int simd) {
+    if (n < 1 || n > COUNTERS_MAX) return NULL;
+    struct counters_state* s = calloc(1, sizeof(struct counters_state));
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    if (!s || !p) { free(s); free(p); return NULL; }
+    s->n = n;
+    s->lanes = (n + 7) & ~7;
+    uint32_t total = 0;
+    for (int i = 0; i < n; i++) {
+        int size = sizes[i];
+        if ((kinds[i] != PREDICTOR_BIMODAL && kinds[i] != PREDICTOR_GSHARE) ||
+            size <= 0 || (size & (size - 1)) || size > (1 << 28)) {
+            free(s); free(p);
+            return NULL;
+        }
+        s->kinds[i] = kinds[i];
+        s->sizes[i] = size;
+        s->idx_mask[i] = size - 1;
+        s->hist_mask[i] = kinds[i] == PREDICTOR_GSHARE ? (uint32_t)size - 1 : 0;
+        s->offset[i] = total;
+        total += size;
+    }
+    // padding lanes get a counter of their own past the real tables
+    for (int i = n; i < s->lanes; i++) s->offset[i] = total + (i - n);
+    s->tables = malloc(total + (s->lanes - n) + 3);
+    if (!s->tables) { free(s); free(p); return NULL; }
+    memset(s->tables, 2, total + (s->lanes - n) + 3);   /* weakly taken */
+
+    s->step = step_scalar;
+#ifdef __x86_64__
+    if (simd && __builtin_cpu_supports("avx2")) s->step = step_avx2;
+#else
+    (void)simd;
+#endif
+    p->predict = counters_predict;
+    p->update  = counters_update;
+    p->destroy = counters_destroy;
+    p->save    = counters_save;
+    p->load    = counters_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_COUNTERS;
+    p->state   = s;
+    return p;
+}
+
+void counters_stats(struct Predictor* p, struct BPStats* stats) {
+    struct counters_state* s = (struct counters_state*) p->state;
+    fold(s);
+    for (int i = 0; i < s->n; i++) {
+        stats[i].total_branches = s->branches;
+        stats[i].mispredictions = s->miss[i];
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef __COUNTERS_H__
+#define __COUNTERS_H__
+
+#include "predictor.h"
+#include <stdint.h>
+
+// --- Counter banks ---------------------------------------------------------
+//
+// A bank holds the 2-bit counter tables of up to COUNTERS_MAX bimodal and
+// gshare configurations side by side, one lane each, and steps all of them
+// for every branch: the indices, predictions, counter updates and
+// misprediction counts of 8 lanes at a time are computed in AVX2 registers
+// (table reads are gathers; only counters that change are written back).
+// A scalar path gives identical results, on hosts without AVX2 or on
+// request.
+//
+// Every lane behaves exactly like its predictor_bimodal/predictor_gshare
+// would on its own. The gshare lanes share one global history register,
+// each using as many of its bits as its table has index bits.
+//
+// As a struct Predictor a bank predicts like lane 0 and keeps its own
+// misprediction count for every lane (see counters_stats).
+
+#define COUNTERS_MAX 32
+
+struct counters_state {
+    int n;                      // lanes in use
+    int lanes;                  // n rounded up to a multiple of 8
+    uint32_t ghr;               // newest outcome in bit 0
+    uint32_t idx_mask[COUNTERS_MAX];
+    uint32_t hist_mask[COUNTERS_MAX];   // 0 for bimodal lanes
+    uint32_t offset[COUNTERS_MAX];      // of each table in 'tables'
+    uint8_t* tables;
+    int sizes[COUNTERS_MAX];
+    enum predictor_kind kinds[COUNTERS_MAX];
+
+    // mispredictions are counted in 32-bit lanes and folded into 'miss'
+    // before they can overflow
+    uint32_t miss32[COUNTERS_MAX];
+    long miss[COUNTERS_MAX];
+    long branches;
+    uint32_t steps;             // since the last fold
+
+    int (*step)(struct counters_state* s, uint32_t instr_pc, int taken);
+};
+
+// kinds[i] is PREDICTOR_BIMODAL or PREDICTOR_GSHARE and sizes[i] its table
+// size in entries (a power of two). The AVX2 path is used if 'simd' is set
+// and the host has AVX2. NULL for a bad configuration or n outside
+// 1..COUNTERS_MAX.
+struct Predictor* predictor_counters(const enum predictor_kind* kinds, const int* sizes, int n, int simd);
+
+// Predicts every lane, updates every lane with the outcome and returns the
+// prediction of lane 0, like predict() followed by update()
+static inline int counters_predict_update(struct counters_state* s, uint32_t instr_pc, int taken) {
+    return s->step(s, instr_pc, taken);
+}
+
+// Statistics of lanes 0..n-1
+void counters_stats(struct Predictor* p, struct BPStats* stats);
+
+#endif
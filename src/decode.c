@@ -0,0 +1,308 @@
+#include "decode.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// --- Small helpers ---------------------------------------------------------
+
+// Sign-extend 'val' which is 'bits' wide (bits <= 32)
+static int32_t sext(int32_t val, int bits) {
+    int32_t m = 1 << (bits - 1);
+    return (val ^ m) - m;
+}
+
+// I-type immediate (12-bit)
+static int32_t imm_i(uint32_t inst) {
+    int32_t imm = (int32_t)(inst >> 20);
+    return sext(imm, 12);
+}
+
+// S-type immediate (12-bit)
+static int32_t imm_s(uint32_t inst) {
+    uint32_t imm = ((inst >> 7) & 0x1f) | (((inst >> 25) & 0x7f) << 5);
+    return sext((int32_t)imm, 12);
+}
+
+// B-type immediate (branch, 13-bit incl. sign, then << 1)
+static int32_t imm_b(uint32_t inst) {
+    uint32_t imm = 0;
+    imm |= ((inst >> 8) & 0x0f) << 1;      // bits 4:1
+    imm |= ((inst >> 25) & 0x3f) << 5;     // bits 10:5
+    imm |= ((inst >> 7) & 0x01) << 11;     // bit 11
+    imm |= ((inst >> 31) & 0x01) << 12;    // bit 12 (sign)
+    return sext((int32_t)imm, 13);
+}
+
+// U-type immediate (upper 20 bits, already aligned)
+static int32_t imm_u(uint32_t inst) {
+    return (int32_t)(inst & 0xfffff000);
+}
+
+// J-type immediate (jump, 21-bit incl. sign, then << 1)
+static int32_t imm_j(uint32_t inst) {
+    uint32_t imm = 0;
+    imm |= ((inst >> 21) & 0x3ff) << 1;    // bits 10:1
+    imm |= ((inst >> 20) & 0x001) << 11;   // bit 11
+    imm |= ((inst >> 12) & 0x0ff) << 12;   // bits 19:12
+    imm |= ((inst >> 31) & 0x001) << 20;   // bit 20 (sign)
+    return sext((int32_t)imm, 21);
+}
+
+// --- Decoder ---------------------------------------------------------------
+//
+// The mapping follows what the original switch-based simulate() accepted:
+// e.g. funct7 = 0x20 only matters for ADD/SUB and SRL/SRA, and SLLI ignores
+// funct7. Anything it rejected decodes to OP_ILLEGAL.
+//
+static int decode_op(uint32_t inst) {
+    uint32_t opcode = inst & 0x7f;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t funct7 = (inst >> 25) & 0x7f;
+
+    switch (opcode) {
+        case 0x37: return OP_LUI;
+        case 0x17: return OP_AUIPC;
+        case 0x6f: return OP_JAL;
+        case 0x67: return OP_JALR;
+        case 0x63: {
+            static const uint8_t ops[8] = {
+                OP_BEQ, OP_BNE, OP_ILLEGAL, OP_ILLEGAL,
+                OP_BLT, OP_BGE, OP_BLTU, OP_BGEU
+            };
+            return ops[funct3];
+        }
+        case 0x03: {
+            static const uint8_t ops[8] = {
+                OP_LB, OP_LH, OP_LW, OP_ILLEGAL,
+                OP_LBU, OP_LHU, OP_ILLEGAL, OP_ILLEGAL
+            };
+            return ops[funct3];
+        }
+        case 0x23: {
+            static const uint8_t ops[8] = {
+                OP_SB, OP_SH, OP_SW, OP_ILLEGAL,
+                OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL
+            };
+            return ops[funct3];
+        }
+        case 0x13: {
+            static const uint8_t ops[8] = {
+                OP_ADDI, OP_SLLI, OP_SLTI, OP_SLTIU,
+                OP_XORI, OP_SRLI, OP_ORI, OP_ANDI
+            };
+            if (funct3 == 0x5) {
+                if (funct7 == 0x00) return OP_SRLI;
+                if (funct7 == 0x20) return OP_SRAI;
+                return OP_ILLEGAL;
+            }
+            return ops[funct3];
+        }
+        case 0x33: {
+            static const uint8_t base[8] = {
+                OP_ADD, OP_SLL, OP_SLT, OP_SLTU,
+                OP_XOR, OP_SRL, OP_OR, OP_AND
+            };
+            static const uint8_t mext[8] = {
+                OP_MUL, OP_ILLEGAL, OP_ILLEGAL, OP_ILLEGAL,
+                OP_DIV, OP_DIVU, OP_REM, OP_REMU
+            };
+            if (funct7 == 0x00) return base[funct3];
+            if (funct7 == 0x20) {
+                if (funct3 == 0x0) return OP_SUB;
+                if (funct3 == 0x5) return OP_SRA;
+                return base[funct3];
+            }
+            if (funct7 == 0x01) return mext[funct3];
+            return OP_ILLEGAL;
+        }
+        case 0x73:
+            if (funct3 == 0 && (inst >> 20) == 0) return OP_ECALL;
+            return OP_ILLEGAL;
+        default:
+            return OP_ILLEGAL;
+    }
+}
+
+void decode_insn(uint32_t addr, uint32_t inst, struct decoded* d) {
+    uint32_t rd = (inst >> 7) & 0x1f;
+
+    d->handler = NULL;
+    d->op  = (uint8_t)decode_op(inst);
+    d->rd  = (uint8_t)(rd ? rd : REG_SINK);
+    d->rs1 = (uint8_t)((inst >> 15) & 0x1f);
+    d->rs2 = (uint8_t)((inst >> 20) & 0x1f);
+
+    switch (d->op) {
+        case OP_LUI:   d->imm = imm_u(inst); break;
+        case OP_AUIPC: d->imm = (int32_t)(addr + imm_u(inst)); break;
+        case OP_JAL:   d->imm = (int32_t)(addr + imm_j(inst)); break;
+        case OP_BEQ: case OP_BNE: case OP_BLT:
+        case OP_BGE: case OP_BLTU: case OP_BGEU:
+            d->imm = (int32_t)(addr + imm_b(inst));
+            break;
+        case OP_SB: case OP_SH: case OP_SW:
+            d->imm = imm_s(inst);
+            break;
+        case OP_SLLI: case OP_SRLI: case OP_SRAI:
+            d->imm = (inst >> 20) & 0x1f;
+            break;
+        case OP_ILLEGAL:
+            d->imm = (int32_t)inst;
+            break;
+        default:
+            d->imm = imm_i(inst);
+            break;
+    }
+}
+
+// --- Superinstruction fusion ----------------------------------------------
+
+// does 'd' read register 'r' as a source?
+static int reads(const struct decoded* d, int r, int both) {
+    return d->rs1 == r || (both && d->rs2 == r);
+}
+
+int decode_fuse(const struct decoded* first, const struct decoded* second, uint32_t second_pc) {
+    int a = first->rd;   // REG_SINK for x0, which no source field matches
+    // the second record may itself start a pair; only its own half counts
+    struct decoded s = *second;
+    s.op = (uint8_t)decode_first_op(s.op);
+    second = &s;
+    switch (first->op) {
+        case OP_LUI:
+            if (second->op == OP_ADDI && reads(second, a, 0)) return OP_LUI_ADDI;
+            break;
+        case OP_AUIPC:
+            if (second->op == OP_ADDI && reads(second, a, 0)) return OP_AUIPC_ADDI;
+            if (second->op == OP_JALR && reads(second, a, 0)) return OP_AUIPC_JALR;
+            break;
+        case OP_SLT:
+        case OP_SLTU: {
+            // beqz/bnez on the result: one operand is a, the other x0
+            int bz = (second->rs1 == a && second->rs2 == 0) ||
+                     (second->rs1 == 0 && second->rs2 == a);
+            if (!bz) break;
+            if (second->op == OP_BEQ) return first->op == OP_SLT ? OP_SLT_BEQ : OP_SLTU_BEQ;
+            if (second->op == OP_BNE) return first->op == OP_SLT ? OP_SLT_BNE : OP_SLTU_BNE;
+            break;
+        }
+        case OP_ADDI:
+            // loop back-edge on the register just stepped
+            if (second->op == OP_BNE && reads(second, a, 1) &&
+                (uint32_t)second->imm <= second_pc)
+                return OP_ADDI_BNE;
+            break;
+        default:
+            break;
+    }
+    return first->op;
+}
+
+int decode_first_op(int op) {
+    switch (op) {
+#define FIRST_OP(name, first, second, text) case OP_##name: return OP_##first;
+        DECODE_FUSED_OPS(FIRST_OP)
+#undef FIRST_OP
+        default: return op;
+    }
+}
+
+const char* decode_fused_name(int op) {
+    switch (op) {
+#define FUSED_NAME(name, first, second, text) case OP_##name: return text;
+        DECODE_FUSED_OPS(FUSED_NAME)
+#undef FUSED_NAME
+        default: return "?";
+    }
+}
+
+void decode_report_illegal(uint32_t addr, uint32_t inst) {
+    uint32_t opcode = inst & 0x7f;
+    uint32_t funct3 = (inst >> 12) & 0x7;
+    uint32_t funct7 = (inst >> 25) & 0x7f;
+
+    switch (opcode) {
+        case 0x63:
+            fprintf(stderr, "Unknown branch funct3: 0x%x at 0x%08x\n", funct3, addr);
+            break;
+        case 0x03:
+            fprintf(stderr, "Unknown LOAD funct3: 0x%x at 0x%08x\n", funct3, addr);
+            break;
+        case 0x23:
+            fprintf(stderr, "Unknown STORE funct3: 0x%x at 0x%08x\n", funct3, addr);
+            break;
+        case 0x13:
+            fprintf(stderr, "Unknown OP-IMM shift funct7: 0x%x at 0x%08x\n", funct7, addr);
+            break;
+        case 0x33:
+            if (funct7 == 0x01)
+                fprintf(stderr, "Unknown M-extension funct3: 0x%x at 0x%08x\n", funct3, addr);
+            else
+                fprintf(stderr, "Unknown OP funct7: 0x%x at 0x%08x\n", funct7, addr);
+            break;
+        case 0x73:
+            fprintf(stderr, "Unknown SYSTEM instruction at 0x%08x\n", addr);
+            break;
+        default:
+            fprintf(stderr, "Unknown opcode 0x%x at 0x%08x\n", opcode, addr);
+            break;
+    }
+}
+
+// --- Predecode cache -------------------------------------------------------
+
+struct decode_cache* decode_cache_create(struct memory* mem, int fuse) {
+    struct decode_cache* dc = calloc(1, sizeof(struct decode_cache));
+    if (!dc) return NULL;
+    dc->mem = mem;
+    dc->fuse = fuse;
+    dc->stop_pc = DECODE_NO_PC;
+    return dc;
+}
+
+void decode_cache_delete(struct decode_cache* dc) {
+    if (!dc) return;
+    decode_cache_flush(dc);
+    free(dc);
+}
+
+void decode_cache_flush(struct decode_cache* dc) {
+    for (int j = 0; j < 0x10000; ++j) {
+        if (dc->pages[j]) free(dc->pages[j]);
+        dc->pages[j] = NULL;
+    }
+}
+
+struct decoded* decode_cache_fill(struct decode_cache* dc, uint32_t pc) {
+    // memory_rd_w reports (and exits on) a misaligned fetch for us
+    uint32_t inst = (uint32_t) memory_rd_w(dc->mem, (int)pc);
+
+    struct decoded* page = dc->pages[pc >> 16];
+    if (page == NULL) {
+        // OP_UNDECODED is 0, so a zeroed page is an empty one
+        page = calloc(DECODE_PAGE_WORDS + 1, sizeof(struct decoded));
+        if (!page) {
+            fprintf(stderr, "Out of memory in predecode cache\n");
+            exit(-1);
+        }
+        dc->pages[pc >> 16] = page;
+    }
+    uint32_t index = (pc >> 2) & (DECODE_PAGE_WORDS - 1);
+    struct decoded* d = &page[index];
+    decode_insn(pc, inst, d);
+
+    // pairs never straddle a page, so d + 1 is always in this page
+    if (dc->fuse && index < DECODE_PAGE_WORDS - 1 && pc + 4 != dc->stop_pc) {
+        struct decoded* next = d + 1;
+        if (next->op == OP_UNDECODED) {
+            // fill in the fields only: next is still filled properly (and
+            // maybe fused with its own successor) once it is looked up
+            decode_insn(pc + 4, (uint32_t) memory_rd_w(dc->mem, (int)(pc + 4)), next);
+            d->op = (uint8_t)decode_fuse(d, next, pc + 4);
+            next->op = OP_UNDECODED;
+        } else {
+            d->op = (uint8_t)decode_fuse(d, next, pc + 4);
+        }
+    }
+    return d;
+}
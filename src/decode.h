@@ -0,0 +1,151 @@
+#ifndef __DECODE_H__
+#define __DECODE_H__
+
+#include "memory.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Fully resolved instruction kinds. Decoding maps every RV32IM word to one
+// of these, so the execution engines never look at opcode/funct3/funct7.
+#define DECODE_OPS(X)                                                   \
+    X(UNDECODED) X(ILLEGAL)                                             \
+    X(LUI) X(AUIPC) X(JAL) X(JALR)                                      \
+    X(BEQ) X(BNE) X(BLT) X(BGE) X(BLTU) X(BGEU)                         \
+    X(LB) X(LH) X(LW) X(LBU) X(LHU)                                     \
+    X(SB) X(SH) X(SW)                                                   \
+    X(ADDI) X(SLTI) X(SLTIU) X(XORI) X(ORI) X(ANDI)                     \
+    X(SLLI) X(SRLI) X(SRAI)                                             \
+    X(ADD) X(SUB) X(SLL) X(SLT) X(SLTU) X(XOR) X(SRL) X(SRA) X(OR) X(AND) \
+    X(MUL) X(DIV) X(DIVU) X(REM) X(REMU)                                \
+    X(ECALL)
+
+// Superinstructions: common pairs that the decoder fuses into one record.
+// The first instruction's record gets the fused op, the second keeps its
+// own record (it may still be a jump target), which the fused handler
+// reads as d[1]. Columns: fused op, first op, second op, report name.
+#define DECODE_FUSED_OPS(X)                                             \
+    X(LUI_ADDI,   LUI,   ADDI, "lui+addi (li)")                         \
+    X(AUIPC_ADDI, AUIPC, ADDI, "auipc+addi (la)")                       \
+    X(AUIPC_JALR, AUIPC, JALR, "auipc+jalr (call)")                     \
+    X(SLT_BEQ,    SLT,   BEQ,  "slt+beqz")                              \
+    X(SLT_BNE,    SLT,   BNE,  "slt+bnez")                              \
+    X(SLTU_BEQ,   SLTU,  BEQ,  "sltu+beqz")                             \
+    X(SLTU_BNE,   SLTU,  BNE,  "sltu+bnez")                             \
+    X(ADDI_BNE,   ADDI,  BNE,  "addi+bne (loop)")
+
+enum decode_op {
+#define DECODE_ENUM(name) OP_##name,
+    DECODE_OPS(DECODE_ENUM)
+#undef DECODE_ENUM
+#define DECODE_FUSED_ENUM(name, first, second, text) OP_##name,
+    DECODE_FUSED_OPS(DECODE_FUSED_ENUM)
+#undef DECODE_FUSED_ENUM
+    OP_COUNT
+};
+
+// enum constants rather than macros, so that they can be used inside a
+// DECODE_FUSED_OPS expansion
+enum {
+#define DECODE_FUSED_ONE(name, first, second, text) + 1
+    NUM_FUSED_OPS = 0 DECODE_FUSED_OPS(DECODE_FUSED_ONE),
+#undef DECODE_FUSED_ONE
+    OP_FUSED_FIRST = OP_COUNT - NUM_FUSED_OPS
+};
+
+// Register index used as destination for instructions with rd == x0.
+// Engines keep 33 registers so that writes need no rd != 0 test.
+#define REG_SINK 32
+#define NUM_REGS 33
+
+// One predecoded instruction.
+//  imm holds the sign-extended immediate, except:
+//   AUIPC          : the final value (pc + imm)
+//   JAL, branches  : the absolute target address
+//   SLLI/SRLI/SRAI : the shift amount
+//   ILLEGAL        : the raw instruction word (for diagnostics)
+//  handler is owned by the threaded engine: the address of the code that
+//  executes op, or NULL until bound (and again after invalidation).
+struct decoded {
+    const void* handler;
+    int32_t imm;
+    uint8_t op;
+    uint8_t rd, rs1, rs2;
+};
+
+// Decode the instruction word 'inst' located at 'addr'
+void decode_insn(uint32_t addr, uint32_t inst, struct decoded* d);
+
+// Fused op for the pair (first, second), where second is the instruction
+// at second_pc; returns first->op if the pair is not fused.
+int decode_fuse(const struct decoded* first, const struct decoded* second, uint32_t second_pc);
+
+// Op executed by the first half of a (possibly fused) op
+int decode_first_op(int op);
+
+// Report name of a fused op
+const char* decode_fused_name(int op);
+
+// Print the same diagnostic the simulator has always printed for an
+// instruction it cannot execute.
+void decode_report_illegal(uint32_t addr, uint32_t inst);
+
+// --- Predecode cache -------------------------------------------------------
+//
+// Mirrors the page layout of struct memory: one array of 16K records per
+// 64KB page that has been fetched from. Records start out as OP_UNDECODED
+// and are decoded on first execution. Stores must call
+// decode_cache_invalidate() so self-modifying code is picked up.
+//
+// With fusion enabled, decoding a word also decodes the word after it (in
+// the same page) and fuses the pair if possible. Invalidating the second
+// half of a pair also invalidates the fused record in front of it.
+//
+// Each page carries one extra record past the end that is never decoded,
+// so an engine walking records sequentially falls into the slow path when
+// it crosses into the next page.
+
+#define DECODE_PAGE_WORDS 0x4000
+
+// No instruction can be at this address (bit 0 is set)
+#define DECODE_NO_PC 0xffffffffu
+
+struct decode_cache {
+    struct memory* mem;
+    int fuse;
+    uint32_t stop_pc;   // never fused into the second half of a pair
+    struct decoded* pages[0x10000];
+};
+
+struct decode_cache* decode_cache_create(struct memory* mem, int fuse);
+void decode_cache_delete(struct decode_cache* dc);
+
+// Forget every predecoded record
+void decode_cache_flush(struct decode_cache* dc);
+
+// slow path of decode_cache_lookup - allocates/decodes as needed
+struct decoded* decode_cache_fill(struct decode_cache* dc, uint32_t pc);
+
+static inline struct decoded* decode_cache_lookup(struct decode_cache* dc, uint32_t pc) {
+    struct decoded* page = dc->pages[pc >> 16];
+    if (page) {
+        struct decoded* d = &page[(pc >> 2) & (DECODE_PAGE_WORDS - 1)];
+        if (d->op != OP_UNDECODED && (pc & 3) == 0) return d;
+    }
+    return decode_cache_fill(dc, pc);
+}
+
+static inline void decode_cache_invalidate(struct decode_cache* dc, uint32_t addr) {
+    struct decoded* page = dc->pages[addr >> 16];
+    if (page) {
+        uint32_t index = (addr >> 2) & (DECODE_PAGE_WORDS - 1);
+        struct decoded* d = &page[index];
+        d->op = OP_UNDECODED;
+        d->handler = NULL;
+        if (index > 0 && d[-1].op >= OP_FUSED_FIRST) {
+            d[-1].op = OP_UNDECODED;
+            d[-1].handler = NULL;
+        }
+    }
+}
+
+#endif
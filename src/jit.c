@@ -0,0 +1,596 @@
+#include "jit.h"
+#include "btb.h"
+#include "decode.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+
+#define CODE_SIZE (32u << 20)
+
+// Host registers. Generated code keeps
+//   rbp = struct jit_ctx*, rbx = guest regs, r12 = page table,
+//   r13 = code bitmap table, r14 = scratch that survives helper calls
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// x86 condition codes for jcc/setcc
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xc, CC_GE = 0xd };
+
+struct jit {
+    uint8_t* code;
+    size_t size;
+    size_t used;
+    int branch_hook;
+    int jump_hook;
+    uint8_t* enter;      // trampoline: (ctx, native) -> pc
+    uint8_t* epilogue;   // shared exit path of all native blocks
+};
+
+struct emitter {
+    uint8_t* p;
+    uint8_t* end;
+    int overflow;
+};
+
+// --- Encoding helpers ------------------------------------------------------
+
+static void e8(struct emitter* e, uint8_t b) {
+    if (e->p < e->end) *e->p++ = b;
+    else e->overflow = 1;
+}
+static void e32(struct emitter* e, uint32_t v) {
+    for (int i = 0; i < 4; i++) e8(e, (uint8_t)(v >> (8 * i)));
+}
+static void e64(struct emitter* e, uint64_t v) {
+    for (int i = 0; i < 8; i++) e8(e, (uint8_t)(v >> (8 * i)));
+}
+
+// REX prefix, emitted only when needed (or when w is set)
+static void rex(struct emitter* e, int w, int reg, int base) {
+    uint8_t b = 0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3);
+    if (b != 0x40) e8(e, b);
+}
+
+// modrm (+disp) for [base + disp]; base must not be rsp or r12
+static void mem_operand(struct emitter* e, int reg, int base, int32_t disp) {
+    if (disp >= -128 && disp < 128) {
+        e8(e, 0x40 | ((reg & 7) << 3) | (base & 7));
+        e8(e, (uint8_t)disp);
+    } else {
+        e8(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+        e32(e, (uint32_t)disp);
+    }
+}
+
+// <op> reg, [base + disp]   (op is one byte, or 0x0f + one byte)
+static void op_mem(struct emitter* e, int w, int op, int reg, int base, int32_t disp) {
+    rex(e, w, reg, base);
+    if (op > 0xff) { e8(e, 0x0f); e8(e, (uint8_t)op); }
+    else e8(e, (uint8_t)op);
+    mem_operand(e, reg, base, disp);
+}
+
+// <op> dst, src  (register to register, reg field = src)
+static void op_rr(struct emitter* e, int w, int op, int src, int dst) {
+    rex(e, w, src, dst);
+    if (op > 0xff) { e8(e, 0x0f); e8(e, (uint8_t)op); }
+    else e8(e, (uint8_t)op);
+    e8(e, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+#define OP_2B(x) (0x0f00 | (x))
+
+// guest register operands
+static int32_t greg(int r) { return 4 * r; }
+static void load_greg(struct emitter* e, int host, int r)  { op_mem(e, 0, 0x8b, host, RBX, greg(r)); }
+static void store_greg(struct emitter* e, int host, int r) { op_mem(e, 0, 0x89, host, RBX, greg(r)); }
+static void store_greg_imm(struct emitter* e, int r, uint32_t imm) {
+    op_mem(e, 0, 0xc7, 0, RBX, greg(r));
+    e32(e, imm);
+}
+
+// ctx field operands
+#define CTX(field) ((int32_t)offsetof(struct jit_ctx, field))
+
+static void mov_r64_imm(struct emitter* e, int r, uint64_t imm) {
+    rex(e, 1, 0, r);
+    e8(e, 0xb8 | (r & 7));
+    e64(e, imm);
+}
+static void mov_r32_imm(struct emitter* e, int r, uint32_t imm) {
+    rex(e, 0, 0, r);
+    e8(e, 0xb8 | (r & 7));
+    e32(e, imm);
+}
+
+// alu eax, imm32: ext = /digit of opcode 0x81
+static void alu_eax_imm(struct emitter* e, int ext, int32_t imm) {
+    e8(e, 0x81);
+    e8(e, 0xc0 | (ext << 3));
+    e32(e, (uint32_t)imm);
+}
+
+// function pointers are passed as integers: ISO C has no void* for them
+static void call_abs(struct emitter* e, uintptr_t fn) {
+    mov_r64_imm(e, RAX, (uint64_t)fn);
+    e8(e, 0xff); e8(e, 0xd0);   // call rax
+}
+
+// forward jumps: emit with a zero rel32, patch when the target is known
+static uint8_t* jcc32(struct emitter* e, int cc) {
+    e8(e, 0x0f); e8(e, 0x80 | cc);
+    uint8_t* at = e->p;
+    e32(e, 0);
+    return at;
+}
+static uint8_t* jmp32(struct emitter* e) {
+    e8(e, 0xe9);
+    uint8_t* at = e->p;
+    e32(e, 0);
+    return at;
+}
+static uint8_t* jcc8(struct emitter* e, int cc) {
+    e8(e, 0x70 | cc);
+    uint8_t* at = e->p;
+    e8(e, 0);
+    return at;
+}
+static void patch32(struct emitter* e, uint8_t* at, uint8_t* target) {
+    if (e->overflow || !at) return;
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(at, &rel, 4);
+}
+static void patch8(struct emitter* e, uint8_t* at, uint8_t* target) {
+    if (e->overflow || !at) return;
+    *at = (uint8_t)(int8_t)(target - (at + 1));
+}
+static void jmp_to(struct emitter* e, uint8_t* target) {
+    uint8_t* at = jmp32(e);
+    patch32(e, at, target);
+}
+
+// --- Helpers called from generated code ------------------------------------
+
+static int32_t helper_div(int32_t r1, int32_t r2) {
+    if (r2 == 0) return -1;
+    if (r1 == INT32_MIN && r2 == -1) return INT32_MIN;
+    return r1 / r2;
+}
+static int32_t helper_divu(int32_t r1, int32_t r2) {
+    if (r2 == 0) return -1;
+    return (int32_t)((uint32_t)r1 / (uint32_t)r2);
+}
+static int32_t helper_rem(int32_t r1, int32_t r2) {
+    if (r2 == 0) return r1;
+    if (r1 == INT32_MIN && r2 == -1) return 0;
+    return r1 % r2;
+}
+static int32_t helper_remu(int32_t r1, int32_t r2) {
+    if (r2 == 0) return r1;
+    return (int32_t)((uint32_t)r1 % (uint32_t)r2);
+}
+
+// unallocated page or misaligned access: let memory.c handle it
+static int32_t helper_load(struct jit_ctx* ctx, uint32_t addr, int op) {
+    switch (op) {
+        case OP_LB:  return (int8_t) memory_rd_b(ctx->mem, (int)addr);
+        case OP_LH:  return (int16_t) memory_rd_h(ctx->mem, (int)addr);
+        case OP_LBU: return memory_rd_b(ctx->mem, (int)addr) & 0xff;
+        case OP_LHU: return memory_rd_h(ctx->mem, (int)addr) & 0xffff;
+        default:     return memory_rd_w(ctx->mem, (int)addr);
+    }
+}
+static void helper_store(struct jit_ctx* ctx, uint32_t addr, int32_t value, int op) {
+    switch (op) {
+        case OP_SB: memory_wr_b(ctx->mem, (int)addr, value); break;
+        case OP_SH: memory_wr_h(ctx->mem, (int)addr, value); break;
+        default:    memory_wr_w(ctx->mem, (int)addr, value); break;
+    }
+}
+
+// --- Code generation -------------------------------------------------------
+
+// eax = guest address; leaves rcx = page (or jumps to *slow if the page is
+// missing or the access is misaligned) and edx = offset within the page
+static void emit_page_lookup(struct emitter* e, int align_mask, uint8_t** slow1, uint8_t** slow2) {
+    e8(e, 0x89); e8(e, 0xc2);                               // mov edx, eax
+    e8(e, 0xc1); e8(e, 0xea); e8(e, 0x10);                  // shr edx, 16
+    e8(e, 0x49); e8(e, 0x8b); e8(e, 0x0c); e8(e, 0xd4);     // mov rcx, [r12 + rdx*8]
+    e8(e, 0x48); e8(e, 0x85); e8(e, 0xc9);                  // test rcx, rcx
+    *slow1 = jcc32(e, CC_E);
+    *slow2 = NULL;
+    if (align_mask) {
+        e8(e, 0xa8); e8(e, (uint8_t)align_mask);            // test al, mask
+        *slow2 = jcc32(e, CC_NE);
+    }
+    e8(e, 0x0f); e8(e, 0xb7); e8(e, 0xd0);                  // movzx edx, ax
+}
+
+// eax = rs1 + imm
+static void emit_address(struct emitter* e, const struct decoded* d) {
+    load_greg(e, RAX, d->rs1);
+    if (d->imm) alu_eax_imm(e, 0, d->imm);
+}
+
+static void emit_load(struct emitter* e, const struct decoded* d) {
+    uint8_t *slow1, *slow2;
+    int align = (d->op == OP_LW) ? 3 : (d->op == OP_LH || d->op == OP_LHU) ? 1 : 0;
+
+    emit_address(e, d);
+    emit_page_lookup(e, align, &slow1, &slow2);
+    switch (d->op) {                                        // eax = [rcx + rdx]
+        case OP_LB:  e8(e, 0x0f); e8(e, 0xbe); break;
+        case OP_LH:  e8(e, 0x0f); e8(e, 0xbf); break;
+        case OP_LBU: e8(e, 0x0f); e8(e, 0xb6); break;
+        case OP_LHU: e8(e, 0x0f); e8(e, 0xb7); break;
+        default:     e8(e, 0x8b); break;
+    }
+    e8(e, 0x04); e8(e, 0x11);
+    uint8_t* done = jmp32(e);
+
+    patch32(e, slow1, e->p);
+    patch32(e, slow2, e->p);
+    op_rr(e, 0, 0x89, RAX, RSI);                            // mov esi, eax
+    op_rr(e, 1, 0x89, RBP, RDI);                            // mov rdi, rbp
+    mov_r32_imm(e, RDX, d->op);
+    call_abs(e, (uintptr_t)helper_load);
+
+    patch32(e, done, e->p);
+    store_greg(e, RAX, d->rd);
+}
+
+static void emit_exit_smc(struct emitter* e, struct jit* jit, struct block* b, uint32_t done, uint32_t pc);
+
+static void emit_store(struct emitter* e, struct jit* jit, struct block* b,
+                       const struct decoded* d, uint32_t index, uint32_t pc) {
+    uint8_t *slow1, *slow2;
+    int align = (d->op == OP_SW) ? 3 : (d->op == OP_SH) ? 1 : 0;
+
+    emit_address(e, d);
+    op_rr(e, 0, 0x89, RAX, R14);                            // mov r14d, eax
+    emit_page_lookup(e, align, &slow1, &slow2);
+    load_greg(e, RAX, d->rs2);
+    switch (d->op) {                                        // [rcx + rdx] = value
+        case OP_SB: e8(e, 0x88); break;
+        case OP_SH: e8(e, 0x66); e8(e, 0x89); break;
+        default:    e8(e, 0x89); break;
+    }
+    e8(e, 0x04); e8(e, 0x11);
+    uint8_t* done = jmp32(e);
+
+    patch32(e, slow1, e->p);
+    patch32(e, slow2, e->p);
+    op_rr(e, 1, 0x89, RBP, RDI);                            // mov rdi, rbp
+    op_rr(e, 0, 0x89, R14, RSI);                            // mov esi, r14d
+    load_greg(e, RDX, d->rs2);
+    mov_r32_imm(e, RCX, d->op);
+    call_abs(e, (uintptr_t)helper_store);
+
+    // did the store hit translated code?
+    patch32(e, done, e->p);
+    op_rr(e, 0, 0x89, R14, RDX);                            // mov edx, r14d
+    e8(e, 0xc1); e8(e, 0xea); e8(e, 0x10);                  // shr edx, 16
+    e8(e, 0x49); e8(e, 0x8b); e8(e, 0x4c); e8(e, 0xd5); e8(e, 0x00); // mov rcx, [r13 + rdx*8]
+    e8(e, 0x48); e8(e, 0x85); e8(e, 0xc9);                  // test rcx, rcx
+    uint8_t* no_code = jcc32(e, CC_E);
+    op_rr(e, 0, 0x89, R14, RDX);                            // mov edx, r14d
+    e8(e, 0xc1); e8(e, 0xea); e8(e, 0x02);                  // shr edx, 2
+    e8(e, 0x81); e8(e, 0xe2); e32(e, DECODE_PAGE_WORDS - 1); // and edx, mask
+    e8(e, 0x0f); e8(e, 0xa3); e8(e, 0x11);                  // bt [rcx], edx
+    uint8_t* not_hit = jcc32(e, CC_AE);
+    emit_exit_smc(e, jit, b, index + 1, pc + 4);
+    patch32(e, no_code, e->p);
+    patch32(e, not_hit, e->p);
+}
+
+// Leave block b through 'slot' with the next pc in edx, having executed
+// 'done' of its instructions. Jumps straight to the successor's native code
+// when it is chained, compiled and matches the pc.
+static void emit_exit(struct emitter* e, struct jit* jit, struct block* b, int slot, uint32_t done) {
+    // add qword [rbp + insns], done
+    if (done < 128) { op_mem(e, 1, 0x83, 0, RBP, CTX(insns)); e8(e, (uint8_t)done); }
+    else            { op_mem(e, 1, 0x81, 0, RBP, CTX(insns)); e32(e, done); }
+
+    op_mem(e, 1, 0x8b, RAX, RBP, CTX(insns));               // mov rax, [rbp + insns]
+    op_mem(e, 1, 0x3b, RAX, RBP, CTX(insn_limit));          // cmp rax, [rbp + insn_limit]
+    uint8_t* out0 = jcc8(e, CC_GE);
+    mov_r64_imm(e, RAX, (uint64_t)(uintptr_t)&b->next[slot]);
+    op_mem(e, 1, 0x8b, RAX, RAX, 0);                        // mov rax, [rax]
+    op_rr(e, 1, 0x85, RAX, RAX);                            // test rax, rax
+    uint8_t* out1 = jcc8(e, CC_E);
+    op_mem(e, 0, 0x39, RDX, RAX, offsetof(struct block, pc)); // cmp [rax + pc], edx
+    uint8_t* out2 = jcc8(e, CC_NE);
+    op_mem(e, 1, 0x8b, RCX, RAX, offsetof(struct block, native)); // mov rcx, [rax + native]
+    op_rr(e, 1, 0x85, RCX, RCX);                            // test rcx, rcx
+    uint8_t* out3 = jcc8(e, CC_E);
+    e8(e, 0xff); e8(e, 0xe1);                               // jmp rcx
+
+    patch8(e, out0, e->p);
+    patch8(e, out1, e->p);
+    patch8(e, out2, e->p);
+    patch8(e, out3, e->p);
+    mov_r64_imm(e, RAX, (uint64_t)(uintptr_t)b);
+    op_mem(e, 1, 0x89, RAX, RBP, CTX(block));               // mov [rbp + block], rax
+    op_mem(e, 0, 0xc7, 0, RBP, CTX(exit)); e32(e, (uint32_t)slot);
+    op_rr(e, 0, 0x89, RDX, RAX);                            // mov eax, edx
+    jmp_to(e, jit->epilogue);
+}
+
+static void emit_exit_imm(struct emitter* e, struct jit* jit, struct block* b,
+                          int slot, uint32_t done, uint32_t target) {
+    mov_r32_imm(e, RDX, target);
+    emit_exit(e, jit, b, slot, done);
+}
+
+static void emit_exit_smc(struct emitter* e, struct jit* jit, struct block* b, uint32_t done, uint32_t pc) {
+    if (done < 128) { op_mem(e, 1, 0x83, 0, RBP, CTX(insns)); e8(e, (uint8_t)done); }
+    else            { op_mem(e, 1, 0x81, 0, RBP, CTX(insns)); e32(e, done); }
+    mov_r64_imm(e, RAX, (uint64_t)(uintptr_t)b);
+    op_mem(e, 1, 0x89, RAX, RBP, CTX(block));
+    op_mem(e, 0, 0xc7, 0, RBP, CTX(exit)); e32(e, JIT_EXIT_SMC);
+    mov_r32_imm(e, RAX, pc);
+    jmp_to(e, jit->epilogue);
+}
+
+static void emit_branch(struct emitter* e, struct jit* jit, struct block* b,
+                        const struct decoded* d, uint32_t index, uint32_t pc) {
+    int cc;
+    switch (d->op) {
+        case OP_BEQ:  cc = CC_E;  break;
+        case OP_BNE:  cc = CC_NE; break;
+        case OP_BLT:  cc = CC_L;  break;
+        case OP_BGE:  cc = CC_GE; break;
+        case OP_BLTU: cc = CC_B;  break;
+        default:      cc = CC_AE; break;
+    }
+    load_greg(e, RAX, d->rs1);
+    op_mem(e, 0, 0x3b, RAX, RBX, greg(d->rs2));             // cmp eax, rs2
+
+    uint8_t* taken;
+    if (jit->branch_hook) {
+        e8(e, 0x0f); e8(e, 0x90 | cc); e8(e, 0xc0);         // setcc al
+        op_rr(e, 0, OP_2B(0xb6), R14, RAX);                 // movzx r14d, al (reg field = dst)
+        op_rr(e, 1, 0x89, RBP, RDI);                        // mov rdi, rbp
+        mov_r32_imm(e, RSI, pc);
+        mov_r32_imm(e, RDX, (uint32_t)d->imm);
+        op_rr(e, 0, 0x89, R14, RCX);                        // mov ecx, r14d
+        op_mem(e, 1, 0x8b, RAX, RBP, CTX(branch_hook));     // mov rax, [rbp + hook]
+        e8(e, 0xff); e8(e, 0xd0);                           // call rax
+        op_rr(e, 0, 0x85, R14, R14);                        // test r14d, r14d
+        taken = jcc32(e, CC_NE);
+    } else {
+        taken = jcc32(e, cc);
+    }
+    emit_exit_imm(e, jit, b, BLOCK_FALLTHROUGH, index + 1, pc + 4);
+    patch32(e, taken, e->p);
+    emit_exit_imm(e, jit, b, BLOCK_TAKEN, index + 1, (uint32_t)d->imm);
+}
+
+// Call ctx->jump_hook for the JAL/JALR d at pc, with its target in edx
+// (which survives the call)
+static void emit_jump_hook(struct emitter* e, const struct decoded* d, uint32_t pc) {
+    op_rr(e, 0, 0x89, RDX, R14);                            // mov r14d, edx
+    op_rr(e, 1, 0x89, RBP, RDI);                            // mov rdi, rbp
+    mov_r32_imm(e, RSI, pc);
+    mov_r32_imm(e, RCX, (uint32_t)btb_kind(d));
+    op_mem(e, 1, 0x8b, RAX, RBP, CTX(jump_hook));           // mov rax, [rbp + hook]
+    e8(e, 0xff); e8(e, 0xd0);                               // call rax
+    op_rr(e, 0, 0x89, R14, RDX);                            // mov edx, r14d
+}
+
+static void emit_alu(struct emitter* e, const struct decoded* d) {
+    switch (d->op) {
+        case OP_LUI:
+        case OP_AUIPC:
+            store_greg_imm(e, d->rd, (uint32_t)d->imm);
+            return;
+        case OP_DIV: case OP_DIVU: case OP_REM: case OP_REMU: {
+            uintptr_t fn = d->op == OP_DIV  ? (uintptr_t)helper_div
+                         : d->op == OP_DIVU ? (uintptr_t)helper_divu
+                         : d->op == OP_REM  ? (uintptr_t)helper_rem : (uintptr_t)helper_remu;
+            load_greg(e, RDI, d->rs1);
+            load_greg(e, RSI, d->rs2);
+            call_abs(e, fn);
+            store_greg(e, RAX, d->rd);
+            return;
+        }
+        default:
+            break;
+    }
+
+    load_greg(e, RAX, d->rs1);
+    switch (d->op) {
+        case OP_ADDI:  alu_eax_imm(e, 0, d->imm); break;
+        case OP_ORI:   alu_eax_imm(e, 1, d->imm); break;
+        case OP_ANDI:  alu_eax_imm(e, 4, d->imm); break;
+        case OP_XORI:  alu_eax_imm(e, 6, d->imm); break;
+        case OP_SLTI:
+        case OP_SLTIU:
+            alu_eax_imm(e, 7, d->imm);                      // cmp eax, imm
+            e8(e, 0x0f); e8(e, 0x90 | (d->op == OP_SLTI ? CC_L : CC_B)); e8(e, 0xc0);
+            e8(e, 0x0f); e8(e, 0xb6); e8(e, 0xc0);          // movzx eax, al
+            break;
+        case OP_SLLI: e8(e, 0xc1); e8(e, 0xe0); e8(e, (uint8_t)d->imm); break;
+        case OP_SRLI: e8(e, 0xc1); e8(e, 0xe8); e8(e, (uint8_t)d->imm); break;
+        case OP_SRAI: e8(e, 0xc1); e8(e, 0xf8); e8(e, (uint8_t)d->imm); break;
+        case OP_ADD:  op_mem(e, 0, 0x03, RAX, RBX, greg(d->rs2)); break;
+        case OP_SUB:  op_mem(e, 0, 0x2b, RAX, RBX, greg(d->rs2)); break;
+        case OP_XOR:  op_mem(e, 0, 0x33, RAX, RBX, greg(d->rs2)); break;
+        case OP_OR:   op_mem(e, 0, 0x0b, RAX, RBX, greg(d->rs2)); break;
+        case OP_AND:  op_mem(e, 0, 0x23, RAX, RBX, greg(d->rs2)); break;
+        case OP_MUL:  op_mem(e, 0, OP_2B(0xaf), RAX, RBX, greg(d->rs2)); break;
+        case OP_SLT:
+        case OP_SLTU:
+            op_mem(e, 0, 0x3b, RAX, RBX, greg(d->rs2));     // cmp eax, rs2
+            e8(e, 0x0f); e8(e, 0x90 | (d->op == OP_SLT ? CC_L : CC_B)); e8(e, 0xc0);
+            e8(e, 0x0f); e8(e, 0xb6); e8(e, 0xc0);          // movzx eax, al
+            break;
+        case OP_SLL:
+        case OP_SRL:
+        case OP_SRA:
+            load_greg(e, RCX, d->rs2);                      // x86 masks the count to 5 bits
+            e8(e, 0xd3);
+            e8(e, d->op == OP_SLL ? 0xe0 : d->op == OP_SRL ? 0xe8 : 0xf8);
+            break;
+        default:
+            break;
+    }
+    store_greg(e, RAX, d->rd);
+}
+
+// ctx->fused[k]++ for a fused pair compiled as its two halves
+static void emit_count_fused(struct emitter* e, int k) {
+    op_mem(e, 1, 0x8b, RAX, RBP, CTX(fused));               // mov rax, [rbp + fused]
+    op_mem(e, 1, 0x83, 0, RAX, (int32_t)(k * sizeof(long))); e8(e, 1); // add qword [rax + k * 8], 1
+}
+
+static int compilable(int op) {
+    return op != OP_ECALL && op != OP_ILLEGAL && op != OP_UNDECODED;
+}
+
+int jit_compile(struct jit* jit, struct block* b) {
+    if (!compilable(b->insns[0].op)) return JIT_UNSUPPORTED;
+
+    struct emitter em = { jit->code + jit->used, jit->code + jit->size, 0 };
+    struct emitter* e = &em;
+    uint8_t* start = e->p;
+
+    uint32_t pc = b->pc;
+    uint32_t i;
+    for (i = 0; i < b->n; i++, pc += 4) {
+        // native code has no use for superinstructions: emit the halves,
+        // counting the pair like the interpreters do
+        struct decoded insn = b->insns[i];
+        if (insn.op >= OP_FUSED_FIRST) emit_count_fused(e, insn.op - OP_FUSED_FIRST);
+        insn.op = (uint8_t)decode_first_op(insn.op);
+        const struct decoded* d = &insn;
+        if (!compilable(d->op)) break;      // the interpreter takes it from here
+
+        switch (d->op) {
+            case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU:
+                emit_load(e, d);
+                break;
+            case OP_SB: case OP_SH: case OP_SW:
+                emit_store(e, jit, b, d, i, pc);
+                break;
+            case OP_BEQ: case OP_BNE: case OP_BLT:
+            case OP_BGE: case OP_BLTU: case OP_BGEU:
+                emit_branch(e, jit, b, d, i, pc);
+                break;
+            case OP_JAL:
+                store_greg_imm(e, d->rd, pc + 4);
+                mov_r32_imm(e, RDX, (uint32_t)d->imm);
+                if (jit->jump_hook) emit_jump_hook(e, d, pc);
+                emit_exit(e, jit, b, BLOCK_TAKEN, i + 1);
+                break;
+            case OP_JALR:
+                load_greg(e, RDX, d->rs1);
+                if (d->imm) { e8(e, 0x81); e8(e, 0xc2); e32(e, (uint32_t)d->imm); } // add edx, imm
+                e8(e, 0x83); e8(e, 0xe2); e8(e, 0xfe);      // and edx, ~1
+                store_greg_imm(e, d->rd, pc + 4);
+                if (jit->jump_hook) emit_jump_hook(e, d, pc);
+                emit_exit(e, jit, b, BLOCK_TAKEN, i + 1);
+                break;
+            default:
+                emit_alu(e, d);
+                break;
+        }
+        if (d->op >= OP_JAL && d->op <= OP_BGEU) break;
+    }
+    // stopped in front of an ECALL/illegal instruction, or the block was cut
+    if (i == b->n || !compilable(b->insns[i].op))
+        emit_exit_imm(e, jit, b, BLOCK_FALLTHROUGH, i, pc);
+
+    if (e->overflow) return JIT_FULL;
+    jit->used = (size_t)(e->p - jit->code);
+    b->native = start;
+    return JIT_OK;
+}
+
+// --- Setup -----------------------------------------------------------------
+
+static void emit_runtime(struct jit* jit) {
+    struct emitter em = { jit->code, jit->code + jit->size, 0 };
+    struct emitter* e = &em;
+
+    // enter(ctx = rdi, native = rsi): five pushes keep rsp 16-byte aligned
+    // for the helper calls made from generated code
+    jit->enter = e->p;
+    e8(e, 0x53);                                            // push rbx
+    e8(e, 0x55);                                            // push rbp
+    e8(e, 0x41); e8(e, 0x54);                               // push r12
+    e8(e, 0x41); e8(e, 0x55);                               // push r13
+    e8(e, 0x41); e8(e, 0x56);                               // push r14
+    op_rr(e, 1, 0x89, RDI, RBP);                            // mov rbp, rdi
+    op_mem(e, 1, 0x8b, RBX, RBP, CTX(regs));
+    op_mem(e, 1, 0x8b, R12, RBP, CTX(pages));
+    op_mem(e, 1, 0x8b, R13, RBP, CTX(code_bits));
+    e8(e, 0xff); e8(e, 0xe6);                               // jmp rsi
+
+    jit->epilogue = e->p;
+    e8(e, 0x41); e8(e, 0x5e);                               // pop r14
+    e8(e, 0x41); e8(e, 0x5d);                               // pop r13
+    e8(e, 0x41); e8(e, 0x5c);                               // pop r12
+    e8(e, 0x5d);                                            // pop rbp
+    e8(e, 0x5b);                                            // pop rbx
+    e8(e, 0xc3);                                            // ret
+
+    jit->used = (size_t)(e->p - jit->code);
+}
+
+struct jit* jit_create(int branch_hook, int jump_hook) {
+    struct jit* jit = calloc(1, sizeof(struct jit));
+    if (!jit) return NULL;
+    jit->size = CODE_SIZE;
+    jit->code = mmap(NULL, jit->size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit->branch_hook = branch_hook;
+    jit->jump_hook = jump_hook;
+    emit_runtime(jit);
+    return jit;
+}
+
+void jit_delete(struct jit* jit) {
+    if (!jit) return;
+    munmap(jit->code, jit->size);
+    free(jit);
+}
+
+void jit_reset(struct jit* jit) {
+    emit_runtime(jit);
+}
+
+uint32_t jit_run(struct jit* jit, struct jit_ctx* ctx, struct block* b) {
+    uint32_t (*enter)(struct jit_ctx*, void*);
+    *(void**)&enter = jit->enter;
+    return enter(ctx, b->native);
+}
+
+#else
+
+// No code generator for this host: the block engine just keeps interpreting
+
+struct jit* jit_create(int branch_hook, int jump_hook) {
+    (void)branch_hook; (void)jump_hook;
+    return NULL;
+}
+void jit_delete(struct jit* jit) { (void)jit; }
+void jit_reset(struct jit* jit) { (void)jit; }
+int jit_compile(struct jit* jit, struct block* b) {
+    (void)jit; (void)b;
+    return JIT_UNSUPPORTED;
+}
+uint32_t jit_run(struct jit* jit, struct jit_ctx* ctx, struct block* b) {
+    (void)jit; (void)ctx;
+    return b->pc;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "block.h"
+#include "memory.h"
+#include <stdint.h>
+
+// --- x86-64 JIT tier for the block engine ----------------------------------
+//
+// Hot blocks from the translation cache are compiled to native x86-64.
+// Guest registers stay in the regs array; loads and stores index the
+// memory.c page table directly and only call into memory.c for pages that
+// are not allocated yet or for misaligned accesses. ECALL and illegal
+// instructions are never compiled: a native block stops in front of them
+// and hands the pc back to the interpreter.
+//
+// Native blocks share one stack frame, set up by a trampoline, so a block
+// can jump straight into the native code of its chained successor. Control
+// only returns to C when a successor is missing or not compiled, when a
+// store hits translated code, or when the instruction budget runs out.
+
+// Exit reasons reported in jit_ctx.exit
+#define JIT_EXIT_FALLTHROUGH BLOCK_FALLTHROUGH
+#define JIT_EXIT_TAKEN       BLOCK_TAKEN
+#define JIT_EXIT_SMC         2   // a store hit translated code: flush caches
+
+struct jit_ctx;
+typedef void (*jit_branch_hook)(struct jit_ctx* ctx, uint32_t pc, uint32_t target, int taken);
+// 'kind' is an enum btb_kind (see btb.h)
+typedef void (*jit_jump_hook)(struct jit_ctx* ctx, uint32_t pc, uint32_t target, int kind);
+
+// Shared between C and generated code. Field offsets are baked into the
+// generated code, so only ever add fields at the end.
+struct jit_ctx {
+    int32_t* regs;              // NUM_REGS guest registers
+    int** pages;                // memory_pages(mem)
+    uint32_t** code_bits;       // block_cache.code_bits
+    struct memory* mem;
+    long insns;                 // instructions executed by native code
+    struct block* block;        // block that exited to C
+    uint32_t exit;              // JIT_EXIT_*
+    jit_branch_hook branch_hook;    // only called if compiled in (see jit_create)
+    void* user;                 // for branch_hook
+    long insn_limit;            // no chaining to another block once insns reaches this
+    jit_jump_hook jump_hook;    // only called if compiled in (see jit_create)
+    long* fused;                // executions per superinstruction, as in struct Stat
+};
+
+// Compile result
+#define JIT_OK          0
+#define JIT_UNSUPPORTED 1   // first instruction cannot be compiled
+#define JIT_FULL        2   // code buffer exhausted, call jit_reset()
+
+struct jit;
+
+// Returns NULL if the host cannot run generated code (not x86-64, or no
+// executable memory). With 'branch_hook' set, every conditional branch in
+// generated code calls ctx->branch_hook, and with 'jump_hook' set every
+// JAL/JALR calls ctx->jump_hook with its target; without them no call is
+// emitted.
+struct jit* jit_create(int branch_hook, int jump_hook);
+void jit_delete(struct jit* jit);
+
+// Forget all generated code (the block cache must be flushed with it)
+void jit_reset(struct jit* jit);
+
+// Compile b and store the entry point in b->native
+int jit_compile(struct jit* jit, struct block* b);
+
+// Run native code starting at b->native until it exits to C. Returns the
+// next guest pc; ctx->block and ctx->exit tell which block exited and how.
+uint32_t jit_run(struct jit* jit, struct jit_ctx* ctx, struct block* b);
+
+#endif
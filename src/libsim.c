@@ -0,0 +1,141 @@
+#include "libsim.h"
+#include "memory.h"
+#include "read_elf.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct sim_machine {
+    struct memory* mem;
+    struct symbols* symbols;
+    struct program_info prog_info;
+    int loaded;
+
+    struct Predictor* predictor;
+    struct BPStats bpstats;
+    struct sim_console console;
+    int have_console;
+    struct SimOptions opts;
+
+    struct sim_cpu* cpu;        // created by the first sim_machine_run
+    struct Stat no_stat;        // reported before that
+};
+
+struct sim_machine* sim_machine_create(void) {
+    struct sim_machine* m = calloc(1, sizeof(struct sim_machine));
+    if (!m) return NULL;
+    m->mem = memory_create();
+    if (!m->mem) {
+        free(m);
+        return NULL;
+    }
+    m->opts.engine = ENGINE_JIT;
+    m->opts.fuse = 1;
+    m->opts.ff_stop_pc = DECODE_NO_PC;
+    m->opts.ckpt_stop_pc = DECODE_NO_PC;
+    return m;
+}
+
+void sim_machine_delete(struct sim_machine* m) {
+    if (!m) return;
+    sim_cpu_delete(m->cpu);
+    if (m->predictor) m->predictor->destroy(m->predictor);
+    if (m->symbols) symbols_delete(m->symbols);
+    memory_delete(m->mem);
+    free(m);
+}
+
+int sim_machine_load_elf(struct sim_machine* m, const char* file_name) {
+    if (m->cpu || m->loaded) return -1;
+    if (read_elf(m->mem, &m->prog_info, file_name, stderr)) return -1;
+    m->symbols = symbols_read_from_elf(file_name);
+    if (!m->symbols) return -1;
+    m->loaded = 1;
+    return 0;
+}
+
+// Same layout as the sim binary: argc at 0x1000000, then argv[], then the
+// strings
+int sim_machine_set_args(struct sim_machine* m, int argc, const char* const argv[]) {
+    if (m->cpu) return -1;
+    unsigned argv_addr = 0x1000004;
+    unsigned str_addr = argv_addr + 4 * argc;
+    memory_wr_w(m->mem, 0x1000000, argc);
+    for (int i = 0; i < argc; i++) {
+        memory_wr_w(m->mem, argv_addr + 4 * i, str_addr);
+        const char* cp = argv[i];
+        do {
+            memory_wr_b(m->mem, str_addr++, *cp);
+        } while (*cp++);
+    }
+    return 0;
+}
+
+int sim_machine_set_predictor(struct sim_machine* m, const char* name, int size) {
+    struct Predictor* predictor = predictor_create(name, size);
+    if (!predictor) {
+        fprintf(stderr, "Unknown predictor or bad size: %s %d\n", name, size);
+        return -1;
+    }
+    if (sim_machine_attach_predictor(m, predictor)) {
+        predictor->destroy(predictor);
+        return -1;
+    }
+    return 0;
+}
+
+int sim_machine_attach_predictor(struct sim_machine* m, struct Predictor* predictor) {
+    if (m->cpu) return -1;
+    if (m->predictor) m->predictor->destroy(m->predictor);
+    m->predictor = predictor;
+    return 0;
+}
+
+int sim_machine_set_engine(struct sim_machine* m, enum sim_engine engine, int fuse) {
+    if (m->cpu) return -1;
+    m->opts.engine = engine;
+    m->opts.fuse = fuse;
+    return 0;
+}
+
+int sim_machine_set_console(struct sim_machine* m, const struct sim_console* console) {
+    if (m->cpu) return -1;
+    m->have_console = console != NULL;
+    if (console) m->console = *console;
+    return 0;
+}
+
+enum sim_event sim_machine_run(struct sim_machine* m, long budget) {
+    if (!m->cpu) {
+        if (!m->loaded) {
+            fprintf(stderr, "No program loaded\n");
+            return SIM_EVENT_ILLEGAL;
+        }
+        m->opts.variant = sim_pick_variant(m->predictor, NULL, NULL, NULL, NULL);
+        m->opts.console = m->have_console ? &m->console : NULL;
+        m->cpu = sim_cpu_create(m->mem, (int)m->prog_info.start, NULL, m->symbols,
+                                m->predictor, &m->bpstats, &m->opts);
+        if (!m->cpu) {
+            fprintf(stderr, "Could not allocate CPU state\n");
+            return SIM_EVENT_ILLEGAL;
+        }
+    }
+    return sim_step_n(m->cpu, budget > 0 ? budget : LONG_MAX);
+}
+
+const struct Stat* sim_machine_stat(const struct sim_machine* m) {
+    return m->cpu ? sim_cpu_stat(m->cpu) : &m->no_stat;
+}
+
+const struct BPStats* sim_machine_bpstats(const struct sim_machine* m) {
+    return &m->bpstats;
+}
+
+uint32_t sim_machine_pc(const struct sim_machine* m) {
+    return m->cpu ? sim_cpu_pc(m->cpu) : m->prog_info.start;
+}
+
+int32_t sim_machine_reg(const struct sim_machine* m, int r) {
+    return m->cpu ? sim_cpu_reg(m->cpu, r) : 0;
+}
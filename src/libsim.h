@@ -0,0 +1,54 @@
+#ifndef __LIBSIM_H__
+#define __LIBSIM_H__
+
+#include "predictor.h"
+#include "simulate.h"
+#include <stdint.h>
+
+// --- libsim: the simulator as a library ------------------------------------
+//
+// A sim_machine is one guest: its memory, program, predictor and CPU state.
+// Machines share nothing, so any number of them can run in one process,
+// each on its own thread; console I/O goes through per-machine callbacks.
+//
+//   struct sim_machine* m = sim_machine_create();
+//   if (sim_machine_load_elf(m, "prog.elf")) ...
+//   sim_machine_set_predictor(m, "gshare", 1024);
+//   while (sim_machine_run(m, 1000000) == SIM_EVENT_BUDGET) ...
+//   printf("%ld\n", sim_machine_bpstats(m)->mispredictions);
+//   sim_machine_delete(m);
+//
+// Everything is set up before the first sim_machine_run; the setters fail
+// (-1) once the machine has started. Errors are reported on stderr.
+// Misaligned accesses still end the whole process, as in the sim binary.
+
+struct sim_machine;
+
+struct sim_machine* sim_machine_create(void);
+// also destroys the predictor
+void sim_machine_delete(struct sim_machine* m);
+
+// Load the program and its symbols. Returns 0 on success.
+int sim_machine_load_elf(struct sim_machine* m, const char* file_name);
+
+// Program arguments, as after -- on the sim command line
+int sim_machine_set_args(struct sim_machine* m, int argc, const char* const argv[]);
+
+// A built-in predictor by name (see predictor_create), or any predictor;
+// the machine owns it from here
+int sim_machine_set_predictor(struct sim_machine* m, const char* name, int size);
+int sim_machine_attach_predictor(struct sim_machine* m, struct Predictor* predictor);
+
+// Defaults: ENGINE_JIT with fusion, stdin/stdout as console
+int sim_machine_set_engine(struct sim_machine* m, enum sim_engine engine, int fuse);
+int sim_machine_set_console(struct sim_machine* m, const struct sim_console* console);
+
+// Run at most 'budget' instructions (no limit if <= 0); see sim_step_n
+enum sim_event sim_machine_run(struct sim_machine* m, long budget);
+
+const struct Stat* sim_machine_stat(const struct sim_machine* m);
+const struct BPStats* sim_machine_bpstats(const struct sim_machine* m);
+uint32_t sim_machine_pc(const struct sim_machine* m);
+int32_t sim_machine_reg(const struct sim_machine* m, int r);
+
+#endif
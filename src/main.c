@@ -3,10 +3,13 @@
 #include "disassemble.h"
 #include "simulate.h"
 #include "predictor.h"
+#include "batch.h"
+#include "replay.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 static void terminate(const char *error)
 {
@@ -18,6 +21,25 @@ static void terminate(const char *error)
   printf("      sim riscv-elf -l log\n");
   printf("      sim riscv-elf -s log\n");
   printf("      sim riscv-elf -p prof -b <nt|btfnt|bimodal|gshare> [size]\n");
+  printf("      sim riscv-elf -p prof -b <bimode|agree|yags> <size>   (with an aliasing report)\n");
+  printf("      sim riscv-elf -p prof -b tage <kb>\n");
+  printf("      sim riscv-elf -p prof -b perceptron[/history] <rows>\n");
+  printf("      sim riscv-elf -p prof -b local[/history[/bht size]] <pht size>\n");
+  printf("      sim riscv-elf -p prof -b tournament[/local+global] <size>   (parts: name or name=size)\n");
+  printf("      sim riscv-elf -p prof -b name[:size],name[:size],...   (compare predictors)\n");
+  printf("      sim riscv-elf -e <switch|threaded|block|jit>\n");
+  printf("      sim riscv-elf -f <on|off>   (instruction fusion, on by default; -f on adds fusion counts to the profile)\n");
+  printf("      sim riscv-elf -ff <count|symbol>   (fast-forward, then simulate in detail)\n");
+  printf("      sim riscv-elf -bbv file [-interval N]   (basic-block vectors for simpoint)\n");
+  printf("      sim riscv-elf -sample file [-interval N] [-warmup N]   (simulate simpoint samples)\n");
+  printf("      sim riscv-elf -ckpt file <count|symbol>   (run up to there, then save a checkpoint)\n");
+  printf("      sim riscv-elf -resume file   (continue from a checkpoint)\n");
+  printf("      sim riscv-elf -slice N   (run in slices of N instructions)\n");
+  printf("      sim riscv-elf -trace file[.btz]   (binary trace of all conditional branches; .btz compresses)\n");
+  printf("      sim riscv-elf -trace file -sweep specs out.csv   (then replay every predictor spec)\n");
+  printf("      sim riscv-elf -p prof -btb <sets> <ways> [lru|fifo|random] [-ras entries]   (target prediction)\n");
+  printf("      sim riscv-elf -p prof -btb ... -indirect <entries> [path]   (indirect target cache for JALR)\n");
+  printf("  sim --batch jobs.txt [-j threads] [-o report.csv|report.json] [-e engine]\n");
   printf("    prog-args:\n");
   printf("      sim riscv-elf -- arg1 arg2 ...\n");
   exit(-1);
@@ -64,18 +86,78 @@ static void disassemble_to_stdout(struct memory* mem, struct program_info* prog_
   }
 }
 
-static struct Predictor* build_predictor(const char* name, int size)
+// Reads the "interval weight" lines written by simpoint, sorted by interval
+static struct SimSample* read_samples(const char* name, int* num_samples)
 {
-  if (!name) return NULL;
-  if (!strcmp(name, "nt")) return predictor_nt();
-  if (!strcmp(name, "btfnt")) return predictor_btfnt();
-  if (!strcmp(name, "bimodal")) return predictor_bimodal(size);
-  if (!strcmp(name, "gshare")) return predictor_gshare(size);
-  return NULL;
+  FILE* f = fopen(name, "r");
+  if (!f) terminate("Could not open sample file, terminating.");
+  struct SimSample* samples = NULL;
+  int n = 0, capacity = 0;
+  long interval;
+  double weight;
+  while (fscanf(f, "%ld %lf", &interval, &weight) == 2) {
+    if (n == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      samples = realloc(samples, capacity * sizeof(struct SimSample));
+      if (!samples) terminate("Out of memory reading sample file");
+    }
+    samples[n++] = (struct SimSample){ .interval = interval, .weight = weight };
+  }
+  fclose(f);
+  if (n == 0) terminate("No samples in sample file");
+  for (int i = 1; i < n; i++) {
+    if (samples[i].interval <= samples[i - 1].interval) terminate("Samples must be sorted by interval");
+  }
+  *num_samples = n;
+  return samples;
+}
+
+// sim --batch jobs.txt ...: see batch.h
+static int batch_main(int argc, char *argv[])
+{
+  if (argc < 3) terminate("Missing job file after --batch");
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  enum sim_engine engine = ENGINE_JIT;
+  const char* report_name = NULL;
+  for (int i = 3; i < argc; i++) {
+    if (!strcmp(argv[i], "-j")) {
+      if (i + 1 >= argc) terminate("Missing thread count after -j");
+      threads = atoi(argv[++i]);
+      if (threads < 1) terminate("Thread count must be at least 1");
+    } else if (!strcmp(argv[i], "-o")) {
+      if (i + 1 >= argc) terminate("Missing report file name after -o");
+      report_name = argv[++i];
+    } else if (!strcmp(argv[i], "-e")) {
+      if (i + 1 >= argc) terminate("Missing engine name after -e");
+      i++;
+      if (!strcmp(argv[i], "switch")) engine = ENGINE_SWITCH;
+      else if (!strcmp(argv[i], "threaded")) engine = ENGINE_THREADED;
+      else if (!strcmp(argv[i], "block")) engine = ENGINE_BLOCK;
+      else if (!strcmp(argv[i], "jit")) engine = ENGINE_JIT;
+      else terminate("Unknown engine after -e");
+    } else {
+      terminate("Unknown batch option");
+    }
+  }
+  if (threads < 1) threads = 1;
+
+  FILE* report = stdout;
+  int json = 0;
+  if (report_name) {
+    size_t len = strlen(report_name);
+    json = len >= 5 && !strcmp(report_name + len - 5, ".json");
+    report = fopen(report_name, "w");
+    if (!report) terminate("Could not open report file, terminating.");
+  }
+  int status = batch_run(argv[2], (int)threads, engine, report, json);
+  if (report_name) fclose(report);
+  return status ? 1 : 0;
 }
 
 int main(int argc, char *argv[])
 {
+  if (argc >= 2 && !strcmp(argv[1], "--batch")) return batch_main(argc, argv);
+
   struct memory *mem = memory_create();
   argc = pass_args_to_program(mem, argc, argv);
 
@@ -89,6 +171,27 @@ int main(int argc, char *argv[])
 
   const char* pred_name = NULL;
   int pred_size = 0;
+  int pred_list = 0;
+  int fuse_stats = 0;   // -f on given: profile the superinstructions
+  struct SimOptions sim_opts = {
+    .engine = ENGINE_SWITCH,
+    .fuse = 1,
+    .ff_stop_pc = DECODE_NO_PC,
+    .interval = 10000000,
+    .ckpt_stop_pc = DECODE_NO_PC,
+  };
+  const char* ff_symbol = NULL;
+  FILE* bbv_file = NULL;
+  const char* sample_name = NULL;
+  const char* ckpt_symbol = NULL;
+  const char* resume_name = NULL;
+  long slice = 0;
+  const char* trace_name = NULL;
+  const char* sweep_specs = NULL;
+  const char* sweep_csv = NULL;
+  int btb_sets = 0, btb_ways = 0, ras_entries = 16;
+  int indirect_entries = 0, indirect_path = 8;
+  enum btb_replacement btb_replacement = BTB_LRU;
 
   // Parse sim-options (argv[2..argc-1])
   for (int i = 2; i < argc; i++) {
@@ -115,16 +218,146 @@ int main(int argc, char *argv[])
       if (i + 1 >= argc) terminate("Missing predictor name after -b");
       pred_name = argv[i + 1];
       i++;
-      if (!strcmp(pred_name, "bimodal") || !strcmp(pred_name, "gshare")) {
-        if (i + 1 >= argc) terminate("Missing size after -b bimodal/gshare");
+      if (strpbrk(pred_name, ":,")) {
+        pred_list = 1;    // several predictors in one run, e.g. bimodal:256,gshare:1024
+      } else if (predictor_has_size(pred_name)) {
+        if (i + 1 >= argc) terminate("Missing size after a sized -b predictor");
         pred_size = atoi(argv[i + 1]);
         i++;
       }
+    } else if (!strcmp(argv[i], "-e")) {
+      if (i + 1 >= argc) terminate("Missing engine name after -e");
+      if (!strcmp(argv[i + 1], "switch")) sim_opts.engine = ENGINE_SWITCH;
+      else if (!strcmp(argv[i + 1], "threaded")) sim_opts.engine = ENGINE_THREADED;
+      else if (!strcmp(argv[i + 1], "block")) sim_opts.engine = ENGINE_BLOCK;
+      else if (!strcmp(argv[i + 1], "jit")) sim_opts.engine = ENGINE_JIT;
+      else terminate("Unknown engine after -e");
+      i++;
+    } else if (!strcmp(argv[i], "-f")) {
+      if (i + 1 >= argc) terminate("Missing on/off after -f");
+      if (!strcmp(argv[i + 1], "on")) sim_opts.fuse = fuse_stats = 1;
+      else if (!strcmp(argv[i + 1], "off")) sim_opts.fuse = fuse_stats = 0;
+      else terminate("Expected on or off after -f");
+      i++;
+    } else if (!strcmp(argv[i], "-ff")) {
+      if (i + 1 >= argc) terminate("Missing instruction count or symbol after -ff");
+      char* end;
+      long count = strtol(argv[i + 1], &end, 0);
+      if (*end == '\0' && count > 0) sim_opts.ff_insns = count;
+      else ff_symbol = argv[i + 1];   // looked up once the ELF file is read
+      i++;
+    } else if (!strcmp(argv[i], "-bbv")) {
+      if (i + 1 >= argc) terminate("Missing file name after -bbv");
+      bbv_file = fopen(argv[i + 1], "w");
+      if (!bbv_file) terminate("Could not open BBV file, terminating.");
+      i++;
+    } else if (!strcmp(argv[i], "-interval")) {
+      if (i + 1 >= argc) terminate("Missing instruction count after -interval");
+      sim_opts.interval = strtol(argv[i + 1], NULL, 0);
+      // an interval ends at a block boundary, so it must be well above the block size
+      if (sim_opts.interval < 1000) terminate("Interval must be at least 1000 instructions");
+      i++;
+    } else if (!strcmp(argv[i], "-sample")) {
+      if (i + 1 >= argc) terminate("Missing sample file name after -sample");
+      sample_name = argv[i + 1];
+      i++;
+    } else if (!strcmp(argv[i], "-warmup")) {
+      if (i + 1 >= argc) terminate("Missing instruction count after -warmup");
+      sim_opts.warmup = strtol(argv[i + 1], NULL, 0);
+      if (sim_opts.warmup < 0) terminate("Negative warm-up");
+      i++;
+    } else if (!strcmp(argv[i], "-ckpt")) {
+      if (i + 2 >= argc) terminate("Missing file name and instruction count or symbol after -ckpt");
+      sim_opts.ckpt_file = argv[i + 1];
+      char* end;
+      long count = strtol(argv[i + 2], &end, 0);
+      if (*end == '\0' && count > 0) sim_opts.ckpt_insns = count;
+      else ckpt_symbol = argv[i + 2];   // looked up once the ELF file is read
+      i += 2;
+    } else if (!strcmp(argv[i], "-slice")) {
+      if (i + 1 >= argc) terminate("Missing instruction count after -slice");
+      slice = strtol(argv[i + 1], NULL, 0);
+      if (slice <= 0) terminate("Slice must be at least 1 instruction");
+      i++;
+    } else if (!strcmp(argv[i], "-trace")) {
+      if (i + 1 >= argc) terminate("Missing file name after -trace");
+      trace_name = argv[i + 1];
+      i++;
+    } else if (!strcmp(argv[i], "-sweep")) {
+      if (i + 2 >= argc) terminate("Missing spec file and CSV file name after -sweep");
+      sweep_specs = argv[i + 1];
+      sweep_csv = argv[i + 2];
+      i += 2;
+    } else if (!strcmp(argv[i], "-btb")) {
+      if (i + 2 >= argc) terminate("Missing sets and ways after -btb");
+      btb_sets = atoi(argv[i + 1]);
+      btb_ways = atoi(argv[i + 2]);
+      if (btb_sets < 1 || (btb_sets & (btb_sets - 1))) terminate("BTB sets must be a power of two");
+      if (btb_ways < 1) terminate("BTB needs at least one way");
+      i += 2;
+      if (i + 1 < argc && btb_parse_replacement(argv[i + 1]) >= 0) {
+        btb_replacement = (enum btb_replacement)btb_parse_replacement(argv[i + 1]);
+        i++;
+      }
+    } else if (!strcmp(argv[i], "-ras")) {
+      if (i + 1 >= argc) terminate("Missing entry count after -ras");
+      ras_entries = atoi(argv[i + 1]);
+      if (ras_entries < 1) terminate("RAS needs at least one entry");
+      i++;
+    } else if (!strcmp(argv[i], "-indirect")) {
+      if (i + 1 >= argc) terminate("Missing entry count after -indirect");
+      indirect_entries = atoi(argv[i + 1]);
+      if (indirect_entries < BTB_INDIRECT_WAYS || (indirect_entries & (indirect_entries - 1)))
+        terminate("Indirect target cache entries must be a power of two, at least 4");
+      i++;
+      char* end;
+      long path = i + 1 < argc ? strtol(argv[i + 1], &end, 0) : -1;
+      if (i + 1 < argc && *end == '\0' && argv[i + 1][0] != '\0') {
+        if (path < 0 || path > BTB_MAX_PATH) terminate("Indirect path length must be 0 to 16");
+        indirect_path = (int)path;
+        i++;
+      }
+    } else if (!strcmp(argv[i], "-resume")) {
+      if (i + 1 >= argc) terminate("Missing checkpoint file name after -resume");
+      resume_name = argv[i + 1];
+      i++;
     } else {
       terminate("Unknown sim-option");
     }
   }
 
+  if (sample_name && (bbv_file || sim_opts.ff_insns > 0 || ff_symbol))
+    terminate("-sample cannot be combined with -bbv or -ff");
+  if (bbv_file && log_file) terminate("-bbv cannot be combined with -l");
+  if (sample_name && sim_opts.ckpt_file) terminate("-sample cannot be combined with -ckpt");
+  if (pred_list && sample_name) terminate("-sample needs a single predictor");
+  if (trace_name && (log_file || bbv_file || sample_name))
+    terminate("-trace cannot be combined with -l, -bbv or -sample");
+  if (sweep_specs && !trace_name) terminate("-sweep needs -trace");
+  if (btb_sets && (log_file || bbv_file || trace_name || sample_name))
+    terminate("-btb cannot be combined with -l, -bbv, -trace or -sample");
+  if (indirect_entries && !btb_sets) terminate("-indirect needs -btb");
+  if (btb_sets) {
+    sim_opts.btb = btb_create(btb_sets, btb_ways, btb_replacement, ras_entries,
+                              indirect_entries, indirect_path);
+    if (!sim_opts.btb) terminate("Could not allocate BTB");
+  }
+  if (trace_name) {
+    // a .btz name gets the compressed format
+    size_t len = strlen(trace_name);
+    sim_opts.trace = trace_writer_create(trace_name, len >= 4 && !strcmp(trace_name + len - 4, ".btz"));
+    if (!sim_opts.trace) exit(-1);
+  }
+  if (slice && (sample_name || sim_opts.ckpt_file || sim_opts.ff_insns > 0 || ff_symbol || bbv_file))
+    terminate("-slice cannot be combined with -sample, -ckpt, -ff or -bbv");
+  if (sample_name) sim_opts.samples = read_samples(sample_name, &sim_opts.num_samples);
+  if (bbv_file) {
+    sim_opts.bbv = bbv_create(bbv_file, sim_opts.interval);
+    if (!sim_opts.bbv) terminate("Could not allocate BBV writer");
+    // only the block engine collects basic-block vectors
+    sim_opts.engine = ENGINE_BLOCK;
+  }
+
   struct program_info prog_info;
   int status = read_elf(mem, &prog_info, argv[1], log_file);
   if (status) exit(status);
@@ -132,6 +365,17 @@ int main(int argc, char *argv[])
   struct symbols* symbols = symbols_read_from_elf(argv[1]);
   if (symbols == NULL) exit(-1);
 
+  if (ff_symbol) {
+    unsigned int value;
+    if (!symbols_sym_to_value(symbols, ff_symbol, &value)) terminate("Unknown symbol after -ff");
+    sim_opts.ff_stop_pc = value;
+  }
+  if (ckpt_symbol) {
+    unsigned int value;
+    if (!symbols_sym_to_value(symbols, ckpt_symbol, &value)) terminate("Unknown symbol after -ckpt");
+    sim_opts.ckpt_stop_pc = value;
+  }
+
   if (disasm_only) {
     disassemble_to_stdout(mem, &prog_info, symbols);
     symbols_delete(symbols);
@@ -139,12 +383,37 @@ int main(int argc, char *argv[])
     return 0;
   }
 
-  struct Predictor* predictor = build_predictor(pred_name, pred_size);
+  struct Predictor* predictor = pred_list ? predictor_create_list(pred_name)
+                                         : predictor_create(pred_name, pred_size);
+  if (pred_list && !predictor) terminate("Bad predictor list after -b");
+  if (pred_name && !predictor) terminate("Unknown predictor or bad size");
+  // the aliasing tallies are only worth their cost for a profile
+  if (predictor && prof_file && predictor_track_aliasing(predictor))
+    terminate("Could not allocate aliasing statistics");
   struct BPStats bpstats = (struct BPStats){0};
 
+  sim_opts.variant = sim_pick_variant(predictor, log_file, sim_opts.bbv, sim_opts.trace, sim_opts.btb);
+
+  // the checkpoint replaces the memory image and predictor tables from here
+  struct checkpoint resume;
+  if (resume_name) {
+    if (checkpoint_load(resume_name, &resume, mem, predictor)) exit(-1);
+    sim_opts.resume = &resume;
+  }
+
   int start_addr = prog_info.start;
   clock_t before = clock();
-  struct Stat sim_stats = simulate(mem, start_addr, log_file, symbols, predictor, &bpstats);
+  struct Stat sim_stats;
+  if (slice) {
+    struct sim_cpu* cpu = sim_cpu_create(mem, start_addr, log_file, symbols, predictor, &bpstats, &sim_opts);
+    if (!cpu) terminate("Could not allocate CPU state");
+    while (sim_step_n(cpu, slice) == SIM_EVENT_BUDGET)
+      ;
+    sim_stats = *sim_cpu_stat(cpu);
+    sim_cpu_delete(cpu);
+  } else {
+    sim_stats = simulate(mem, start_addr, log_file, symbols, predictor, &bpstats, &sim_opts);
+  }
   clock_t after = clock();
 
   long int num_insns = sim_stats.insns;
@@ -159,28 +428,83 @@ int main(int argc, char *argv[])
     printf("\nSimulated %ld instructions in %d host ticks (%f MIPS)\n", num_insns, ticks, mips);
   }
 
+  if (sim_opts.ckpt_file) {
+    printf("Checkpoint written to %s\n", sim_opts.ckpt_file);
+  }
+
   // Write profile (branch predictor stats)
   if (prof_file) {
     fprintf(prof_file, "Predictor: %s\n", pred_name ? pred_name : "none");
-    if (pred_name && (!strcmp(pred_name, "bimodal") || !strcmp(pred_name, "gshare"))) {
+    if (!pred_list && pred_name && predictor_has_size(pred_name)) {
       fprintf(prof_file, "Size: %d\n", pred_size);
     }
+    // with fast-forward, only the detailed part counts for the rates below
+    long int ff_insns = sim_stats.ff_insns;
+    num_insns -= ff_insns;
     fprintf(prof_file, "Instructions: %ld\n", num_insns);
-    fprintf(prof_file, "Total branches: %ld\n", bpstats.total_branches);
-    fprintf(prof_file, "Mispredictions: %ld\n", bpstats.mispredictions);
-
-    if (bpstats.total_branches > 0) {
-      double rate = (100.0 * (double)bpstats.mispredictions) / (double)bpstats.total_branches;
-      fprintf(prof_file, "Misprediction rate: %.2f%%\n", rate);
+    if (sim_opts.resume) {
+      fprintf(prof_file, "Resumed at instruction: %ld\n", sim_opts.resume->insns);
     }
-    if (num_insns > 0) {
-      double mpki = (1000.0 * (double)bpstats.mispredictions) / (double)num_insns;
-      fprintf(prof_file, "MPKI: %.3f\n", mpki);
+    if (sim_opts.ff_insns > 0 || sim_opts.ff_stop_pc != DECODE_NO_PC || sim_opts.num_samples > 0) {
+      fprintf(prof_file, "Fast-forwarded instructions: %ld\n", ff_insns);
+    }
+    predictor_print_stats(prof_file, predictor, &bpstats, num_insns);
+    if (sim_opts.btb) btb_report(sim_opts.btb, prof_file);
+    // the log variant never fuses
+    if (fuse_stats && sim_opts.variant != SIM_LOG) {
+      for (int k = 0; k < NUM_FUSED_OPS; k++) {
+        fprintf(prof_file, "Fused %s: %ld\n", decode_fused_name(OP_FUSED_FIRST + k), sim_stats.fused[k]);
+      }
     }
     fclose(prof_file);
   }
 
+  // Sampled simulation: per-sample results and the MPKI weighted over the
+  // samples the program got to
+  if (sim_opts.num_samples > 0) {
+    double weight = 0.0, weighted_mpki = 0.0;
+    int ran = 0;
+    for (int k = 0; k < sim_opts.num_samples; k++) {
+      struct SimSample* s = &sim_opts.samples[k];
+      if (s->insns == 0) continue;
+      double mpki = (1000.0 * (double)s->stats.mispredictions) / (double)s->insns;
+      printf("Sample %ld: weight %.4f, %ld instructions, %ld mispredictions, MPKI %.3f\n",
+              s->interval, s->weight, s->insns, s->stats.mispredictions, mpki);
+      weight += s->weight;
+      weighted_mpki += s->weight * mpki;
+      ran++;
+    }
+    printf("Samples simulated: %d of %d (interval %ld, warm-up %ld)\n",
+            ran, sim_opts.num_samples, sim_opts.interval, sim_opts.warmup);
+    if (weight > 0.0) printf("Weighted MPKI: %.3f\n", weighted_mpki / weight);
+    free(sim_opts.samples);
+  }
+
+  if (sim_opts.bbv) {
+    bbv_delete(sim_opts.bbv);
+    fclose(bbv_file);
+  }
+  // the trace covers the detailed part of the run only
+  if (sim_opts.trace && trace_writer_close(sim_opts.trace, sim_stats.insns - sim_stats.ff_insns)) {
+    fprintf(stderr, "Could not finish branch trace %s\n", trace_name);
+    exit(-1);
+  }
+
+  // Predictor sweep over the trace just written, on all host cores
+  if (sweep_specs) {
+    struct trace_file trace;
+    if (trace_open(trace_name, &trace)) exit(-1);
+    FILE* csv = fopen(sweep_csv, "w");
+    if (!csv) terminate("Could not open sweep CSV file, terminating.");
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (replay_sweep(&trace, sweep_specs, threads > 0 ? (int)threads : 1, 1, csv)) exit(-1);
+    fclose(csv);
+    trace_close(&trace);
+    printf("Sweep written to %s\n", sweep_csv);
+  }
+
   if (predictor) predictor->destroy(predictor);
+  btb_delete(sim_opts.btb);
 
   symbols_delete(symbols);
   memory_delete(mem);
@@ -22,6 +22,11 @@ void memory_delete(struct memory *mem)
   free(mem);
 }
 
+int **memory_pages(struct memory *mem)
+{
+  return mem->pages;
+}
+
 int *get_page(struct memory *mem, int addr)
 {
   int page_number = (addr >> 16) & 0x0ffff;
@@ -126,3 +131,34 @@ int memory_rd_b(struct memory *mem, int addr)
   }
   return 0; // silence a warning
 }
+
+// Format: for each allocated page its number (32 bit), then its 64KB, and
+// 0xffffffff after the last one
+int memory_save(struct memory *mem, FILE *f)
+{
+  for (unsigned j = 0; j < 0x10000; ++j)
+  {
+    if (mem->pages[j] == NULL)
+      continue;
+    if (fwrite(&j, sizeof(j), 1, f) != 1 || fwrite(mem->pages[j], 65536, 1, f) != 1)
+      return -1;
+  }
+  unsigned end = 0xffffffff;
+  return fwrite(&end, sizeof(end), 1, f) == 1 ? 0 : -1;
+}
+
+int memory_load(struct memory *mem, FILE *f)
+{
+  unsigned j;
+  while (fread(&j, sizeof(j), 1, f) == 1)
+  {
+    if (j == 0xffffffff)
+      return 0;
+    if (j >= 0x10000)
+      return -1;
+    int *page = get_page(mem, (int)(j << 16));
+    if (page == NULL || fread(page, 65536, 1, f) != 1)
+      return -1;
+  }
+  return -1;
+}
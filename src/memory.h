@@ -1,6 +1,8 @@
 #ifndef __MEMORY_H__
 #define __MEMORY_H__
 
+#include <stdio.h>
+
 struct memory;
 
 // opret/nedlæg lager
@@ -16,4 +18,13 @@ void memory_wr_b(struct memory *mem, int addr, int data);
 int memory_rd_w(struct memory *mem, int addr);
 int memory_rd_h(struct memory *mem, int addr);
 int memory_rd_b(struct memory *mem, int addr);
+
+// direkte adgang til sidetabellen (0x10000 sider a 64KB, NULL = ikke allokeret)
+// bruges af JIT'en til at lave lagertilgange uden funktionskald
+int **memory_pages(struct memory *mem);
+
+// gem/indlæs alle allokerede sider i en åben fil (til checkpoints)
+// returnerer 0 ved succes, -1 ved fejl
+int memory_save(struct memory *mem, FILE *f);
+int memory_load(struct memory *mem, FILE *f);
 #endif
@@ -3,6 +3,9 @@
 #include <string.h>
 #include <stdio.h>
 #include "predictor.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
 /* Utility */
 static int is_power_of_two(int x) {
@@ -31,6 +34,10 @@ struct Predictor* predictor_nt() {
     p->predict = nt_predict;
     p->update  = nt_update;
     p->destroy = nt_destroy;
+    p->save    = NULL;
+    p->load    = NULL;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_NT;
     p->state   = NULL;
     return p;
 }
@@ -57,17 +64,16 @@ struct Predictor* predictor_btfnt() {
     p->predict = btfnt_predict;
     p->update  = btfnt_update;
     p->destroy = btfnt_destroy;
+    p->save    = NULL;
+    p->load    = NULL;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_BTFNT;
     p->state   = NULL;
     return p;
 }
 
 /* ------------------ Bimodal ------------------ */
-/* 2-bit saturating counters: 0..3 (>=2 means predict TAKEN) */
-struct bimodal_state {
-    int size;
-    int idx_mask;
-    uint8_t *table;
-};
+/* state and counters: see predictor.h */
 static int bimodal_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
     struct bimodal_state* s = (struct bimodal_state*) self->state;
     (void)target_pc;
@@ -78,13 +84,7 @@ static void bimodal_update(struct Predictor* self, uint32_t instr_pc, uint32_t t
     struct bimodal_state* s = (struct bimodal_state*) self->state;
     (void)target_pc;
     uint32_t index = (instr_pc >> 2) & s->idx_mask;
-    uint8_t ctr = s->table[index];
-    if (taken) {
-        if (ctr < 3) ctr++;
-    } else {
-        if (ctr > 0) ctr--;
-    }
-    s->table[index] = ctr;
+    s->table[index] = counter_next(s->table[index], taken);
 }
 static void bimodal_destroy(struct Predictor* self) {
     if (!self) return;
@@ -95,6 +95,17 @@ static void bimodal_destroy(struct Predictor* self) {
     }
     free(self);
 }
+static int bimodal_save(struct Predictor* self, FILE* f) {
+    struct bimodal_state* s = (struct bimodal_state*) self->state;
+    if (fwrite(&s->size, sizeof(s->size), 1, f) != 1) return -1;
+    return fwrite(s->table, 1, s->size, f) == (size_t)s->size ? 0 : -1;
+}
+static int bimodal_load(struct Predictor* self, FILE* f) {
+    struct bimodal_state* s = (struct bimodal_state*) self->state;
+    int size;
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != s->size) return -1;
+    return fread(s->table, 1, s->size, f) == (size_t)s->size ? 0 : -1;
+}
 struct Predictor* predictor_bimodal(int size) {
     if (!is_power_of_two(size)) return NULL;
     struct Predictor* p = malloc(sizeof(struct Predictor));
@@ -109,19 +120,16 @@ struct Predictor* predictor_bimodal(int size) {
     p->predict = bimodal_predict;
     p->update  = bimodal_update;
     p->destroy = bimodal_destroy;
+    p->save    = bimodal_save;
+    p->load    = bimodal_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_BIMODAL;
     p->state   = s;
     return p;
 }
 
 /* ------------------ gShare ------------------ */
-/* GHR bits = log2(size). Use index = ((instr_pc>>2) ^ GHR) & mask */
-struct gshare_state {
-    int size;
-    int idx_mask;
-    int ghr_bits;
-    uint32_t ghr;
-    uint8_t *table;
-};
+/* state: see predictor.h */
 static int gshare_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
     struct gshare_state* s = (struct gshare_state*) self->state;
     (void)target_pc;
@@ -134,13 +142,7 @@ static void gshare_update(struct Predictor* self, uint32_t instr_pc, uint32_t ta
     (void)target_pc;
     uint32_t pc_index = (instr_pc >> 2) & s->idx_mask;
     uint32_t idx = (pc_index ^ (s->ghr & s->idx_mask)) & s->idx_mask;
-    uint8_t ctr = s->table[idx];
-    if (taken) {
-        if (ctr < 3) ctr++;
-    } else {
-        if (ctr > 0) ctr--;
-    }
-    s->table[idx] = ctr;
+    s->table[idx] = counter_next(s->table[idx], taken);
     s->ghr = ((s->ghr << 1) | (taken ? 1u : 0u)) & ((1u << s->ghr_bits) - 1u);
 }
 static void gshare_destroy(struct Predictor* self) {
@@ -152,6 +154,19 @@ static void gshare_destroy(struct Predictor* self) {
     }
     free(self);
 }
+static int gshare_save(struct Predictor* self, FILE* f) {
+    struct gshare_state* s = (struct gshare_state*) self->state;
+    if (fwrite(&s->size, sizeof(s->size), 1, f) != 1) return -1;
+    if (fwrite(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    return fwrite(s->table, 1, s->size, f) == (size_t)s->size ? 0 : -1;
+}
+static int gshare_load(struct Predictor* self, FILE* f) {
+    struct gshare_state* s = (struct gshare_state*) self->state;
+    int size;
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != s->size) return -1;
+    if (fread(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    return fread(s->table, 1, s->size, f) == (size_t)s->size ? 0 : -1;
+}
 struct Predictor* predictor_gshare(int size) {
     if (!is_power_of_two(size)) return NULL;
     struct Predictor* p = malloc(sizeof(struct Predictor));
@@ -169,6 +184,1113 @@ struct Predictor* predictor_gshare(int size) {
     p->predict = gshare_predict;
     p->update  = gshare_update;
     p->destroy = gshare_destroy;
+    p->save    = gshare_save;
+    p->load    = gshare_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_GSHARE;
+    p->state   = s;
+    return p;
+}
+
+/* ------------------ Perceptron ------------------
+   Jimenez and Lin, "Dynamic branch prediction with perceptrons", 2001.
+   'rows' perceptrons selected by pc, each a bias weight plus one signed
+   weight per bit of global history. The prediction is the sign of
+   bias + sum(w[i] * x[i]), with x[i] = +1 for a taken and -1 for a not
+   taken branch i branches ago. After a misprediction, or while the sum
+   is within theta of 0, every weight moves towards the outcome times its
+   input.
+
+   Weights are int8 (kept in -127..127, so negating one cannot overflow)
+   and a row is padded to whole 32-byte vectors. The inputs are one int8
+   vector too, [1, x1 .. xH, 0 ...], so the bias needs no special case
+   and the padding never trains. With AVX2 the dot product and the
+   training take a few instructions per 32 weights; the scalar loops give
+   the same results.
+------------------------------------------------------*/
+#define PERCEPTRON_MAX_HISTORY 128
+#define PERCEPTRON_DEFAULT_HISTORY 31   /* bias + 31 weights fill one vector */
+#define PERCEPTRON_VECTOR 32
+
+struct perceptron_state {
+    int rows;
+    int history;
+    int stride;                 /* bytes per row, a multiple of PERCEPTRON_VECTOR */
+    int theta;
+    int avx2;
+    int8_t* weights;            /* row r at r * stride */
+    int8_t inputs[PERCEPTRON_MAX_HISTORY + PERCEPTRON_VECTOR];
+    /* the last prediction, for the update that follows it */
+    uint32_t pc;
+    int looked_up;
+    int sum;
+};
+
+static int perceptron_dot(const int8_t* w, const int8_t* x, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i) sum += w[i] * x[i];
+    return sum;
+}
+static void perceptron_train(int8_t* w, const int8_t* x, int n, int t) {
+    for (int i = 0; i < n; ++i) {
+        int v = w[i] + t * x[i];
+        w[i] = (int8_t)(v > 127 ? 127 : v < -127 ? -127 : v);
+    }
+}
+
+#ifdef __x86_64__
+__attribute__((target("avx2")))
+static int perceptron_dot_avx2(const int8_t* w, const int8_t* x, int n) {
+    __m256i ones8 = _mm256_set1_epi8(1), ones16 = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < n; i += PERCEPTRON_VECTOR) {
+        __m256i p = _mm256_sign_epi8(_mm256_loadu_si256((const __m256i*)(w + i)),
+                                     _mm256_loadu_si256((const __m256i*)(x + i)));
+        /* int8 products -> int16 pair sums -> int32 */
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(ones8, p), ones16));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    return _mm_cvtsi128_si32(s);
+}
+__attribute__((target("avx2")))
+static void perceptron_train_avx2(int8_t* w, const int8_t* x, int n, int t) {
+    __m256i dir = _mm256_set1_epi8((char)t), lo = _mm256_set1_epi8(-127);
+    for (int i = 0; i < n; i += PERCEPTRON_VECTOR) {
+        __m256i* v = (__m256i*)(w + i);
+        __m256i d = _mm256_sign_epi8(dir, _mm256_loadu_si256((const __m256i*)(x + i)));
+        _mm256_storeu_si256(v, _mm256_max_epi8(_mm256_adds_epi8(_mm256_loadu_si256(v), d), lo));
+    }
+}
+#endif
+
+static void perceptron_lookup(struct perceptron_state* s, uint32_t instr_pc) {
+    const int8_t* w = s->weights + (size_t)((instr_pc >> 2) & (s->rows - 1)) * s->stride;
+#ifdef __x86_64__
+    if (s->avx2) s->sum = perceptron_dot_avx2(w, s->inputs, s->stride);
+    else
+#endif
+    s->sum = perceptron_dot(w, s->inputs, s->stride);
+    s->pc = instr_pc;
+    s->looked_up = 1;
+}
+static int perceptron_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct perceptron_state* s = (struct perceptron_state*) self->state;
+    (void)target_pc;
+    perceptron_lookup(s, instr_pc);
+    return s->sum >= 0 ? TAKEN : NOT_TAKEN;
+}
+static void perceptron_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct perceptron_state* s = (struct perceptron_state*) self->state;
+    (void)target_pc;
+    if (!s->looked_up || s->pc != instr_pc) perceptron_lookup(s, instr_pc);
+    s->looked_up = 0;
+    int t = taken ? 1 : -1;
+    if ((s->sum >= 0) != (t > 0) || abs(s->sum) <= s->theta) {
+        int8_t* w = s->weights + (size_t)((instr_pc >> 2) & (s->rows - 1)) * s->stride;
+#ifdef __x86_64__
+        if (s->avx2) perceptron_train_avx2(w, s->inputs, s->stride, t);
+        else
+#endif
+        perceptron_train(w, s->inputs, s->stride, t);
+    }
+    /* inputs[0] is the bias input; the newest outcome goes to inputs[1] */
+    memmove(s->inputs + 2, s->inputs + 1, s->history - 1);
+    s->inputs[1] = (int8_t)t;
+}
+static void perceptron_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct perceptron_state* s = (struct perceptron_state*) self->state;
+    if (s) {
+        free(s->weights);
+        free(s);
+    }
+    free(self);
+}
+static int perceptron_save(struct Predictor* self, FILE* f) {
+    struct perceptron_state* s = (struct perceptron_state*) self->state;
+    size_t n = (size_t)s->rows * s->stride;
+    if (fwrite(&s->rows, sizeof(s->rows), 1, f) != 1) return -1;
+    if (fwrite(&s->history, sizeof(s->history), 1, f) != 1) return -1;
+    if (fwrite(s->inputs, 1, sizeof(s->inputs), f) != sizeof(s->inputs)) return -1;
+    return fwrite(s->weights, 1, n, f) == n ? 0 : -1;
+}
+static int perceptron_load(struct Predictor* self, FILE* f) {
+    struct perceptron_state* s = (struct perceptron_state*) self->state;
+    size_t n = (size_t)s->rows * s->stride;
+    int rows, history;
+    if (fread(&rows, sizeof(rows), 1, f) != 1 || rows != s->rows) return -1;
+    if (fread(&history, sizeof(history), 1, f) != 1 || history != s->history) return -1;
+    if (fread(s->inputs, 1, sizeof(s->inputs), f) != sizeof(s->inputs)) return -1;
+    s->looked_up = 0;
+    return fread(s->weights, 1, n, f) == n ? 0 : -1;
+}
+struct Predictor* predictor_perceptron(int rows, int history) {
+    if (!is_power_of_two(rows) || history < 1 || history > PERCEPTRON_MAX_HISTORY) return NULL;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    if (!p) return NULL;
+    struct perceptron_state* s = calloc(1, sizeof(struct perceptron_state));
+    if (!s) { free(p); return NULL; }
+    s->rows = rows;
+    s->history = history;
+    s->stride = (history + PERCEPTRON_VECTOR) / PERCEPTRON_VECTOR * PERCEPTRON_VECTOR;
+    s->theta = (int)(1.93 * history + 14);      /* from the paper */
+    s->weights = calloc((size_t)rows * s->stride, 1);
+    if (!s->weights) { free(s); free(p); return NULL; }
+    s->inputs[0] = 1;
+    for (int i = 1; i <= history; ++i) s->inputs[i] = -1;     /* nothing taken yet */
+#ifdef __x86_64__
+    s->avx2 = __builtin_cpu_supports("avx2");
+#endif
+    p->predict = perceptron_predict;
+    p->update  = perceptron_update;
+    p->destroy = perceptron_destroy;
+    p->save    = perceptron_save;
+    p->load    = perceptron_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_PERCEPTRON;
     p->state   = s;
     return p;
 }
+
+/* ------------------ Local (two-level) ------------------ */
+/* Two-level local history (Yeh and Patt): a branch history table indexed
+   by pc holds each branch's last 'history' outcomes, and those select a
+   2-bit counter in the pattern history table. When the pattern table has
+   more than 2^history entries, the remaining index bits are pc bits above
+   the history (PAp); otherwise all branches share it (PAg). */
+struct local_state {
+    int history;                // bits, 1..16
+    int bht_size;
+    int pht_size;
+    uint32_t bht_mask;
+    uint32_t pc_mask;           // pc bits in the pattern table index
+    uint16_t* bht;
+    uint8_t* pht;
+};
+
+static inline uint32_t local_index(const struct local_state* s, uint32_t instr_pc, uint32_t hist) {
+    return (((instr_pc >> 2) & s->pc_mask) << s->history) | hist;
+}
+static int local_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct local_state* s = (struct local_state*) self->state;
+    (void)target_pc;
+    uint32_t hist = s->bht[(instr_pc >> 2) & s->bht_mask];
+    return (s->pht[local_index(s, instr_pc, hist)] >= 2) ? TAKEN : NOT_TAKEN;
+}
+static void local_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct local_state* s = (struct local_state*) self->state;
+    (void)target_pc;
+    uint16_t* h = &s->bht[(instr_pc >> 2) & s->bht_mask];
+    uint32_t idx = local_index(s, instr_pc, *h);
+    s->pht[idx] = counter_next(s->pht[idx], taken);
+    *h = (uint16_t)(((*h << 1) | (taken ? 1u : 0u)) & ((1u << s->history) - 1u));
+}
+static void local_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct local_state* s = (struct local_state*) self->state;
+    if (s) {
+        free(s->bht);
+        free(s->pht);
+        free(s);
+    }
+    free(self);
+}
+static int local_save(struct Predictor* self, FILE* f) {
+    struct local_state* s = (struct local_state*) self->state;
+    if (fwrite(&s->pht_size, sizeof(s->pht_size), 1, f) != 1) return -1;
+    if (fwrite(&s->history, sizeof(s->history), 1, f) != 1) return -1;
+    if (fwrite(&s->bht_size, sizeof(s->bht_size), 1, f) != 1) return -1;
+    if (fwrite(s->bht, sizeof(uint16_t), s->bht_size, f) != (size_t)s->bht_size) return -1;
+    return fwrite(s->pht, 1, s->pht_size, f) == (size_t)s->pht_size ? 0 : -1;
+}
+static int local_load(struct Predictor* self, FILE* f) {
+    struct local_state* s = (struct local_state*) self->state;
+    int pht_size, history, bht_size;
+    if (fread(&pht_size, sizeof(pht_size), 1, f) != 1 || pht_size != s->pht_size) return -1;
+    if (fread(&history, sizeof(history), 1, f) != 1 || history != s->history) return -1;
+    if (fread(&bht_size, sizeof(bht_size), 1, f) != 1 || bht_size != s->bht_size) return -1;
+    if (fread(s->bht, sizeof(uint16_t), s->bht_size, f) != (size_t)s->bht_size) return -1;
+    return fread(s->pht, 1, s->pht_size, f) == (size_t)s->pht_size ? 0 : -1;
+}
+struct Predictor* predictor_local(int pht_size, int history, int bht_size) {
+    if (!is_power_of_two(pht_size) || !is_power_of_two(bht_size)) return NULL;
+    if (history < 1 || history > 16 || history > log2_int(pht_size)) return NULL;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    if (!p) return NULL;
+    struct local_state* s = malloc(sizeof(struct local_state));
+    if (!s) { free(p); return NULL; }
+    s->history = history;
+    s->bht_size = bht_size;
+    s->pht_size = pht_size;
+    s->bht_mask = bht_size - 1;
+    s->pc_mask = (pht_size >> history) - 1;
+    s->bht = calloc(bht_size, sizeof(uint16_t));
+    s->pht = malloc(pht_size);
+    if (!s->bht || !s->pht) { free(s->bht); free(s->pht); free(s); free(p); return NULL; }
+    memset(s->pht, 2, pht_size);  /* weakly taken */
+    p->predict = local_predict;
+    p->update  = local_update;
+    p->destroy = local_destroy;
+    p->save    = local_save;
+    p->load    = local_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_LOCAL;
+    p->state   = s;
+    return p;
+}
+
+/* ------------------ Aliasing ------------------
+   For the reports of the anti-aliasing predictors below (bi-mode, agree,
+   YAGS). Every training of a counter is tallied per (counter, branch), so
+   at the end each branch has a bias on each counter it used: the
+   direction it trained it in most of the time. A counter is shared by
+   branches of opposite bias when one branch biased one way and another
+   biased the other way both used it, which is the destructive kind of
+   aliasing. Each predictor tracks its own counters, and also the index a
+   plain gshare of the same size would use on the same branches, to show
+   how much of that aliasing the scheme avoided. The tallies cost a hash
+   table lookup per update, so they are only kept once
+   predictor_track_aliasing has been called, and the report is left out
+   otherwise.
+------------------------------------------------------*/
+struct alias_pair {
+    uint32_t idx;
+    uint32_t pc;
+    uint64_t toward;            /* trainings towards 1 */
+    uint64_t count;             /* trainings, 0 for a free slot */
+};
+
+struct alias_table {
+    const char* label;
+    int size;
+    struct alias_pair* pairs;   /* open addressing on (idx, pc); NULL while not tracked */
+    uint32_t mask;
+    uint32_t used;
+};
+
+/* first member of the states below, for aliasing_report */
+struct aliasing {
+    struct alias_table own;
+    struct alias_table gshare;
+};
+
+static void alias_init(struct alias_table* a, const char* label, int size) {
+    a->label = label;
+    a->size = size;
+}
+static int alias_start(struct alias_table* a) {
+    if (a->pairs) return 0;
+    a->mask = 4095;
+    a->used = 0;
+    a->pairs = calloc(a->mask + 1, sizeof(struct alias_pair));
+    return a->pairs ? 0 : -1;
+}
+static void alias_free(struct alias_table* a) {
+    free(a->pairs);
+}
+static inline uint32_t alias_hash(uint32_t idx, uint32_t instr_pc) {
+    uint64_t h = (((uint64_t)idx << 32) | instr_pc) * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(h >> 32);
+}
+static void alias_grow(struct alias_table* a) {
+    uint32_t old_mask = a->mask;
+    struct alias_pair* old = a->pairs;
+    a->mask = 2 * a->mask + 1;
+    a->pairs = calloc(a->mask + 1, sizeof(struct alias_pair));
+    if (!a->pairs) {
+        fprintf(stderr, "Out of memory in aliasing statistics\n");
+        exit(-1);
+    }
+    for (uint32_t i = 0; i <= old_mask; ++i) {
+        if (!old[i].count) continue;
+        uint32_t k = alias_hash(old[i].idx, old[i].pc) & a->mask;
+        while (a->pairs[k].count) k = (k + 1) & a->mask;
+        a->pairs[k] = old[i];
+    }
+    free(old);
+}
+/* entry 'idx' trained towards 'dir' for the branch at instr_pc */
+static inline void alias_note(struct alias_table* a, uint32_t idx, uint32_t instr_pc, int dir) {
+    if (!a->pairs) return;
+    uint32_t k = alias_hash(idx, instr_pc) & a->mask;
+    while (a->pairs[k].count && (a->pairs[k].idx != idx || a->pairs[k].pc != instr_pc))
+        k = (k + 1) & a->mask;
+    struct alias_pair* pr = &a->pairs[k];
+    if (!pr->count) {
+        pr->idx = idx;
+        pr->pc = instr_pc;
+        if (2 * ++a->used > a->mask) {
+            pr->count = 1;
+            pr->toward = (uint64_t)dir;
+            alias_grow(a);
+            return;
+        }
+    }
+    pr->count++;
+    pr->toward += (uint64_t)dir;
+}
+/* entries used, and shared by branches of opposite bias */
+static void alias_count(const struct alias_table* a, long* used, long* opposite) {
+    uint8_t* bias = calloc(a->size, 1);    /* bit 0: a branch biased to 0, bit 1: to 1 */
+    if (!bias) {
+        fprintf(stderr, "Out of memory in aliasing statistics\n");
+        exit(-1);
+    }
+    for (uint32_t i = 0; i <= a->mask; ++i) {
+        const struct alias_pair* pr = &a->pairs[i];
+        if (pr->count) bias[pr->idx] |= (2 * pr->toward >= pr->count) ? 2 : 1;
+    }
+    *used = *opposite = 0;
+    for (int i = 0; i < a->size; ++i) {
+        *used += bias[i] != 0;
+        *opposite += bias[i] == 3;
+    }
+    free(bias);
+}
+static void aliasing_report(struct Predictor* self, FILE* f, const char* name, long insns) {
+    struct aliasing* al = (struct aliasing*) self->state;
+    (void)insns;
+    if (!al->own.pairs) return;
+    if (name) fprintf(f, "%s aliasing:\n", name);
+    else fprintf(f, "Aliasing:\n");
+    fprintf(f, "%-28s %10s %10s %14s\n", "Table", "Entries", "Used", "Opposite bias");
+    const struct alias_table* t[2] = { &al->own, &al->gshare };
+    for (int i = 0; i < 2; ++i) {
+        long used, opposite;
+        alias_count(t[i], &used, &opposite);
+        fprintf(f, "%-28s %10d %10ld %14ld\n", t[i]->label, t[i]->size, used, opposite);
+    }
+}
+
+/* gshare's index over 'mask' + 1 entries */
+static inline uint32_t gshare_index(uint32_t instr_pc, uint32_t ghr, uint32_t mask) {
+    return ((instr_pc >> 2) ^ ghr) & mask;
+}
+
+/* ------------------ Bi-mode ------------------
+   Lee, Chen and Mudge, "The bi-mode branch predictor", 1997. A choice
+   table indexed by pc sends each branch to one of two direction tables
+   indexed like gshare, one for mostly taken and one for mostly not taken
+   branches, so the branches sharing a direction counter tend to agree.
+------------------------------------------------------*/
+struct bimode_state {
+    struct aliasing alias;
+    int size;                   /* entries per table */
+    uint32_t idx_mask;
+    uint32_t ghr;
+    uint8_t* choice;
+    uint8_t* direction[2];      /* [1] for the taken-biased branches */
+};
+
+static int bimode_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct bimode_state* s = (struct bimode_state*) self->state;
+    (void)target_pc;
+    int c = s->choice[(instr_pc >> 2) & s->idx_mask] >= 2;
+    return (s->direction[c][gshare_index(instr_pc, s->ghr, s->idx_mask)] >= 2) ? TAKEN : NOT_TAKEN;
+}
+static void bimode_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct bimode_state* s = (struct bimode_state*) self->state;
+    (void)target_pc;
+    taken = taken ? TAKEN : NOT_TAKEN;
+    uint8_t* choice = &s->choice[(instr_pc >> 2) & s->idx_mask];
+    int c = *choice >= 2;
+    uint32_t idx = gshare_index(instr_pc, s->ghr, s->idx_mask);
+    uint8_t* d = &s->direction[c][idx];
+    int predicted = *d >= 2;
+    *d = counter_next(*d, taken);
+    alias_note(&s->alias.own, ((uint32_t)c * s->size) | idx, instr_pc, taken);
+    alias_note(&s->alias.gshare, idx, instr_pc, taken);
+    /* keep the choice when it was wrong but its direction table was right */
+    if (!(c != taken && predicted == taken)) *choice = counter_next(*choice, taken);
+    s->ghr = (s->ghr << 1) | (uint32_t)taken;
+}
+static void bimode_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct bimode_state* s = (struct bimode_state*) self->state;
+    if (s) {
+        free(s->choice);
+        free(s->direction[0]);
+        free(s->direction[1]);
+        alias_free(&s->alias.own);
+        alias_free(&s->alias.gshare);
+        free(s);
+    }
+    free(self);
+}
+static int bimode_save(struct Predictor* self, FILE* f) {
+    struct bimode_state* s = (struct bimode_state*) self->state;
+    size_t n = (size_t)s->size;
+    if (fwrite(&s->size, sizeof(s->size), 1, f) != 1) return -1;
+    if (fwrite(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fwrite(s->choice, 1, n, f) != n) return -1;
+    if (fwrite(s->direction[0], 1, n, f) != n) return -1;
+    return fwrite(s->direction[1], 1, n, f) == n ? 0 : -1;
+}
+static int bimode_load(struct Predictor* self, FILE* f) {
+    struct bimode_state* s = (struct bimode_state*) self->state;
+    size_t n = (size_t)s->size;
+    int size;
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != s->size) return -1;
+    if (fread(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fread(s->choice, 1, n, f) != n) return -1;
+    if (fread(s->direction[0], 1, n, f) != n) return -1;
+    return fread(s->direction[1], 1, n, f) == n ? 0 : -1;
+}
+struct Predictor* predictor_bimode(int size) {
+    if (!is_power_of_two(size)) return NULL;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    struct bimode_state* s = calloc(1, sizeof(struct bimode_state));
+    if (!p || !s) { free(p); free(s); return NULL; }
+    p->state = s;
+    p->destroy = bimode_destroy;
+    s->size = size;
+    s->idx_mask = size - 1;
+    s->choice = malloc(size);
+    s->direction[0] = malloc(size);
+    s->direction[1] = malloc(size);
+    if (!s->choice || !s->direction[0] || !s->direction[1]) {
+        bimode_destroy(p);
+        return NULL;
+    }
+    alias_init(&s->alias.own, "bi-mode direction tables", 2 * size);
+    alias_init(&s->alias.gshare, "gshare table, same size", size);
+    memset(s->choice, 2, size);
+    memset(s->direction[0], 1, size);   /* weakly not taken */
+    memset(s->direction[1], 2, size);   /* weakly taken */
+    p->predict = bimode_predict;
+    p->update  = bimode_update;
+    p->save    = bimode_save;
+    p->load    = bimode_load;
+    p->report  = aliasing_report;
+    p->kind    = PREDICTOR_BIMODE;
+    return p;
+}
+
+/* ------------------ Agree ------------------
+   Sprangle, Chappell, Alsup and Patt, "The agree predictor", 1997. Each
+   branch gets a bias bit, its first outcome, and the gshare-indexed
+   counters predict whether the branch agrees with its bias. Branches that
+   share a counter mostly all agree, whichever way they go. The bias bits
+   are a pc-indexed table here (a BTB field in the paper); before a
+   branch's first outcome its bias is taken for backward branches.
+------------------------------------------------------*/
+#define AGREE_NO_BIAS 0xff
+
+struct agree_state {
+    struct aliasing alias;
+    int size;
+    uint32_t idx_mask;
+    uint32_t ghr;
+    uint8_t* bias;              /* TAKEN, NOT_TAKEN or AGREE_NO_BIAS */
+    uint8_t* agree;             /* >= 2 agrees with the bias */
+};
+
+static inline int agree_bias(const struct agree_state* s, uint32_t instr_pc, uint32_t target_pc) {
+    uint8_t b = s->bias[(instr_pc >> 2) & s->idx_mask];
+    return b == AGREE_NO_BIAS ? btfnt_predict_update(instr_pc, target_pc) : b;
+}
+static int agree_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct agree_state* s = (struct agree_state*) self->state;
+    int bias = agree_bias(s, instr_pc, target_pc);
+    return (s->agree[gshare_index(instr_pc, s->ghr, s->idx_mask)] >= 2) ? bias : !bias;
+}
+static void agree_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct agree_state* s = (struct agree_state*) self->state;
+    taken = taken ? TAKEN : NOT_TAKEN;
+    uint8_t* b = &s->bias[(instr_pc >> 2) & s->idx_mask];
+    if (*b == AGREE_NO_BIAS) *b = (uint8_t)taken;
+    int agrees = taken == *b;
+    uint32_t idx = gshare_index(instr_pc, s->ghr, s->idx_mask);
+    s->agree[idx] = counter_next(s->agree[idx], agrees);
+    alias_note(&s->alias.own, idx, instr_pc, agrees);
+    alias_note(&s->alias.gshare, idx, instr_pc, taken);
+    s->ghr = (s->ghr << 1) | (uint32_t)taken;
+    (void)target_pc;
+}
+static void agree_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct agree_state* s = (struct agree_state*) self->state;
+    if (s) {
+        free(s->bias);
+        free(s->agree);
+        alias_free(&s->alias.own);
+        alias_free(&s->alias.gshare);
+        free(s);
+    }
+    free(self);
+}
+static int agree_save(struct Predictor* self, FILE* f) {
+    struct agree_state* s = (struct agree_state*) self->state;
+    size_t n = (size_t)s->size;
+    if (fwrite(&s->size, sizeof(s->size), 1, f) != 1) return -1;
+    if (fwrite(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fwrite(s->bias, 1, n, f) != n) return -1;
+    return fwrite(s->agree, 1, n, f) == n ? 0 : -1;
+}
+static int agree_load(struct Predictor* self, FILE* f) {
+    struct agree_state* s = (struct agree_state*) self->state;
+    size_t n = (size_t)s->size;
+    int size;
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != s->size) return -1;
+    if (fread(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fread(s->bias, 1, n, f) != n) return -1;
+    return fread(s->agree, 1, n, f) == n ? 0 : -1;
+}
+struct Predictor* predictor_agree(int size) {
+    if (!is_power_of_two(size)) return NULL;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    struct agree_state* s = calloc(1, sizeof(struct agree_state));
+    if (!p || !s) { free(p); free(s); return NULL; }
+    p->state = s;
+    p->destroy = agree_destroy;
+    s->size = size;
+    s->idx_mask = size - 1;
+    s->bias = malloc(size);
+    s->agree = malloc(size);
+    if (!s->bias || !s->agree) {
+        agree_destroy(p);
+        return NULL;
+    }
+    alias_init(&s->alias.own, "agree counters", size);
+    alias_init(&s->alias.gshare, "gshare table, same size", size);
+    memset(s->bias, AGREE_NO_BIAS, size);
+    memset(s->agree, 2, size);  /* weakly agree */
+    p->predict = agree_predict;
+    p->update  = agree_update;
+    p->save    = agree_save;
+    p->load    = agree_load;
+    p->report  = aliasing_report;
+    p->kind    = PREDICTOR_AGREE;
+    return p;
+}
+
+/* ------------------ YAGS ------------------
+   Eden and Mudge, "The YAGS branch prediction scheme", 1998. A bimodal
+   choice table gives each branch's usual direction; two small tagged
+   caches indexed like gshare hold only the exceptions, the taken cases of
+   branches that mostly fall through and the other way round. The tags
+   (low pc bits) keep other branches from sharing an exception counter.
+   Both caches have as many entries as the choice table, so they see as
+   much history as a gshare of that size.
+------------------------------------------------------*/
+#define YAGS_TAG_BITS 8
+#define YAGS_TAG(pc) ((uint16_t)((((pc) >> 2) & ((1u << YAGS_TAG_BITS) - 1)) | (1u << YAGS_TAG_BITS)))  /* never 0 */
+
+struct yags_state {
+    struct aliasing alias;
+    int size;                   /* entries per table */
+    uint32_t idx_mask;
+    uint32_t ghr;
+    uint8_t* choice;
+    uint16_t* tags[2];          /* [1] taken exceptions, looked up when the choice says not taken */
+    uint8_t* ctrs[2];
+};
+
+static int yags_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct yags_state* s = (struct yags_state*) self->state;
+    (void)target_pc;
+    int c = s->choice[(instr_pc >> 2) & s->idx_mask] >= 2;
+    uint32_t idx = gshare_index(instr_pc, s->ghr, s->idx_mask);
+    if (s->tags[!c][idx] == YAGS_TAG(instr_pc)) return (s->ctrs[!c][idx] >= 2) ? TAKEN : NOT_TAKEN;
+    return c ? TAKEN : NOT_TAKEN;
+}
+static void yags_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct yags_state* s = (struct yags_state*) self->state;
+    (void)target_pc;
+    taken = taken ? TAKEN : NOT_TAKEN;
+    uint8_t* choice = &s->choice[(instr_pc >> 2) & s->idx_mask];
+    int c = *choice >= 2, e = !c;
+    uint32_t idx = gshare_index(instr_pc, s->ghr, s->idx_mask);
+    int hit = s->tags[e][idx] == YAGS_TAG(instr_pc);
+    int cache_right = 0;
+    if (hit) {
+        cache_right = (s->ctrs[e][idx] >= 2) == taken;
+        s->ctrs[e][idx] = counter_next(s->ctrs[e][idx], taken);
+        alias_note(&s->alias.own, ((uint32_t)e * s->size) | idx, instr_pc, taken);
+    } else if (c != taken) {
+        /* a new exception; the entry now belongs to this branch */
+        s->tags[e][idx] = YAGS_TAG(instr_pc);
+        s->ctrs[e][idx] = taken ? 2 : 1;
+        alias_note(&s->alias.own, ((uint32_t)e * s->size) | idx, instr_pc, taken);
+    }
+    alias_note(&s->alias.gshare, gshare_index(instr_pc, s->ghr, s->idx_mask), instr_pc, taken);
+    if (!(c != taken && cache_right)) *choice = counter_next(*choice, taken);
+    s->ghr = (s->ghr << 1) | (uint32_t)taken;
+}
+static void yags_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct yags_state* s = (struct yags_state*) self->state;
+    if (s) {
+        free(s->choice);
+        for (int i = 0; i < 2; ++i) {
+            free(s->tags[i]);
+            free(s->ctrs[i]);
+        }
+        alias_free(&s->alias.own);
+        alias_free(&s->alias.gshare);
+        free(s);
+    }
+    free(self);
+}
+static int yags_save(struct Predictor* self, FILE* f) {
+    struct yags_state* s = (struct yags_state*) self->state;
+    size_t n = (size_t)s->size;
+    if (fwrite(&s->size, sizeof(s->size), 1, f) != 1) return -1;
+    if (fwrite(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fwrite(s->choice, 1, n, f) != n) return -1;
+    for (int i = 0; i < 2; ++i) {
+        if (fwrite(s->tags[i], sizeof(uint16_t), n, f) != n) return -1;
+        if (fwrite(s->ctrs[i], 1, n, f) != n) return -1;
+    }
+    return 0;
+}
+static int yags_load(struct Predictor* self, FILE* f) {
+    struct yags_state* s = (struct yags_state*) self->state;
+    size_t n = (size_t)s->size;
+    int size;
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != s->size) return -1;
+    if (fread(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fread(s->choice, 1, n, f) != n) return -1;
+    for (int i = 0; i < 2; ++i) {
+        if (fread(s->tags[i], sizeof(uint16_t), n, f) != n) return -1;
+        if (fread(s->ctrs[i], 1, n, f) != n) return -1;
+    }
+    return 0;
+}
+struct Predictor* predictor_yags(int size) {
+    if (!is_power_of_two(size)) return NULL;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    struct yags_state* s = calloc(1, sizeof(struct yags_state));
+    if (!p || !s) { free(p); free(s); return NULL; }
+    p->state = s;
+    p->destroy = yags_destroy;
+    s->size = size;
+    s->idx_mask = size - 1;
+    s->choice = malloc(size);
+    int ok = s->choice != NULL;
+    for (int i = 0; i < 2; ++i) {
+        s->tags[i] = calloc(size, sizeof(uint16_t));
+        s->ctrs[i] = calloc(size, 1);
+        ok = ok && s->tags[i] && s->ctrs[i];
+    }
+    if (!ok) {
+        yags_destroy(p);
+        return NULL;
+    }
+    alias_init(&s->alias.own, "YAGS exception caches", 2 * size);
+    alias_init(&s->alias.gshare, "gshare table, same size", size);
+    memset(s->choice, 2, size);
+    p->predict = yags_predict;
+    p->update  = yags_update;
+    p->save    = yags_save;
+    p->load    = yags_load;
+    p->report  = aliasing_report;
+    p->kind    = PREDICTOR_YAGS;
+    return p;
+}
+
+/* ------------------ Tournament ------------------ */
+struct tournament_state {
+    struct Predictor* parts[2];
+    char* names[2];
+    int size;
+    int idx_mask;
+    uint32_t ghr;               // log2(size) bits
+    uint8_t* chooser;           // >= 2 picks parts[1]
+    int predicted[2];           // by each part for the current branch
+    int chosen;
+    long times_chosen[2];       // for the report
+    long right_chosen[2];
+    long mispredictions[2];     // of each part on its own
+};
+
+static int tournament_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct tournament_state* s = (struct tournament_state*) self->state;
+    for (int i = 0; i < 2; ++i)
+        s->predicted[i] = s->parts[i]->predict(s->parts[i], instr_pc, target_pc);
+    s->chosen = s->chooser[s->ghr & s->idx_mask] >= 2;
+    return s->predicted[s->chosen];
+}
+static void tournament_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct tournament_state* s = (struct tournament_state*) self->state;
+    taken = taken ? TAKEN : NOT_TAKEN;
+    s->times_chosen[s->chosen]++;
+    s->right_chosen[s->chosen] += s->predicted[s->chosen] == taken;
+    for (int i = 0; i < 2; ++i) {
+        s->mispredictions[i] += s->predicted[i] != taken;
+        s->parts[i]->update(s->parts[i], instr_pc, target_pc, taken);
+    }
+    /* the chooser only learns when the parts disagree */
+    if (s->predicted[0] != s->predicted[1]) {
+        uint8_t* c = &s->chooser[s->ghr & s->idx_mask];
+        *c = counter_next(*c, s->predicted[1] == taken);
+    }
+    s->ghr = (s->ghr << 1) | (uint32_t)taken;
+}
+static void tournament_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct tournament_state* s = (struct tournament_state*) self->state;
+    if (s) {
+        for (int i = 0; i < 2; ++i) {
+            if (s->parts[i]) s->parts[i]->destroy(s->parts[i]);
+            free(s->names[i]);
+        }
+        free(s->chooser);
+        free(s);
+    }
+    free(self);
+}
+static int tournament_save(struct Predictor* self, FILE* f) {
+    struct tournament_state* s = (struct tournament_state*) self->state;
+    if (fwrite(&s->size, sizeof(s->size), 1, f) != 1) return -1;
+    if (fwrite(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fwrite(s->chooser, 1, s->size, f) != (size_t)s->size) return -1;
+    for (int i = 0; i < 2; ++i) {
+        struct Predictor* p = s->parts[i];
+        int32_t kind = (int32_t)p->kind;
+        if (fwrite(&kind, sizeof(kind), 1, f) != 1) return -1;
+        if (p->save && p->save(p, f) != 0) return -1;
+    }
+    return 0;
+}
+static int tournament_load(struct Predictor* self, FILE* f) {
+    struct tournament_state* s = (struct tournament_state*) self->state;
+    int size;
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != s->size) return -1;
+    if (fread(&s->ghr, sizeof(s->ghr), 1, f) != 1) return -1;
+    if (fread(s->chooser, 1, s->size, f) != (size_t)s->size) return -1;
+    for (int i = 0; i < 2; ++i) {
+        struct Predictor* p = s->parts[i];
+        int32_t kind;
+        if (fread(&kind, sizeof(kind), 1, f) != 1 || kind != (int32_t)p->kind) return -1;
+        if (p->load && p->load(p, f) != 0) return -1;
+    }
+    return 0;
+}
+/* which part a tournament chose how often, and how often that was right;
+   the last column is each part's own MPKI */
+static void tournament_report(struct Predictor* self, FILE* f, const char* name, long insns) {
+    struct tournament_state* ts = (struct tournament_state*) self->state;
+    long total = ts->times_chosen[0] + ts->times_chosen[1];
+    if (name) fprintf(f, "%s chooser:\n", name);
+    else fprintf(f, "Chooser:\n");
+    fprintf(f, "%-20s %14s %9s %14s %9s %9s\n", "Component", "Chosen", "Share", "Right", "Accuracy", "MPKI");
+    for (int i = 0; i < 2; ++i) {
+        long chosen = ts->times_chosen[i];
+        double share = total ? (100.0 * (double)chosen) / (double)total : 0.0;
+        double accuracy = chosen ? (100.0 * (double)ts->right_chosen[i]) / (double)chosen : 0.0;
+        double mpki = insns ? (1000.0 * (double)ts->mispredictions[i]) / (double)insns : 0.0;
+        fprintf(f, "%-20s %14ld %8.2f%% %14ld %8.2f%% %9.3f\n", ts->names[i], chosen, share,
+                ts->right_chosen[i], accuracy, mpki);
+    }
+}
+struct Predictor* predictor_tournament(struct Predictor** parts, const char** names, int size) {
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    struct tournament_state* s = calloc(1, sizeof(struct tournament_state));
+    if (!p || !s || !is_power_of_two(size)) {
+        parts[0]->destroy(parts[0]);
+        parts[1]->destroy(parts[1]);
+        free(p); free(s);
+        return NULL;
+    }
+    p->state = s;
+    p->destroy = tournament_destroy;
+    s->size = size;
+    s->idx_mask = size - 1;
+    s->chooser = malloc(size);
+    for (int i = 0; i < 2; ++i) {
+        s->parts[i] = parts[i];
+        s->names[i] = strdup(names[i]);
+    }
+    if (!s->chooser || !s->names[0] || !s->names[1]) { tournament_destroy(p); return NULL; }
+    memset(s->chooser, 1, size);    /* weakly towards parts[0] while global history builds up */
+    p->predict = tournament_predict;
+    p->update  = tournament_update;
+    p->save    = tournament_save;
+    p->load    = tournament_load;
+    p->report  = tournament_report;
+    p->kind    = PREDICTOR_TOURNAMENT;
+    return p;
+}
+
+/* "perceptron" or "perceptron/<history>": the history length, or -1 */
+static int perceptron_history(const char* name) {
+    if (strncmp(name, "perceptron", 10)) return -1;
+    if (!name[10]) return PERCEPTRON_DEFAULT_HISTORY;
+    if (name[10] != '/') return -1;
+    char* end;
+    long h = strtol(name + 11, &end, 10);
+    return (*end || end == name + 11 || h < 1 || h > PERCEPTRON_MAX_HISTORY) ? -1 : (int)h;
+}
+
+/* "local", "local/<history>" or "local/<history>/<bht size>"; 0 if the
+   name is one of those */
+static int local_params(const char* name, int* history, int* bht_size) {
+    if (strncmp(name, "local", 5) || (name[5] && name[5] != '/')) return -1;
+    *history = 10;
+    *bht_size = 1024;
+    const char* p = name + 5;
+    for (int field = 0; *p && field < 2; ++field) {
+        char* end;
+        long v = strtol(p + 1, &end, 10);
+        if (p[0] != '/' || end == p + 1 || v < 1 || v > (1l << 24)) return -1;
+        if (field == 0) *history = (int)v;
+        else *bht_size = (int)v;
+        p = end;
+    }
+    return *p ? -1 : 0;
+}
+
+static int is_tournament(const char* name) {
+    return !strncmp(name, "tournament", 10) && (!name[10] || name[10] == '/');
+}
+
+/* "tournament" or "tournament/<local>+<global>", each part a -b name such
+   as "local/8" or "gshare", optionally with "=size" ('size' by default) */
+static struct Predictor* tournament_create(const char* name, int size) {
+    char local[48] = "bimodal", global[48] = "gshare";
+    char* spec[2] = { local, global };
+    if (name[10] == '/') {
+        const char* plus = strchr(name + 11, '+');
+        if (!plus || plus == name + 11 || (size_t)(plus - name - 11) >= sizeof(local)
+            || !plus[1] || strlen(plus + 1) >= sizeof(global) || strchr(plus + 1, '+'))
+            return NULL;
+        memcpy(spec[0], name + 11, plus - name - 11);
+        spec[0][plus - name - 11] = '\0';
+        strcpy(spec[1], plus + 1);
+    }
+    struct Predictor* parts[2];
+    char names[2][64];
+    for (int i = 0; i < 2; ++i) {
+        int part_size = size;
+        char* eq = strchr(spec[i], '=');
+        if (eq) {
+            *eq = '\0';
+            part_size = atoi(eq + 1);
+        }
+        parts[i] = is_tournament(spec[i]) ? NULL
+                 : predictor_has_size(spec[i]) ? predictor_create(spec[i], part_size) : predictor_create(spec[i], 0);
+        if (!parts[i]) {
+            if (i == 1) parts[0]->destroy(parts[0]);
+            return NULL;
+        }
+        if (predictor_has_size(spec[i])) snprintf(names[i], sizeof(names[i]), "%s:%d", spec[i], part_size);
+        else snprintf(names[i], sizeof(names[i]), "%s", spec[i]);
+    }
+    const char* part_names[2] = { names[0], names[1] };
+    return predictor_tournament(parts, part_names, size);
+}
+
+/* ------------------ By name ------------------ */
+struct Predictor* predictor_create(const char* name, int size) {
+    if (!name) return NULL;
+    if (!strcmp(name, "nt")) return predictor_nt();
+    if (!strcmp(name, "btfnt")) return predictor_btfnt();
+    if (!strcmp(name, "bimodal")) return predictor_bimodal(size);
+    if (!strcmp(name, "gshare")) return predictor_gshare(size);
+    if (!strcmp(name, "tage")) return predictor_tage(size);
+    if (!strcmp(name, "bimode")) return predictor_bimode(size);
+    if (!strcmp(name, "agree")) return predictor_agree(size);
+    if (!strcmp(name, "yags")) return predictor_yags(size);
+    if (perceptron_history(name) > 0) return predictor_perceptron(size, perceptron_history(name));
+    int history, bht_size;
+    if (!local_params(name, &history, &bht_size)) {
+        /* the default history, if it does not fit a small pattern table */
+        if (!strchr(name, '/') && is_power_of_two(size) && history > log2_int(size)) history = log2_int(size);
+        return predictor_local(size, history, bht_size);
+    }
+    if (is_tournament(name)) return tournament_create(name, size);
+    return NULL;
+}
+
+int predictor_has_size(const char* name) {
+    int history, bht_size;
+    return !strcmp(name, "bimodal") || !strcmp(name, "gshare") || !strcmp(name, "tage")
+        || !strcmp(name, "bimode") || !strcmp(name, "agree") || !strcmp(name, "yags")
+        || perceptron_history(name) > 0 || is_tournament(name) || !local_params(name, &history, &bht_size);
+}
+
+/* ------------------ Several at once ------------------ */
+struct multi_state {
+    int n;
+    struct Predictor** parts;
+    char** names;
+    int* predicted;             // by each part for the current branch
+    struct BPStats* stats;      // per part
+};
+
+static int multi_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct multi_state* s = (struct multi_state*) self->state;
+    for (int i = 0; i < s->n; ++i)
+        s->predicted[i] = s->parts[i]->predict(s->parts[i], instr_pc, target_pc);
+    return s->predicted[0];
+}
+static void multi_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct multi_state* s = (struct multi_state*) self->state;
+    for (int i = 0; i < s->n; ++i) {
+        s->stats[i].total_branches++;
+        if (s->predicted[i] != taken) s->stats[i].mispredictions++;
+        s->parts[i]->update(s->parts[i], instr_pc, target_pc, taken);
+    }
+}
+static void multi_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct multi_state* s = (struct multi_state*) self->state;
+    if (s) {
+        for (int i = 0; i < s->n; ++i) {
+            if (s->parts && s->parts[i]) s->parts[i]->destroy(s->parts[i]);
+            if (s->names) free(s->names[i]);
+        }
+        free(s->parts);
+        free(s->names);
+        free(s->predicted);
+        free(s->stats);
+        free(s);
+    }
+    free(self);
+}
+static int multi_save(struct Predictor* self, FILE* f) {
+    struct multi_state* s = (struct multi_state*) self->state;
+    if (fwrite(&s->n, sizeof(s->n), 1, f) != 1) return -1;
+    for (int i = 0; i < s->n; ++i) {
+        struct Predictor* p = s->parts[i];
+        int32_t kind = (int32_t)p->kind;
+        if (fwrite(&kind, sizeof(kind), 1, f) != 1) return -1;
+        if (p->save && p->save(p, f) != 0) return -1;
+    }
+    return 0;
+}
+static int multi_load(struct Predictor* self, FILE* f) {
+    struct multi_state* s = (struct multi_state*) self->state;
+    int n;
+    if (fread(&n, sizeof(n), 1, f) != 1 || n != s->n) return -1;
+    for (int i = 0; i < s->n; ++i) {
+        struct Predictor* p = s->parts[i];
+        int32_t kind;
+        if (fread(&kind, sizeof(kind), 1, f) != 1 || kind != (int32_t)p->kind) return -1;
+        if (p->load && p->load(p, f) != 0) return -1;
+    }
+    return 0;
+}
+struct Predictor* predictor_multi(struct Predictor** parts, const char** names, int n) {
+    if (n < 1) return NULL;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    struct multi_state* s = calloc(1, sizeof(struct multi_state));
+    if (!p || !s) {
+        for (int i = 0; i < n; ++i) parts[i]->destroy(parts[i]);
+        free(p); free(s);
+        return NULL;
+    }
+    s->n = n;
+    s->parts = calloc(n, sizeof(struct Predictor*));
+    s->names = calloc(n, sizeof(char*));
+    s->predicted = calloc(n, sizeof(int));
+    s->stats = calloc(n, sizeof(struct BPStats));
+    p->state = s;
+    p->destroy = multi_destroy;
+    if (!s->parts || !s->names || !s->predicted || !s->stats) {
+        for (int i = 0; i < n; ++i) parts[i]->destroy(parts[i]);
+        s->n = 0;
+        multi_destroy(p);
+        return NULL;
+    }
+    int ok = 1;
+    for (int i = 0; i < n; ++i) {
+        s->parts[i] = parts[i];
+        s->names[i] = strdup(names[i]);
+        ok = ok && s->names[i];
+    }
+    if (!ok) { multi_destroy(p); return NULL; }
+    p->predict = multi_predict;
+    p->update  = multi_update;
+    p->save    = multi_save;
+    p->load    = multi_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_MULTI;
+    return p;
+}
+
+/* ------------------ Reports ------------------ */
+void predictor_print_stats(FILE* f, struct Predictor* predictor, const struct BPStats* stats, long insns) {
+    fprintf(f, "Total branches: %ld\n", stats->total_branches);
+    if (predictor && predictor->kind == PREDICTOR_MULTI) {
+        struct multi_state* ms = predictor->state;
+        fprintf(f, "%-20s %14s %9s %9s\n", "Predictor", "Mispredictions", "Rate", "MPKI");
+        for (int k = 0; k < ms->n; ++k) {
+            struct BPStats* ps = &ms->stats[k];
+            double rate = ps->total_branches ? (100.0 * (double)ps->mispredictions) / (double)ps->total_branches : 0.0;
+            double mpki = insns ? (1000.0 * (double)ps->mispredictions) / (double)insns : 0.0;
+            fprintf(f, "%-20s %14ld %8.2f%% %9.3f\n", ms->names[k], ps->mispredictions, rate, mpki);
+        }
+        for (int k = 0; k < ms->n; ++k)
+            if (ms->parts[k]->report) ms->parts[k]->report(ms->parts[k], f, ms->names[k], insns);
+        return;
+    }
+    fprintf(f, "Mispredictions: %ld\n", stats->mispredictions);
+    if (stats->total_branches > 0) {
+        double rate = (100.0 * (double)stats->mispredictions) / (double)stats->total_branches;
+        fprintf(f, "Misprediction rate: %.2f%%\n", rate);
+    }
+    if (insns > 0) {
+        double mpki = (1000.0 * (double)stats->mispredictions) / (double)insns;
+        fprintf(f, "MPKI: %.3f\n", mpki);
+    }
+    if (predictor && predictor->report) predictor->report(predictor, f, NULL, insns);
+}
+
+int predictor_track_aliasing(struct Predictor* predictor) {
+    if (predictor->kind == PREDICTOR_MULTI) {
+        struct multi_state* ms = predictor->state;
+        for (int k = 0; k < ms->n; ++k)
+            if (predictor_track_aliasing(ms->parts[k])) return -1;
+        return 0;
+    }
+    if (predictor->kind != PREDICTOR_BIMODE && predictor->kind != PREDICTOR_AGREE
+        && predictor->kind != PREDICTOR_YAGS) return 0;
+    struct aliasing* al = (struct aliasing*) predictor->state;
+    return alias_start(&al->own) || alias_start(&al->gshare) ? -1 : 0;
+}
+
+/* ------------------ By list ------------------ */
+/* "name" or "name:size" */
+struct Predictor* predictor_create_spec(const char* entry) {
+    char name[64];
+    size_t len = strcspn(entry, ":");
+    if (len >= sizeof(name)) return NULL;
+    memcpy(name, entry, len);
+    name[len] = '\0';
+    int size = entry[len] == ':' ? atoi(entry + len + 1) : 0;
+    return predictor_create(name, size);
+}
+
+struct Predictor* predictor_create_list(const char* list) {
+    char* copy = strdup(list);
+    if (!copy) return NULL;
+    int n = 1;
+    for (const char* c = list; *c; ++c) n += *c == ',';
+    struct Predictor** parts = calloc(n, sizeof(struct Predictor*));
+    const char** names = calloc(n, sizeof(char*));
+    struct Predictor* p = NULL;
+    int i = 0;
+    if (parts && names) {
+        char* save;
+        for (char* entry = strtok_r(copy, ",", &save); entry; entry = strtok_r(NULL, ",", &save)) {
+            names[i] = entry;
+            parts[i] = predictor_create_spec(entry);
+            if (!parts[i++]) break;
+        }
+    }
+    if (i == n && parts[n - 1]) {
+        /* predictor_multi owns the parts from here, even if it fails */
+        p = n == 1 ? parts[0] : predictor_multi(parts, names, n);
+    } else {
+        for (int k = 0; k < i; ++k)
+            if (parts[k]) parts[k]->destroy(parts[k]);
+    }
+    free(names);
+    free(parts);
+    free(copy);
+    return p;
+}
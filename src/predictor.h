@@ -2,11 +2,34 @@
 #define __PREDICTOR_H__
 
 #include <stdint.h>
+#include <stdio.h>
 
 // Outcome constants
 #define TAKEN     1
 #define NOT_TAKEN 0
 
+// Built-in predictor kinds. The simulator recognises these and runs
+// specialized code with the inline versions below instead of calling
+// predict/update through the function pointers.
+enum predictor_kind {
+    PREDICTOR_OTHER,    // anything else: only reached through the interface
+    PREDICTOR_NT,
+    PREDICTOR_BTFNT,
+    PREDICTOR_BIMODAL,
+    PREDICTOR_GSHARE,
+    PREDICTOR_MULTI,    // predictor_multi; runs through the interface
+    PREDICTOR_COUNTERS, // predictor_counters (counters.h); likewise
+    // The rest run through the interface too; their kind tells checkpoints
+    // which predictor saved the tables.
+    PREDICTOR_TAGE,
+    PREDICTOR_PERCEPTRON,
+    PREDICTOR_LOCAL,
+    PREDICTOR_BIMODE,
+    PREDICTOR_AGREE,
+    PREDICTOR_YAGS,
+    PREDICTOR_TOURNAMENT,
+};
+
 // Generic predictor interface -------------------------------
 // All predictors must implement these functions.
 
@@ -17,8 +40,19 @@ struct Predictor {
     void (*update)(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken);
     void (*destroy)(struct Predictor* self);
 
+    // Write/read the predictor's tables for checkpoints; NULL if it has
+    // none. load fails (-1) if the file holds a differently sized predictor.
+    int  (*save)(struct Predictor* self, FILE* f);
+    int  (*load)(struct Predictor* self, FILE* f);
+
+    // Extra lines for the -p profile, after the mispredictions; NULL if
+    // there are none. 'name' labels them inside a -b list, else NULL.
+    void (*report)(struct Predictor* self, FILE* f, const char* name, long insns);
+
     // Predictor-specific internal state lives here:
     void* state;
+
+    enum predictor_kind kind;
 };
 
 // --- Statistics for the simulator to fill in ---------------
@@ -28,12 +62,118 @@ struct BPStats {
 };
 
 // Create different predictors -------------------------------
-// Team member 2 will implement these constructors.
-// For now we ONLY declare them.
+// Each returns a predictor with cleared tables, or NULL for a bad size or
+// when out of memory.
 
 struct Predictor* predictor_nt();                  // Always Not Taken
 struct Predictor* predictor_btfnt();               // Backwards Taken, Forwards Not Taken
 struct Predictor* predictor_bimodal(int size);     // size in entries (256, 1024, 4096, 16384)
 struct Predictor* predictor_gshare(int size);      // size in entries
+struct Predictor* predictor_tage(int kb);          // storage budget in KB (tage.c)
+struct Predictor* predictor_perceptron(int rows, int history); // rows: power of two, history: 1..128 bits
+struct Predictor* predictor_local(int pht_size, int history, int bht_size); // two-level, see below
+struct Predictor* predictor_bimode(int size);      // entries per direction table (and choice table)
+struct Predictor* predictor_agree(int size);       // agree counters (and bias bits)
+struct Predictor* predictor_yags(int size);        // entries per exception cache (and choice table)
+
+// Two predictors and a chooser table of 'size' 2-bit counters indexed by
+// global history, as in the Alpha 21264: the chooser picks whose
+// prediction is used, and learns from the branches they disagree on.
+// parts[0] is the local (or bimodal) side, parts[1] the global one. Takes
+// ownership of both parts; 'names' are copied and only used for reports.
+struct Predictor* predictor_tournament(struct Predictor** parts, const char** names, int size);
+
+// By name as given to -b: "nt", "btfnt", "bimodal", "gshare", "tage",
+// "bimode", "agree", "yags", "perceptron" or "perceptron/<history>" (31
+// bits of history by default), "local", "local/<history>" or
+// "local/<history>/<bht size>" (10 bits in 1024 entries by default), and
+// "tournament" or "tournament/<local>+<global>" with parts named as here
+// (but not tournaments), each with an optional "=size", such as
+// "local/8+gshare=4096" (bimodal and gshare by default). 'size' is
+// only used by the sized ones: the rows of a perceptron, the pattern
+// table entries of a local predictor, the chooser entries of a tournament
+// and the size of its parts unless they give one. NULL for an unknown name
+// or a bad size.
+struct Predictor* predictor_create(const char* name, int size);
+
+// Whether -b name takes a size
+int predictor_has_size(const char* name);
+
+// One entry of a -b list, "name" or "name:size"
+struct Predictor* predictor_create_spec(const char* spec);
+
+// Several predictors fed the same branches in one run. Predicts (and is
+// accounted by the simulator) like the first one, and keeps statistics
+// for every one of them. Takes ownership of parts[0..n-1]; 'names' are
+// copied and only used for reports.
+struct Predictor* predictor_multi(struct Predictor** parts, const char** names, int n);
+
+// A -b list such as "bimodal:256,gshare:1024,nt": a single predictor for
+// one entry, predictor_multi for more. NULL if any entry is bad.
+struct Predictor* predictor_create_list(const char* list);
+
+// The branch part of a -p profile: total branches, then mispredictions,
+// rate and MPKI over 'insns' instructions (a table with one row per part
+// for predictor_multi), then each predictor's own report lines
+void predictor_print_stats(FILE* f, struct Predictor* predictor, const struct BPStats* stats, long insns);
+
+// Have bi-mode, agree and YAGS, also inside a -b list, tally which branch
+// trains which counter from now on, for the aliasing part of their report;
+// without it that part is left out. -1 when out of memory.
+int predictor_track_aliasing(struct Predictor* predictor);
+
+// Inline versions of the built-in predictors ----------------
+// Each returns the prediction for the branch and then updates the state
+// with the actual outcome, exactly like predict() followed by update().
+
+/* 2-bit saturating counters: 0..3 (>=2 means predict TAKEN) */
+static inline uint8_t counter_next(uint8_t ctr, int taken) {
+    if (taken) {
+        if (ctr < 3) ctr++;
+    } else {
+        if (ctr > 0) ctr--;
+    }
+    return ctr;
+}
+
+static inline int nt_predict_update(uint32_t instr_pc, uint32_t target_pc) {
+    (void)instr_pc; (void)target_pc;
+    return NOT_TAKEN;
+}
+
+static inline int btfnt_predict_update(uint32_t instr_pc, uint32_t target_pc) {
+    return (target_pc < instr_pc) ? TAKEN : NOT_TAKEN;
+}
+
+struct bimodal_state {
+    int size;
+    int idx_mask;
+    uint8_t *table;
+};
+
+static inline int bimodal_predict_update(struct bimodal_state* s, uint32_t instr_pc, int taken) {
+    uint32_t index = (instr_pc >> 2) & s->idx_mask;
+    uint8_t ctr = s->table[index];
+    s->table[index] = counter_next(ctr, taken);
+    return (ctr >= 2) ? TAKEN : NOT_TAKEN;
+}
+
+/* GHR bits = log2(size). Use index = ((instr_pc>>2) ^ GHR) & mask */
+struct gshare_state {
+    int size;
+    int idx_mask;
+    int ghr_bits;
+    uint32_t ghr;
+    uint8_t *table;
+};
+
+static inline int gshare_predict_update(struct gshare_state* s, uint32_t instr_pc, int taken) {
+    uint32_t pc_index = (instr_pc >> 2) & s->idx_mask;
+    uint32_t idx = (pc_index ^ (s->ghr & s->idx_mask)) & s->idx_mask;
+    uint8_t ctr = s->table[idx];
+    s->table[idx] = counter_next(ctr, taken);
+    s->ghr = ((s->ghr << 1) | (taken ? 1u : 0u)) & ((1u << s->ghr_bits) - 1u);
+    return (ctr >= 2) ? TAKEN : NOT_TAKEN;
+}
 
 #endif
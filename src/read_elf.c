@@ -9,7 +9,7 @@
 int read_elf(struct memory* mem, struct program_info* info, const char *filename, FILE *log_file) {
     FILE *file = fopen(filename, "rb");
     if (!file) {
-        fprintf(log_file, "Error opening file");
+        fprintf(log_file, "Error opening file\n");
         return -1;
     }
 
@@ -219,6 +219,20 @@ const char* symbols_value_to_sym(struct symbols* symbols, unsigned int value)
     return NULL;
 }
 
+int symbols_sym_to_value(struct symbols* symbols, const char* name, unsigned int* value)
+{
+    // prefer a global definition, but local labels are fine too
+    int found = 0;
+    for (int i = 0; i < symbols->num_symbols; i++) {
+        if (strcmp(&symbols->strtab[symbols->symbols[i].st_name], name) == 0) {
+            *value = symbols->symbols[i].st_value;
+            found = 1;
+            if (ELF32_ST_BIND(symbols->symbols[i].st_info)) break;
+        }
+    }
+    return found;
+}
+
 void symbols_delete(struct symbols* symbols)
 {
     free(symbols->strtab);
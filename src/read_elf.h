@@ -27,5 +27,8 @@ void symbols_delete(struct symbols* symbols);
 // map a value to a symbol (return NULL if no matching symbol found)
 const char* symbols_value_to_sym(struct symbols* symbols, unsigned int value);
 
+// map a symbol name to its value (return 0 if there is no such symbol)
+int symbols_sym_to_value(struct symbols* symbols, const char* name, unsigned int* value);
+
 
 #endif
@@ -0,0 +1,251 @@
+#include "replay.h"
+#include "counters.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+long replay(struct Predictor* predictor, const struct trace_record* r, uint64_t n) {
+    long miss = 0;
+    switch (predictor->kind) {
+    case PREDICTOR_NT:
+        for (uint64_t i = 0; i < n; i++) miss += (int)(r[i].pc_taken & 1u);
+        break;
+    case PREDICTOR_BTFNT:
+        for (uint64_t i = 0; i < n; i++) {
+            int taken = r[i].pc_taken & 1u;
+            miss += btfnt_predict_update(r[i].pc_taken & ~1u, r[i].target) != taken;
+        }
+        break;
+    case PREDICTOR_BIMODAL: {
+        struct bimodal_state* s = predictor->state;
+        for (uint64_t i = 0; i < n; i++) {
+            int taken = r[i].pc_taken & 1u;
+            miss += bimodal_predict_update(s, r[i].pc_taken & ~1u, taken) != taken;
+        }
+        break;
+    }
+    case PREDICTOR_GSHARE: {
+        struct gshare_state* s = predictor->state;
+        for (uint64_t i = 0; i < n; i++) {
+            int taken = r[i].pc_taken & 1u;
+            miss += gshare_predict_update(s, r[i].pc_taken & ~1u, taken) != taken;
+        }
+        break;
+    }
+    case PREDICTOR_COUNTERS: {
+        struct counters_state* s = predictor->state;
+        for (uint64_t i = 0; i < n; i++) {
+            int taken = r[i].pc_taken & 1u;
+            miss += counters_predict_update(s, r[i].pc_taken & ~1u, taken) != taken;
+        }
+        break;
+    }
+    default:
+        for (uint64_t i = 0; i < n; i++) {
+            uint32_t pc = r[i].pc_taken & ~1u;
+            int taken = r[i].pc_taken & 1u;
+            int predicted = predictor->predict(predictor, pc, r[i].target);
+            predictor->update(predictor, pc, r[i].target, taken);
+            miss += predicted != taken;
+        }
+        break;
+    }
+    return miss;
+}
+
+// --- Sweep -----------------------------------------------------------------
+
+struct config {
+    char* spec;
+    int line;                   // in the spec file
+    struct Predictor* predictor;
+    long mispredictions;
+};
+
+struct sweep {
+    const struct trace_file* trace;
+    struct config* configs;
+    int num_configs;
+    int threads;
+};
+
+// bimodal and gshare configs of a group, stepped together
+struct bank {
+    struct Predictor* predictor;        // predictor_counters
+    int n;
+    int configs[COUNTERS_MAX];
+};
+
+struct group {
+    struct sweep* sweep;
+    int id;                     // runs configs id, id + threads, ...
+    struct bank* banks;
+    int num_banks;
+    int* singles;               // the other configs
+    int num_singles;
+};
+
+// Returns the number of configs, or -1
+static int read_specs(const char* name, struct config** configs) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        fprintf(stderr, "Could not open spec file %s\n", name);
+        return -1;
+    }
+    int n = 0, capacity = 0, line = 0;
+    char buf[4096];
+    *configs = NULL;
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+        const char* p = buf + strspn(buf, " \t\r\n");
+        if (*p == '#') continue;
+        char* save;
+        for (char* spec = strtok_r(buf, ", \t\r\n", &save); spec; spec = strtok_r(NULL, ", \t\r\n", &save)) {
+            if (n == capacity) {
+                capacity = capacity ? 2 * capacity : 64;
+                *configs = realloc(*configs, capacity * sizeof(struct config));
+                if (!*configs) {
+                    fprintf(stderr, "Out of memory reading spec file\n");
+                    exit(-1);
+                }
+            }
+            struct config* c = &(*configs)[n];
+            c->spec = strdup(spec);
+            c->line = line;
+            c->predictor = predictor_create_spec(spec);
+            c->mispredictions = 0;
+            if (!c->spec || !c->predictor) {
+                fprintf(stderr, "%s:%d: bad predictor %s\n", name, line, spec);
+                if (c->predictor) c->predictor->destroy(c->predictor);
+                free(c->spec);
+                for (int k = 0; k < n; k++) {
+                    (*configs)[k].predictor->destroy((*configs)[k].predictor);
+                    free((*configs)[k].spec);
+                }
+                free(*configs);
+                fclose(f);
+                return -1;
+            }
+            n++;
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+static int table_size(const struct Predictor* p) {
+    if (p->kind == PREDICTOR_BIMODAL) return ((const struct bimodal_state*)p->state)->size;
+    if (p->kind == PREDICTOR_GSHARE) return ((const struct gshare_state*)p->state)->size;
+    return 0;
+}
+
+static void bank_create(struct bank* b, const enum predictor_kind* kinds, const int* sizes, int simd) {
+    b->predictor = predictor_counters(kinds, sizes, b->n, simd);
+    if (!b->predictor) {
+        fprintf(stderr, "Out of memory in sweep\n");
+        exit(-1);
+    }
+}
+
+// Splits the configs of group g into banks of up to COUNTERS_MAX counter
+// predictors and the rest
+static void group_setup(struct group* g, int simd) {
+    struct sweep* s = g->sweep;
+    int mine = (s->num_configs - g->id + s->threads - 1) / s->threads;
+    g->banks = calloc(mine / COUNTERS_MAX + 1, sizeof(struct bank));
+    g->singles = calloc(mine + 1, sizeof(int));
+    if (!g->banks || !g->singles) {
+        fprintf(stderr, "Out of memory in sweep\n");
+        exit(-1);
+    }
+    enum predictor_kind kinds[COUNTERS_MAX];
+    int sizes[COUNTERS_MAX];
+    for (int i = g->id; i < s->num_configs; i += s->threads) {
+        struct Predictor* p = s->configs[i].predictor;
+        if (!table_size(p)) {
+            g->singles[g->num_singles++] = i;
+            continue;
+        }
+        struct bank* b = &g->banks[g->num_banks];
+        if (b->n == COUNTERS_MAX) b = &g->banks[++g->num_banks];
+        kinds[b->n] = p->kind;
+        sizes[b->n] = table_size(p);
+        b->configs[b->n++] = i;
+        if (b->n == COUNTERS_MAX) bank_create(b, kinds, sizes, simd);
+    }
+    struct bank* last = &g->banks[g->num_banks];
+    if (last->n > 0 && last->n < COUNTERS_MAX) bank_create(last, kinds, sizes, simd);
+    if (last->n > 0) g->num_banks++;
+}
+
+static void* group_main(void* arg) {
+    struct group* g = arg;
+    struct sweep* s = g->sweep;
+    // every thread decodes the blocks it needs itself
+    struct trace_decoder* dec = s->trace->records ? NULL : trace_decoder_create();
+    for (uint64_t b = 0; b < s->trace->num_blocks; b++) {
+        uint32_t n;
+        const struct trace_record* r = trace_block(s->trace, b, dec, &n);
+        for (int k = 0; k < g->num_banks; k++) replay(g->banks[k].predictor, r, n);
+        for (int k = 0; k < g->num_singles; k++) {
+            struct config* c = &s->configs[g->singles[k]];
+            c->mispredictions += replay(c->predictor, r, n);
+        }
+    }
+    trace_decoder_delete(dec);
+    // the banks count every lane's mispredictions themselves
+    for (int k = 0; k < g->num_banks; k++) {
+        struct bank* b = &g->banks[k];
+        struct BPStats stats[COUNTERS_MAX];
+        counters_stats(b->predictor, stats);
+        for (int l = 0; l < b->n; l++) s->configs[b->configs[l]].mispredictions = stats[l].mispredictions;
+        b->predictor->destroy(b->predictor);
+    }
+    free(g->banks);
+    free(g->singles);
+    return NULL;
+}
+
+int replay_sweep(const struct trace_file* t, const char* spec_file, int threads, int simd, FILE* csv) {
+    struct sweep s = { .trace = t, .threads = threads };
+    s.num_configs = read_specs(spec_file, &s.configs);
+    if (s.num_configs < 0) return -1;
+    if (s.threads > s.num_configs) s.threads = s.num_configs > 0 ? s.num_configs : 1;
+
+    struct group* groups = calloc(s.threads, sizeof(struct group));
+    pthread_t* ids = calloc(s.threads, sizeof(pthread_t));
+    if (!groups || !ids) {
+        fprintf(stderr, "Out of memory in sweep\n");
+        exit(-1);
+    }
+    for (int g = 0; g < s.threads; g++) {
+        groups[g] = (struct group){ .sweep = &s, .id = g };
+        group_setup(&groups[g], simd);
+        if (pthread_create(&ids[g], NULL, group_main, &groups[g])) {
+            fprintf(stderr, "Could not start sweep thread\n");
+            exit(-1);
+        }
+    }
+    for (int g = 0; g < s.threads; g++) pthread_join(ids[g], NULL);
+
+    long branches = (long)t->header->count;
+    long insns = (long)t->header->insns;
+    fprintf(csv, "config,predictor,size,branches,mispredictions,rate,mpki\n");
+    for (int i = 0; i < s.num_configs; i++) {
+        struct config* c = &s.configs[i];
+        size_t len = strcspn(c->spec, ":");
+        int size = c->spec[len] == ':' ? atoi(c->spec + len + 1) : 0;
+        double rate = branches ? (100.0 * (double)c->mispredictions) / (double)branches : 0.0;
+        double mpki = insns ? (1000.0 * (double)c->mispredictions) / (double)insns : 0.0;
+        fprintf(csv, "%s,%.*s,%d,%ld,%ld,%.4f,%.4f\n", c->spec, (int)len, c->spec, size,
+                branches, c->mispredictions, rate, mpki);
+        c->predictor->destroy(c->predictor);
+        free(c->spec);
+    }
+    free(ids);
+    free(groups);
+    free(s.configs);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "predictor.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
+
+// --- Trace replay ----------------------------------------------------------
+//
+// Runs predictors over a recorded branch trace (see trace.h) instead of
+// over a running program. Each record is predicted and then updated with
+// its recorded outcome, exactly as the simulator would have done, so the
+// results match a sim -b run of the traced program.
+
+// Returns the mispredictions over n records. The built-in predictors run
+// with their inline versions; anything else goes through predict/update.
+long replay(struct Predictor* predictor, const struct trace_record* records, uint64_t n);
+
+// Design-space sweep: every predictor spec of 'spec_file' over the whole
+// trace, written as one CSV line per spec (in file order):
+//
+//   config,predictor,size,branches,mispredictions,rate,mpki
+//
+// Specs are -b list entries ("gshare:4096", "btfnt", ...), separated by
+// commas or white space; lines starting with # are skipped. They are dealt
+// out round robin to 'threads' host threads, and each thread streams the
+// shared mapping once, running all of its predictors over each block of
+// records (decoded by the thread, for a compressed trace) while the block
+// is in cache. A thread's bimodal and gshare
+// configs run as counter banks (counters.h), with AVX2 if 'simd' is set.
+// Returns 0 on success, -1 if the spec file could not be read (reported
+// on stderr).
+int replay_sweep(const struct trace_file* t, const char* spec_file, int threads, int simd, FILE* csv);
+
+#endif
@@ -0,0 +1,327 @@
+// simpoint - picks simulation points from the basic-block vectors of a run
+//
+//   sim prog.elf -bbv prog.bb -interval N
+//   simpoint prog.bb [-k max] [-seeds n] [-o points]
+//   sim prog.elf -sample points -interval N -warmup W -b gshare 1024
+//
+// Each interval's vector is normalised to instruction fractions and
+// randomly projected down to DIMS dimensions. k-means (k-means++ start,
+// best of several seeds) clusters the intervals for k = 1 .. max, and the
+// smallest k whose BIC score reaches 90% of the best spread wins. For each
+// cluster the interval closest to its centre is written, with the fraction
+// of all intervals the cluster holds as its weight:
+//
+//   <interval> <weight>
+//
+// sorted by interval.
+//
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DIMS 15
+#define MAX_ITERATIONS 100
+
+static void terminate(const char *error)
+{
+  printf("%s\n", error);
+  printf("SimPoint clustering: Usage:\n");
+  printf("  simpoint file.bb [-k max-clusters] [-seeds n] [-o output]\n");
+  exit(-1);
+}
+
+static void* xrealloc(void* p, size_t size)
+{
+  p = realloc(p, size);
+  if (!p) terminate("Out of memory");
+  return p;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng_next(void)
+{
+  // xorshift64*
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static double rng_uniform(void)
+{
+  return (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+// Projection matrix entry for block 'id' and dimension 'dim', uniform in
+// [-1, 1); a hash, so no matrix has to be kept for every block
+static double projection(uint32_t id, int dim)
+{
+  uint64_t h = ((uint64_t)id << 8 | (uint64_t)dim) * 0x9e3779b97f4a7c15ull;
+  h ^= h >> 29;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 32;
+  return (double)(h >> 11) / 4503599627370496.0 - 1.0;
+}
+
+// Reads the .bb file into one projected vector per interval
+static double (*read_vectors(const char* name, int* num_intervals))[DIMS]
+{
+  FILE* f = fopen(name, "r");
+  if (!f) terminate("Could not open BBV file, terminating.");
+
+  double (*vectors)[DIMS] = NULL;
+  int n = 0, capacity = 0;
+  int c;
+  while ((c = fgetc(f)) != EOF) {
+    if (c != 'T') {
+      // skip anything that is not a vector line
+      while (c != '\n' && c != EOF) c = fgetc(f);
+      continue;
+    }
+    if (n == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      vectors = xrealloc(vectors, capacity * sizeof(*vectors));
+    }
+    double* v = vectors[n++];
+    for (int j = 0; j < DIMS; j++) v[j] = 0.0;
+
+    unsigned id;
+    long count;
+    double total = 0.0;
+    while (fscanf(f, " :%u:%ld", &id, &count) == 2) {
+      for (int j = 0; j < DIMS; j++) v[j] += count * projection(id, j);
+      total += count;
+    }
+    if (total > 0.0) {
+      for (int j = 0; j < DIMS; j++) v[j] /= total;
+    }
+  }
+  fclose(f);
+  *num_intervals = n;
+  return vectors;
+}
+
+static double distance2(const double* a, const double* b)
+{
+  double d = 0.0;
+  for (int j = 0; j < DIMS; j++) d += (a[j] - b[j]) * (a[j] - b[j]);
+  return d;
+}
+
+static int nearest(const double* v, double (*centers)[DIMS], int k, double* dist)
+{
+  int best = 0;
+  double best_d = distance2(v, centers[0]);
+  for (int c = 1; c < k; c++) {
+    double d = distance2(v, centers[c]);
+    if (d < best_d) {
+      best_d = d;
+      best = c;
+    }
+  }
+  if (dist) *dist = best_d;
+  return best;
+}
+
+// One k-means run from a k-means++ start. Returns the sum of squared
+// distances; fills in centers and assign.
+static double kmeans(double (*x)[DIMS], int n, int k, double (*centers)[DIMS], int* assign)
+{
+  double* d2 = malloc(n * sizeof(double));
+  if (!d2) terminate("Out of memory");
+
+  // k-means++: each next centre is picked with probability proportional to
+  // its squared distance from the centres so far
+  memcpy(centers[0], x[rng_next() % n], sizeof(centers[0]));
+  for (int c = 1; c < k; c++) {
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+      nearest(x[i], centers, c, &d2[i]);
+      sum += d2[i];
+    }
+    int pick = (int)(rng_next() % n);
+    if (sum > 0.0) {
+      double r = rng_uniform() * sum;
+      for (pick = 0; pick < n - 1; pick++) {
+        r -= d2[pick];
+        if (r < 0.0) break;
+      }
+    }
+    memcpy(centers[c], x[pick], sizeof(centers[c]));
+  }
+
+  for (int i = 0; i < n; i++) assign[i] = -1;
+  int* sizes = malloc(k * sizeof(int));
+  if (!sizes) terminate("Out of memory");
+  for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
+    int changed = 0;
+    for (int i = 0; i < n; i++) {
+      int c = nearest(x[i], centers, k, NULL);
+      if (c != assign[i]) {
+        assign[i] = c;
+        changed = 1;
+      }
+    }
+    if (!changed) break;
+    for (int c = 0; c < k; c++) {
+      sizes[c] = 0;
+      for (int j = 0; j < DIMS; j++) centers[c][j] = 0.0;
+    }
+    for (int i = 0; i < n; i++) {
+      sizes[assign[i]]++;
+      for (int j = 0; j < DIMS; j++) centers[assign[i]][j] += x[i][j];
+    }
+    for (int c = 0; c < k; c++) {
+      // an empty cluster keeps its (zeroed) centre; it only costs BIC
+      if (sizes[c] == 0) continue;
+      for (int j = 0; j < DIMS; j++) centers[c][j] /= sizes[c];
+    }
+  }
+
+  double sse = 0.0;
+  for (int i = 0; i < n; i++) sse += distance2(x[i], centers[assign[i]]);
+  free(sizes);
+  free(d2);
+  return sse;
+}
+
+// Bayesian information criterion of a clustering, for spherical Gaussians
+// with one shared variance (Pelleg and Moore, as used by SimPoint)
+static double bic(int n, int k, double sse, const int* assign)
+{
+  int* sizes = calloc(k, sizeof(int));
+  if (!sizes) terminate("Out of memory");
+  for (int i = 0; i < n; i++) sizes[assign[i]]++;
+
+  double variance = n > k ? sse / ((double)DIMS * (n - k)) : 0.0;
+  if (variance < 1e-12) variance = 1e-12;
+  double likelihood = 0.0;
+  for (int c = 0; c < k; c++) {
+    double r = sizes[c];
+    if (r == 0) continue;
+    likelihood += -r / 2.0 * log(2.0 * M_PI)
+                  - r * DIMS / 2.0 * log(variance)
+                  - (r - k) / 2.0
+                  + r * log(r) - r * log((double)n);
+  }
+  free(sizes);
+  double params = (k - 1) + (double)DIMS * k + 1;
+  return likelihood - params / 2.0 * log((double)n);
+}
+
+struct point {
+  long interval;
+  double weight;
+};
+
+static int by_interval(const void* a, const void* b)
+{
+  long x = ((const struct point*)a)->interval;
+  long y = ((const struct point*)b)->interval;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) terminate("Missing operands");
+
+  int max_k = 10;
+  int seeds = 5;
+  const char* out_name = NULL;
+  for (int i = 2; i < argc; i++) {
+    if (!strcmp(argv[i], "-k")) {
+      if (i + 1 >= argc) terminate("Missing cluster count after -k");
+      max_k = atoi(argv[++i]);
+      if (max_k < 1) terminate("Cluster count must be at least 1");
+    } else if (!strcmp(argv[i], "-seeds")) {
+      if (i + 1 >= argc) terminate("Missing count after -seeds");
+      seeds = atoi(argv[++i]);
+      if (seeds < 1) terminate("Seed count must be at least 1");
+    } else if (!strcmp(argv[i], "-o")) {
+      if (i + 1 >= argc) terminate("Missing file name after -o");
+      out_name = argv[++i];
+    } else {
+      terminate("Unknown option");
+    }
+  }
+
+  int n;
+  double (*x)[DIMS] = read_vectors(argv[1], &n);
+  if (n == 0) terminate("No intervals in BBV file");
+  if (max_k > n) max_k = n;
+
+  // best clustering (over the seeds) for each k
+  double (*centers)[DIMS] = malloc(max_k * sizeof(*centers));
+  double (*best_centers)[DIMS] = malloc((size_t)max_k * max_k * sizeof(*centers));
+  int* assign = malloc(n * sizeof(int));
+  int* best_assign = malloc((size_t)max_k * n * sizeof(int));
+  double* scores = malloc(max_k * sizeof(double));
+  if (!centers || !best_centers || !assign || !best_assign || !scores) terminate("Out of memory");
+
+  for (int k = 1; k <= max_k; k++) {
+    double best_sse = INFINITY;
+    for (int s = 0; s < seeds; s++) {
+      double sse = kmeans(x, n, k, centers, assign);
+      if (sse < best_sse) {
+        best_sse = sse;
+        memcpy(best_centers + (size_t)(k - 1) * max_k, centers, k * sizeof(*centers));
+        memcpy(best_assign + (size_t)(k - 1) * n, assign, n * sizeof(int));
+      }
+    }
+    scores[k - 1] = bic(n, k, best_sse, best_assign + (size_t)(k - 1) * n);
+  }
+
+  double lo = scores[0], hi = scores[0];
+  for (int k = 1; k < max_k; k++) {
+    if (scores[k] < lo) lo = scores[k];
+    if (scores[k] > hi) hi = scores[k];
+  }
+  int k = 1;
+  while (k < max_k && scores[k - 1] < lo + 0.9 * (hi - lo)) k++;
+
+  // the interval closest to each non-empty cluster's centre stands for it
+  double (*kc)[DIMS] = best_centers + (size_t)(k - 1) * max_k;
+  int* ka = best_assign + (size_t)(k - 1) * n;
+  struct point* points = malloc(k * sizeof(struct point));
+  if (!points) terminate("Out of memory");
+  int num_points = 0;
+  for (int c = 0; c < k; c++) {
+    int size = 0, rep = -1;
+    double rep_d = INFINITY;
+    for (int i = 0; i < n; i++) {
+      if (ka[i] != c) continue;
+      size++;
+      double d = distance2(x[i], kc[c]);
+      if (d < rep_d) {
+        rep_d = d;
+        rep = i;
+      }
+    }
+    if (size == 0) continue;
+    points[num_points].interval = rep;
+    points[num_points].weight = (double)size / n;
+    num_points++;
+  }
+  qsort(points, num_points, sizeof(struct point), by_interval);
+
+  FILE* out = stdout;
+  if (out_name) {
+    out = fopen(out_name, "w");
+    if (!out) terminate("Could not open output file, terminating.");
+  }
+  for (int p = 0; p < num_points; p++) fprintf(out, "%ld %.6f\n", points[p].interval, points[p].weight);
+  if (out_name) fclose(out);
+  fprintf(stderr, "%d intervals, %d clusters (BIC %.1f)\n", n, num_points, scores[k - 1]);
+
+  free(points);
+  free(scores);
+  free(best_assign);
+  free(assign);
+  free(best_centers);
+  free(centers);
+  free(x);
+  return 0;
+}
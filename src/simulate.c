@@ -1,60 +1,17 @@
 #include "simulate.h"
 #include "disassemble.h"
+#include "decode.h"
+#include "block.h"
+#include "jit.h"
+#include "bbv.h"
+#include "trace.h"
+#include "btb.h"
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// --- Small helpers ---------------------------------------------------------
-
-// Sign-extend 'val' which is 'bits' wide (bits <= 32)
-static int32_t sext(int32_t val, int bits) {
-    int32_t m = 1 << (bits - 1);
-    return (val ^ m) - m;
-}
-
-// I-type immediate (12-bit)
-static int32_t imm_i(uint32_t inst) {
-    int32_t imm = (int32_t)(inst >> 20);
-    return sext(imm, 12);
-}
-
-// S-type immediate (12-bit)
-static int32_t imm_s(uint32_t inst) {
-    uint32_t imm = ((inst >> 7) & 0x1f) | (((inst >> 25) & 0x7f) << 5);
-    return sext((int32_t)imm, 12);
-}
-
-// B-type immediate (branch, 13-bit incl. sign, then << 1)
-static int32_t imm_b(uint32_t inst) {
-    uint32_t imm = 0;
-    imm |= ((inst >> 8) & 0x0f) << 1;      // bits 4:1
-    imm |= ((inst >> 25) & 0x3f) << 5;     // bits 10:5
-    imm |= ((inst >> 7) & 0x01) << 11;     // bit 11
-    imm |= ((inst >> 31) & 0x01) << 12;    // bit 12 (sign)
-    return sext((int32_t)imm, 13);
-}
-
-// U-type immediate (upper 20 bits, already aligned)
-static int32_t imm_u(uint32_t inst) {
-    return (int32_t)(inst & 0xfffff000);
-}
-
-// J-type immediate (jump, 21-bit incl. sign, then << 1)
-static int32_t imm_j(uint32_t inst) {
-    uint32_t imm = 0;
-    imm |= ((inst >> 21) & 0x3ff) << 1;    // bits 10:1
-    imm |= ((inst >> 20) & 0x001) << 11;   // bit 11
-    imm |= ((inst >> 12) & 0x0ff) << 12;   // bits 19:12
-    imm |= ((inst >> 31) & 0x001) << 20;   // bit 20 (sign)
-    return sext((int32_t)imm, 21);
-}
-
-// Convenience: enforce that x0 is always zero
-static void enforce_x0(int32_t regs[32]) {
-    regs[0] = 0;
-}
-
 // --- System call handling --------------------------------------------------
 //
 // ecall: opcode 0x73, funct3 = 0, imm = 0
@@ -65,19 +22,23 @@ static void enforce_x0(int32_t regs[32]) {
 // 2 : putchar(A0)
 // 3, 93 : terminate simulation
 //
-static int handle_ecall(int32_t regs[32]) {
+static int handle_ecall(const struct sim_console* console, int32_t regs[32]) {
     int32_t call = regs[17]; // a7
     switch (call) {
         case 1: {
-            int ch = getchar();
+            int ch = console ? console->getc(console->user) : getchar();
             if (ch == EOF) ch = -1;
             regs[10] = ch; // a0
             break;
         }
         case 2: {
             int ch = regs[10] & 0xff;
-            putchar(ch);
-            fflush(stdout);
+            if (console) {
+                console->putc(console->user, ch);
+            } else {
+                putchar(ch);
+                fflush(stdout);
+            }
             break;
         }
         case 3:
@@ -92,358 +53,650 @@ static int handle_ecall(int32_t regs[32]) {
     return 1; // continue
 }
 
-// --- Main simulation -------------------------------------------------------
+// --- Instruction semantics -------------------------------------------------
 //
-// This is a first, "foundation" implementation: it can run RV32I + RV32M
-// programs and handle the required system calls. Logging and branch
-// prediction will be added on top later.
-//
-struct Stat simulate(struct memory *mem, int start_addr,
-                     FILE *log_file, struct symbols* symbols,
-                     struct Predictor* predictor, struct BPStats* stats) {
+// Shared by every engine below. Inside the expressions r1/r2 are the values
+// of rs1/rs2, imm is the predecoded immediate and mem is the guest memory.
 
-    (void)log_file;   // not used yet – we’ll hook this up later
-    (void)symbols;    // ditto
-
-    int32_t regs[32];
-    for (int i = 0; i < 32; i++) regs[i] = 0;
-    enforce_x0(regs);
-
-    uint32_t pc = (uint32_t) start_addr;
-    long int insn_count = 0;
-    int running = 1;
+static inline int32_t op_div(int32_t r1, int32_t r2) {
+    if (r2 == 0) return -1;
+    if (r1 == INT32_MIN && r2 == -1) return INT32_MIN;
+    return r1 / r2;
+}
+static inline int32_t op_divu(int32_t r1, int32_t r2) {
+    if (r2 == 0) return -1;
+    return (int32_t)((uint32_t)r1 / (uint32_t)r2);
+}
+static inline int32_t op_rem(int32_t r1, int32_t r2) {
+    if (r2 == 0) return r1;
+    if (r1 == INT32_MIN && r2 == -1) return 0;
+    return r1 % r2;
+}
+static inline int32_t op_remu(int32_t r1, int32_t r2) {
+    if (r2 == 0) return r1;
+    return (int32_t)((uint32_t)r1 % (uint32_t)r2);
+}
 
-    while (running) {
-        uint32_t addr = pc;
-        uint32_t inst = (uint32_t) memory_rd_w(mem, (int)pc);
+// rd = expr (LUI/AUIPC values are folded in at decode time)
+#define ALU_OPS(X)                                                      \
+    X(LUI,   imm)                                                       \
+    X(AUIPC, imm)                                                       \
+    X(ADDI,  r1 + imm)                                                  \
+    X(SLTI,  (r1 < imm) ? 1 : 0)                                        \
+    X(SLTIU, ((uint32_t)r1 < (uint32_t)imm) ? 1 : 0)                    \
+    X(XORI,  r1 ^ imm)                                                  \
+    X(ORI,   r1 | imm)                                                  \
+    X(ANDI,  r1 & imm)                                                  \
+    X(SLLI,  (int32_t)((uint32_t)r1 << imm))                            \
+    X(SRLI,  (int32_t)((uint32_t)r1 >> imm))                            \
+    X(SRAI,  r1 >> imm)                                                 \
+    X(ADD,   r1 + r2)                                                   \
+    X(SUB,   r1 - r2)                                                   \
+    X(SLL,   (int32_t)((uint32_t)r1 << (r2 & 0x1f)))                    \
+    X(SLT,   (r1 < r2) ? 1 : 0)                                         \
+    X(SLTU,  ((uint32_t)r1 < (uint32_t)r2) ? 1 : 0)                     \
+    X(XOR,   r1 ^ r2)                                                   \
+    X(SRL,   (int32_t)((uint32_t)r1 >> (r2 & 0x1f)))                    \
+    X(SRA,   r1 >> (r2 & 0x1f))                                         \
+    X(OR,    r1 | r2)                                                   \
+    X(AND,   r1 & r2)                                                   \
+    X(MUL,   r1 * r2)                                                   \
+    X(DIV,   op_div(r1, r2))                                            \
+    X(DIVU,  op_divu(r1, r2))                                           \
+    X(REM,   op_rem(r1, r2))                                            \
+    X(REMU,  op_remu(r1, r2))
+
+// taken = cond
+#define BRANCH_OPS(X)                                                   \
+    X(BEQ,  r1 == r2)                                                   \
+    X(BNE,  r1 != r2)                                                   \
+    X(BLT,  r1 <  r2)                                                   \
+    X(BGE,  r1 >= r2)                                                   \
+    X(BLTU, (uint32_t)r1 <  (uint32_t)r2)                               \
+    X(BGEU, (uint32_t)r1 >= (uint32_t)r2)
+
+// rd = load from r1 + imm
+#define LOAD_OPS(X)                                                     \
+    X(LB,  (int8_t) memory_rd_b(mem, r1 + imm))                         \
+    X(LH,  (int16_t) memory_rd_h(mem, r1 + imm))                        \
+    X(LW,  memory_rd_w(mem, r1 + imm))                                  \
+    X(LBU, memory_rd_b(mem, r1 + imm) & 0xff)                           \
+    X(LHU, memory_rd_h(mem, r1 + imm) & 0xffff)
+
+// write function(mem, r1 + imm, r2)
+#define STORE_OPS(X)                                                    \
+    X(SB, memory_wr_b)                                                  \
+    X(SH, memory_wr_h)                                                  \
+    X(SW, memory_wr_w)
+
+// Value of an ALU op. Only called with a constant op (the first half of a
+// superinstruction), where it folds down to the expression itself.
+static inline int32_t alu_eval(int op, int32_t r1, int32_t r2, int32_t imm) {
+    switch (op) {
+#define ALU_EVAL(name, expr) case OP_##name: return (expr);
+        ALU_OPS(ALU_EVAL)
+#undef ALU_EVAL
+        default: return 0;
+    }
+}
 
-        pc += 4;
-        insn_count++;
+// Predictor bookkeeping for one conditional branch. The prediction does not
+// depend on the outcome, so it is fine to ask for it after resolving.
+static inline void branch_account(struct Predictor* predictor, struct BPStats* stats,
+                                  uint32_t addr, uint32_t target_pc, int taken) {
+    int predicted_taken = predictor->predict(predictor, addr, target_pc);
+    stats->total_branches++;
+    if (predicted_taken != taken)
+        stats->mispredictions++;
+    predictor->update(predictor, addr, target_pc, taken);
+}
 
-        uint32_t opcode = inst & 0x7f;
-        uint32_t rd     = (inst >> 7) & 0x1f;
-        uint32_t funct3 = (inst >> 12) & 0x7;
-        uint32_t rs1    = (inst >> 15) & 0x1f;
-        uint32_t rs2    = (inst >> 20) & 0x1f;
-        uint32_t funct7 = (inst >> 25) & 0x7f;
+// --- Engines ---------------------------------------------------------------
+//
+// The engines live in simulate_engines.inc and are instantiated once per
+// instrumentation variant (enum sim_variant), so a run without -b has no
+// predictor code in its hot loop at all, and the built-in predictors are
+// inlined instead of being called through the struct Predictor pointers.
+
+// Everything an engine needs. An engine runs from 'pc' until the program
+// exits, it gets to 'stop_pc', or 'limit' instructions have run (the block
+// engine may stop a little earlier, see there). It leaves the next pc in
+// 'pc' and the reason it stopped in 'event', and returns the number of
+// instructions it executed.
+struct run {
+    uint32_t pc;
+    long limit;
+    uint32_t stop_pc;           // DECODE_NO_PC for none
+    enum sim_event event;
+
+    struct memory* mem;
+    // caches, created on first use and kept until run_release
+    struct decode_cache* dc;
+    struct block_cache* bc;
+    struct jit* jit;
+    long dc_flushes;            // bc->flushes when dc was last in sync with bc
+    int code_written;           // the switch engine stored to a word in bc
+
+    int32_t* regs;              // NUM_REGS
+    struct Predictor* predictor;
+    struct BPStats* stats;
+    long* fused;                // NUM_FUSED_OPS counters
+    int fuse;
+    int use_jit;
+    FILE* log_file;
+    struct symbols* symbols;
+    struct bbv* bbv;
+    struct trace_writer* trace;
+    struct btb* btb;
+    const struct sim_console* console;  // NULL for stdin/stdout
+};
+
+typedef long (*engine_fn)(struct run* run);
+
+#if defined(__GNUC__)
+#define HAVE_COMPUTED_GOTO 1
+#endif
+
+#define JIT_THRESHOLD 32
+
+struct jit_user {
+    struct run* run;
+    struct Predictor* predictor;
+    struct BPStats* stats;
+};
+
+// One log line per executed instruction: count, pc, encoding, disassembly
+// and what it wrote. 'ea'/'value' are the store address and data, 'next_pc'
+// the pc after it.
+static void log_insn(struct run* run, long count, uint32_t addr, uint32_t inst,
+                     const struct decoded* d, int32_t ea, int32_t value, uint32_t next_pc) {
+    char disassembly[100];
+    disassemble(addr, inst, disassembly, sizeof(disassembly), run->symbols);
+    fprintf(run->log_file, "%8ld %8x : %08X  %-32s", count, addr, inst, disassembly);
+    switch (d->op) {
+#define LOG_WRITE(name, expr) case OP_##name:
+        ALU_OPS(LOG_WRITE)
+        LOAD_OPS(LOG_WRITE)
+#undef LOG_WRITE
+        case OP_JAL:
+        case OP_JALR:
+            if (d->rd != REG_SINK)
+                fprintf(run->log_file, " R[%2d] <- %08x", d->rd, (uint32_t)run->regs[d->rd]);
+            break;
+        case OP_SB: value &= 0xff; /* fall through */
+        case OP_SH: value &= 0xffff; /* fall through */
+        case OP_SW:
+            fprintf(run->log_file, " M[%08x] <- %x", (uint32_t)ea, (uint32_t)value);
+            break;
+        default:
+            break;
+    }
+    if (next_pc != addr + 4)
+        fprintf(run->log_file, " -> %08x", next_pc);
+    fprintf(run->log_file, "\n");
+}
 
-        int32_t r1 = regs[rs1];
-        int32_t r2 = regs[rs2];
+// branch counted, mispredicted if 'predicted' differs from 'taken'
+#define ACCOUNT(predicted, taken)                                       \
+    do {                                                                \
+        stats->total_branches++;                                        \
+        if ((predicted) != (taken)) stats->mispredictions++;            \
+    } while (0)
+
+// Only the BBV variant has a block hook, and only the BTB variant a jump hook
+#define BLOCK_HOOK(pc, n) ((void)0)
+#define HAVE_BLOCK_HOOK 0
+#define JUMP_HOOK(addr, target, kind) ((void)0)
+#define HAVE_JUMP_HOOK 0
+
+// No instrumentation
+#define VARIANT(name) name##_plain
+#define PREDICTOR_SETUP
+#define BRANCH_HOOK(addr, target, taken) ((void)0)
+#define HAVE_BRANCH_HOOK 0
+#define LOGGING 0
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+#undef HAVE_BRANCH_HOOK
+
+// Built-in predictors, inlined
+#define HAVE_BRANCH_HOOK 1
+
+#define VARIANT(name) name##_nt
+#define BRANCH_HOOK(addr, target, taken) \
+    ACCOUNT(nt_predict_update(addr, target), taken)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+
+#define VARIANT(name) name##_btfnt
+#define BRANCH_HOOK(addr, target, taken) \
+    ACCOUNT(btfnt_predict_update(addr, target), taken)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+
+#undef PREDICTOR_SETUP
+#define PREDICTOR_SETUP struct bimodal_state* pstate = predictor->state;
+#define VARIANT(name) name##_bimodal
+#define BRANCH_HOOK(addr, target, taken) \
+    ACCOUNT(bimodal_predict_update(pstate, addr, taken), taken)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+
+#undef PREDICTOR_SETUP
+#define PREDICTOR_SETUP struct gshare_state* pstate = predictor->state;
+#define VARIANT(name) name##_gshare
+#define BRANCH_HOOK(addr, target, taken) \
+    ACCOUNT(gshare_predict_update(pstate, addr, taken), taken)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+
+// Any other predictor, through its function pointers
+#undef PREDICTOR_SETUP
+#define PREDICTOR_SETUP
+#define VARIANT(name) name##_generic
+#define BRANCH_HOOK(addr, target, taken) \
+    branch_account(predictor, stats, addr, target, taken)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+
+// Logging, with or without a predictor
+#undef LOGGING
+#define LOGGING 1
+#define VARIANT(name) name##_log
+#define BRANCH_HOOK(addr, target, taken) \
+    do { if (predictor) branch_account(predictor, stats, addr, target, taken); } while (0)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+#undef LOGGING
+#define LOGGING 0
+
+// Basic-block vectors, with or without a predictor
+#undef BLOCK_HOOK
+#undef HAVE_BLOCK_HOOK
+#define BLOCK_HOOK(pc, n) bbv_add(run->bbv, pc, n)
+#define HAVE_BLOCK_HOOK 1
+#define VARIANT(name) name##_bbv
+#define BRANCH_HOOK(addr, target, taken) \
+    do { if (predictor) branch_account(predictor, stats, addr, target, taken); } while (0)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+#undef BLOCK_HOOK
+#undef HAVE_BLOCK_HOOK
+#define BLOCK_HOOK(pc, n) ((void)0)
+#define HAVE_BLOCK_HOOK 0
+
+// Branch trace, with or without a predictor
+#define VARIANT(name) name##_trace
+#define BRANCH_HOOK(addr, target, taken)                                \
+    do {                                                                \
+        trace_write(run->trace, addr, target, taken);                   \
+        if (predictor) branch_account(predictor, stats, addr, target, taken); \
+    } while (0)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+
+// Branch target buffer and return address stack, with or without a
+// predictor: every taken transfer goes to the BTB
+#undef JUMP_HOOK
+#undef HAVE_JUMP_HOOK
+#define JUMP_HOOK(addr, target, kind) btb_transfer(run->btb, addr, target, kind)
+#define HAVE_JUMP_HOOK 1
+#define VARIANT(name) name##_btb
+#define BRANCH_HOOK(addr, target, taken)                                \
+    do {                                                                \
+        if (predictor) branch_account(predictor, stats, addr, target, taken); \
+        if (taken) btb_transfer(run->btb, addr, target, BTB_BRANCH);    \
+    } while (0)
+#include "simulate_engines.inc"
+#undef VARIANT
+#undef BRANCH_HOOK
+#undef JUMP_HOOK
+#undef HAVE_JUMP_HOOK
+#undef BLOCK_HOOK
+#undef HAVE_BLOCK_HOOK
+#undef HAVE_BRANCH_HOOK
+#undef LOGGING
+#undef PREDICTOR_SETUP
+
+#ifdef HAVE_COMPUTED_GOTO
+#define ENGINES(v) {                                                    \
+        [ENGINE_SWITCH]   = run_switch_##v,                             \
+        [ENGINE_THREADED] = run_threaded_##v,                           \
+        [ENGINE_BLOCK]    = run_block_##v,                              \
+        [ENGINE_JIT]      = run_block_##v,                              \
+    }
+#else
+#define ENGINES(v) {                                                    \
+        [ENGINE_SWITCH]   = run_switch_##v,                             \
+        [ENGINE_THREADED] = run_switch_##v,                             \
+        [ENGINE_BLOCK]    = run_switch_##v,                             \
+        [ENGINE_JIT]      = run_switch_##v,                             \
+    }
+#endif
+
+static const engine_fn engines[][ENGINE_JIT + 1] = {
+    [SIM_PLAIN]   = ENGINES(plain),
+    [SIM_NT]      = ENGINES(nt),
+    [SIM_BTFNT]   = ENGINES(btfnt),
+    [SIM_BIMODAL] = ENGINES(bimodal),
+    [SIM_GSHARE]  = ENGINES(gshare),
+    [SIM_GENERIC] = ENGINES(generic),
+    // the log is written by the switch engine only
+    [SIM_LOG]     = { run_switch_log, run_switch_log, run_switch_log, run_switch_log },
+    // only the block engine calls BLOCK_HOOK: run it with ENGINE_BLOCK
+    [SIM_BBV]     = ENGINES(bbv),
+    [SIM_TRACE]   = ENGINES(trace),
+    [SIM_BTB]     = ENGINES(btb),
+};
+#undef ENGINES
+
+enum sim_variant sim_pick_variant(struct Predictor* predictor, FILE* log_file, struct bbv* bbv,
+                                  struct trace_writer* trace, struct btb* btb) {
+    if (log_file) return SIM_LOG;
+    if (bbv) return SIM_BBV;
+    if (trace) return SIM_TRACE;
+    if (btb) return SIM_BTB;
+    if (!predictor) return SIM_PLAIN;
+    switch (predictor->kind) {
+        case PREDICTOR_NT:      return SIM_NT;
+        case PREDICTOR_BTFNT:   return SIM_BTFNT;
+        case PREDICTOR_BIMODAL: return SIM_BIMODAL;
+        case PREDICTOR_GSHARE:  return SIM_GSHARE;
+        default:                return SIM_GENERIC;
+    }
+}
 
-        switch (opcode) {
+// Run the given variant and engine from run->pc until the program exits,
+// reaches run->stop_pc or has executed run->limit instructions. The caches
+// stay with the run, so it can be continued by another call with the same
+// variant and engine; the threaded engine binds the predecoded records, and
+// the block cache its blocks, to the handlers of one particular variant.
+static long run_slice(struct run* run, enum sim_variant variant, enum sim_engine engine) {
+    if (!run->dc) {
+        run->dc = decode_cache_create(run->mem, run->fuse);
+        if (!run->dc) {
+            fprintf(stderr, "Could not allocate predecode cache\n");
+            exit(-1);
+        }
+        run->dc->stop_pc = run->stop_pc;
+    }
+    run->use_jit = engine == ENGINE_JIT;
+
+    long n = engines[variant][engine](run);
+    if (run->event == SIM_EVENT_BUDGET && run->pc != run->stop_pc && n < run->limit) {
+        // the block engine stopped short of the limit: single-step the rest.
+        // The switch engine only sees its own stores, so the two caches are
+        // kept coherent here: every word the switch engine decodes below is
+        // part of a translated block, so a store from block or native code
+        // to it has flushed bc since.
+        if (run->bc && run->bc->flushes != run->dc_flushes) {
+            decode_cache_flush(run->dc);
+            run->dc_flushes = run->bc->flushes;
+        }
+        long limit = run->limit;
+        run->limit = limit - n;
+        n += engines[variant][ENGINE_SWITCH](run);
+        run->limit = limit;
+        if (run->code_written) {
+            block_cache_flush(run->bc);
+            if (run->jit) jit_reset(run->jit);
+            run->dc_flushes = run->bc->flushes;
+            run->code_written = 0;
+        }
+    }
+    return n;
+}
 
-            // ----------------- LUI / AUIPC -----------------
-            case 0x37: { // LUI
-                int32_t imm = imm_u(inst);
-                if (rd != 0) regs[rd] = imm;
-                break;
-            }
-            case 0x17: { // AUIPC
-                int32_t imm = imm_u(inst);
-                if (rd != 0) regs[rd] = (int32_t)(addr + imm);
-                break;
-            }
+// Drop the caches of a run
+static void run_release(struct run* run) {
+    decode_cache_delete(run->dc);
+    block_cache_delete(run->bc);
+    jit_delete(run->jit);
+    run->dc = NULL;
+    run->bc = NULL;
+    run->jit = NULL;
+    run->dc_flushes = 0;
+    run->code_written = 0;
+}
 
-            // ----------------- Jumps ------------------------
-            case 0x6f: { // JAL
-                int32_t imm = imm_j(inst);
-                if (rd != 0) regs[rd] = (int32_t)(addr + 4);
-                pc = (uint32_t)((int32_t)addr + imm);
-                break;
-            }
-            case 0x67: { // JALR
-                int32_t imm = imm_i(inst);
-                int32_t target = (r1 + imm) & ~1; // clear lowest bit
-                if (rd != 0) regs[rd] = (int32_t)(addr + 4);
-                pc = (uint32_t) target;
-                break;
-            }
+// One phase of a simulation: a slice with caches of its own
+static long run_phase(struct run* run, enum sim_variant variant, enum sim_engine engine) {
+    long n = run_slice(run, variant, engine);
+    run_release(run);
+    return n;
+}
 
-            // ----------------- Branches ---------------------
-            case 0x63: { // Branches (B-type)
-                int32_t imm = imm_b(inst);
-                int actual_taken = 0;
-
-                // compute instruction address and target
-                uint32_t instr_pc = addr;           // address of branch instruction
-                uint32_t target_pc = (uint32_t)(addr + imm);
-
-                // --- PREDICTOR: predict before executing ---
-                int predicted_taken = 0;
-                if (predictor) {
-                    predicted_taken = predictor->predict(predictor, instr_pc, target_pc);
-                    stats->total_branches++;
-                }
-
-                switch (funct3) {
-                    case 0x0: actual_taken = (r1 == r2); break;        // BEQ
-                    case 0x1: actual_taken = (r1 != r2); break;        // BNE
-                    case 0x4: actual_taken = (r1 <  r2); break;        // BLT
-                    case 0x5: actual_taken = (r1 >= r2); break;        // BGE
-                    case 0x6: actual_taken = ((uint32_t)r1 <  (uint32_t)r2); break; // BLTU
-                    case 0x7: actual_taken = ((uint32_t)r1 >= (uint32_t)r2); break; // BGEU
-                    default:
-                        fprintf(stderr, "Unknown branch funct3: 0x%x at 0x%08x\n", funct3, addr);
-                        running = 0;
-                        break;
-                }
-
-                // --- PREDICTOR: update and count mispredicts ---
-                if (predictor) {
-                    if (predicted_taken != actual_taken)
-                        stats->mispredictions++;
-
-                    predictor->update(predictor, instr_pc, target_pc, actual_taken);
-                }  
-
-                // --- Execute branch normally ---
-                if (actual_taken)
-                    pc = (uint32_t)(addr + imm);
-
-                break;
-            }
+// Fast-forward phase: the fastest engine without any instrumentation
+static long fast_forward(struct run* run, long limit, uint32_t stop_pc) {
+    long ignored[NUM_FUSED_OPS] = {0};
+    run->limit = limit;
+    run->stop_pc = stop_pc;
+    run->fused = ignored;
+#ifdef HAVE_COMPUTED_GOTO
+    long n = run_phase(run, SIM_PLAIN, ENGINE_JIT);
+#else
+    long n = run_phase(run, SIM_PLAIN, ENGINE_SWITCH);
+#endif
+    run->limit = LONG_MAX;
+    run->stop_pc = DECODE_NO_PC;
+    run->fused = NULL;
+    return n;
+}
 
+// Sampled simulation: fast-forward to each sample, warm up the predictor,
+// then simulate the sample interval in detail
+static void simulate_samples(struct run* run, struct Stat* st, struct BPStats* stats,
+                             const struct SimOptions* opts) {
+    long done = 0;
+    for (int i = 0; i < opts->num_samples; i++) {
+        struct SimSample* s = &opts->samples[i];
+        long start = s->interval * opts->interval;
+        s->insns = 0;
+        s->stats = (struct BPStats){0};
+        if (run->event != SIM_EVENT_BUDGET || start < done) continue;  // ended, or overlaps the last one
+
+        long warm = start - opts->warmup;
+        if (warm > done) {
+            long n = fast_forward(run, warm - done, DECODE_NO_PC);
+            done += n;
+            st->ff_insns += n;
+        }
+        if (run->event == SIM_EVENT_BUDGET && start > done) {
+            struct BPStats ignored = {0};
+            long ignored_fused[NUM_FUSED_OPS] = {0};
+            run->limit = start - done;
+            run->stats = &ignored;
+            run->fused = ignored_fused;
+            long n = run_phase(run, opts->variant, opts->engine);
+            done += n;
+            st->ff_insns += n;
+        }
+        if (run->event == SIM_EVENT_BUDGET) {
+            run->limit = opts->interval;
+            run->stats = &s->stats;
+            run->fused = st->fused;
+            s->insns = run_phase(run, opts->variant, opts->engine);
+            done += s->insns;
+            stats->total_branches += s->stats.total_branches;
+            stats->mispredictions += s->stats.mispredictions;
+        }
+        run->limit = LONG_MAX;
+    }
+    st->insns = done;
+}
 
-            // ----------------- Loads ------------------------
-            case 0x03: { // LOAD (I-type)
-                int32_t imm = imm_i(inst);
-                int32_t eff = r1 + imm;
-                int32_t val = 0;
-                switch (funct3) {
-                    case 0x0: { // LB
-                        int32_t b = memory_rd_b(mem, eff);
-                        val = sext(b & 0xff, 8);
-                        break;
-                    }
-                    case 0x1: { // LH
-                        int32_t h = memory_rd_h(mem, eff);
-                        val = sext(h & 0xffff, 16);
-                        break;
-                    }
-                    case 0x2: { // LW
-                        val = memory_rd_w(mem, eff);
-                        break;
-                    }
-                    case 0x4: { // LBU
-                        int32_t b = memory_rd_b(mem, eff);
-                        val = b & 0xff;
-                        break;
-                    }
-                    case 0x5: { // LHU
-                        int32_t h = memory_rd_h(mem, eff);
-                        val = h & 0xffff;
-                        break;
-                    }
-                    default:
-                        fprintf(stderr, "Unknown LOAD funct3: 0x%x at 0x%08x\n", funct3, addr);
-                        running = 0;
-                        break;
-                }
-                if (!running) break;
-                if (rd != 0) regs[rd] = val;
-                break;
-            }
+// --- Main simulation -------------------------------------------------------
+//
+// Runs RV32I + RV32M programs and handles the required system calls.
+// Every text word is decoded once into a struct decoded (see decode.h);
+// the engines only dispatch on the resolved op (the block engine keeps its
+// own copies inside translated blocks). Stores invalidate the
+// predecoded record of the word they hit, so self-modifying code still works.
+//
+// With opts->fuse set the decoder also fuses common instruction pairs into
+// superinstructions (see DECODE_FUSED_OPS); st.fused counts how often each
+// one ran in the interpreter. Native JIT code emits the pairs unfused and
+// does not count them. The log variant never fuses, so that every
+// instruction gets its own line.
+//
+// With opts->ff_insns or opts->ff_stop_pc set the program first runs on the
+// fastest engine without any instrumentation, for ff_insns instructions or
+// until it gets to ff_stop_pc, and only then with the predictor and log
+// attached. st.ff_insns is the part of st.insns that was fast-forwarded.
+//
+// With opts->num_samples set only the sample intervals are simulated in
+// detail (see struct SimOptions); st.ff_insns then also counts the
+// predictor warm-up, and stats sums up the samples. The run stops after the
+// last sample.
+//
+// opts->resume continues a checkpointed run; with opts->ckpt_file set the
+// run instead ends in a checkpoint (after fast-forward, if any, and with
+// the predictor attached, so the checkpoint holds warm tables).
+//
+struct Stat simulate(struct memory *mem, int start_addr,
+                     FILE *log_file, struct symbols* symbols,
+                     struct Predictor* predictor, struct BPStats* stats,
+                     const struct SimOptions* opts) {
+
+    // regs[REG_SINK] absorbs writes to x0, so regs[0] stays zero
+    int32_t regs[NUM_REGS];
+    for (int i = 0; i < NUM_REGS; i++) regs[i] = 0;
+    if (opts->resume) {
+        for (int i = 1; i < 32; i++) regs[i] = opts->resume->regs[i];
+        start_addr = (int) opts->resume->pc;
+    }
 
-            // ----------------- Stores -----------------------
-            case 0x23: { // STORE (S-type)
-                int32_t imm = imm_s(inst);
-                int32_t eff = r1 + imm;
-                switch (funct3) {
-                    case 0x0: // SB
-                        memory_wr_b(mem, eff, r2);
-                        break;
-                    case 0x1: // SH
-                        memory_wr_h(mem, eff, r2);
-                        break;
-                    case 0x2: // SW
-                        memory_wr_w(mem, eff, r2);
-                        break;
-                    default:
-                        fprintf(stderr, "Unknown STORE funct3: 0x%x at 0x%08x\n", funct3, addr);
-                        running = 0;
-                        break;
-                }
-                break;
-            }
+    struct Stat st = {0};
+    struct run run = {
+        .pc = (uint32_t) start_addr,
+        .limit = LONG_MAX,
+        .stop_pc = DECODE_NO_PC,
+        .mem = mem,
+        .regs = regs,
+        .fuse = opts->fuse,
+        .console = opts->console,
+    };
+
+    if (opts->num_samples > 0) {
+        run.predictor = predictor;
+        run.fuse = opts->fuse && opts->variant != SIM_LOG;
+        run.log_file = log_file;
+        run.symbols = symbols;
+        simulate_samples(&run, &st, stats, opts);
+        return st;
+    }
 
-            // ----------------- ALU immediate ----------------
-            case 0x13: { // OP-IMM (I-type)
-                int32_t imm = imm_i(inst);
-                int32_t res = 0;
-                switch (funct3) {
-                    case 0x0: // ADDI
-                        res = r1 + imm;
-                        break;
-                    case 0x2: // SLTI
-                        res = (r1 < imm) ? 1 : 0;
-                        break;
-                    case 0x3: // SLTIU
-                        res = ((uint32_t)r1 < (uint32_t)imm) ? 1 : 0;
-                        break;
-                    case 0x4: // XORI
-                        res = r1 ^ imm;
-                        break;
-                    case 0x6: // ORI
-                        res = r1 | imm;
-                        break;
-                    case 0x7: // ANDI
-                        res = r1 & imm;
-                        break;
-                    case 0x1: { // SLLI
-                        uint32_t shamt = (inst >> 20) & 0x1f;
-                        res = (int32_t)((uint32_t)r1 << shamt);
-                        break;
-                    }
-                    case 0x5: {
-                        uint32_t shamt = (inst >> 20) & 0x1f;
-                        if (funct7 == 0x00) {
-                            // SRLI
-                            res = (int32_t)((uint32_t)r1 >> shamt);
-                        } else if (funct7 == 0x20) {
-                            // SRAI
-                            res = r1 >> shamt;
-                        } else {
-                            fprintf(stderr, "Unknown OP-IMM shift funct7: 0x%x at 0x%08x\n", funct7, addr);
-                            running = 0;
-                        }
-                        break;
-                    }
-                    default:
-                        fprintf(stderr, "Unknown OP-IMM funct3: 0x%x at 0x%08x\n", funct3, addr);
-                        running = 0;
-                        break;
-                }
-                if (!running) break;
-                if (rd != 0) regs[rd] = res;
-                break;
-            }
+    if (opts->ff_insns > 0 || opts->ff_stop_pc != DECODE_NO_PC) {
+        st.ff_insns = fast_forward(&run, opts->ff_insns > 0 ? opts->ff_insns : LONG_MAX,
+                                   opts->ff_stop_pc);
+    }
 
-                    // ----------------- ALU register -----------------
-        case 0x33: { // OP (R-type), includes RV32M
-            int32_t res = 0;
-
-            if (funct7 == 0x00 || funct7 == 0x20) {
-                // Basic integer ops (ADD/SUB, shifts, logic, compares)
-                switch (funct3) {
-                    case 0x0: // ADD / SUB
-                        if (funct7 == 0x00) {
-                            // ADD
-                            res = r1 + r2;
-                        } else {
-                            // SUB (funct7 == 0x20)
-                            res = r1 - r2;
-                        }
-                        break;
-
-                    case 0x1: // SLL
-                        res = (int32_t)((uint32_t) r1 << (r2 & 0x1f));
-                        break;
-
-                    case 0x2: // SLT
-                        res = (r1 < r2) ? 1 : 0;
-                        break;
-
-                    case 0x3: // SLTU
-                        res = ((uint32_t) r1 < (uint32_t) r2) ? 1 : 0;
-                        break;
-
-                    case 0x4: // XOR
-                        res = r1 ^ r2;
-                        break;
-
-                    case 0x5: // SRL / SRA
-                        if (funct7 == 0x00) {
-                            // SRL
-                            res = (int32_t)((uint32_t) r1 >> (r2 & 0x1f));
-                        } else {
-                            // SRA (funct7 == 0x20)
-                            res = r1 >> (r2 & 0x1f);
-                        }
-                        break;
-
-                    case 0x6: // OR
-                        res = r1 | r2;
-                        break;
-
-                    case 0x7: // AND
-                        res = r1 & r2;
-                        break;
-
-                    default:
-                        fprintf(stderr, "Unknown OP funct3: 0x%x at 0x%08x\n", funct3, addr);
-                        running = 0;
-                        break;
-                }
-            } else if (funct7 == 0x01) {
-                // RV32M (Mul/Div/Rem)
-                int32_t s1 = r1;
-                int32_t s2 = r2;
-                uint32_t u1 = (uint32_t) r1;
-                uint32_t u2 = (uint32_t) r2;
-
-                switch (funct3) {
-                    case 0x0: // MUL
-                        res = s1 * s2;
-                        break;
-                    case 0x4: // DIV
-                        if (s2 == 0) res = -1;
-                        else if (s1 == INT32_MIN && s2 == -1) res = INT32_MIN;
-                        else res = s1 / s2;
-                        break;
-                    case 0x5: // DIVU
-                        if (u2 == 0) res = -1;
-                        else res = (int32_t)(u1 / u2);
-                        break;
-                    case 0x6: // REM
-                        if (s2 == 0) res = s1;
-                        else if (s1 == INT32_MIN && s2 == -1) res = 0;
-                        else res = s1 % s2;
-                        break;
-                    case 0x7: // REMU
-                        if (u2 == 0) res = (int32_t) u1;
-                        else res = (int32_t)(u1 % u2);
-                        break;
-                    default:
-                        fprintf(stderr, "Unknown M-extension funct3: 0x%x at 0x%08x\n", funct3, addr);
-                        running = 0;
-                        break;
-                }
-            } else {
-                fprintf(stderr, "Unknown OP funct7: 0x%x at 0x%08x\n", funct7, addr);
-                running = 0;
-            }
+    st.insns = st.ff_insns;
+    if (run.event == SIM_EVENT_BUDGET) {
+        run.predictor = predictor;
+        run.stats = stats;
+        run.fused = st.fused;
+        run.fuse = opts->fuse && opts->variant != SIM_LOG;
+        run.log_file = log_file;
+        run.symbols = symbols;
+        run.bbv = opts->bbv;
+        run.trace = opts->trace;
+        run.btb = opts->btb;
+        if (opts->ckpt_file) {
+            long limit = opts->ckpt_insns - st.ff_insns;
+            run.limit = opts->ckpt_insns == 0 ? LONG_MAX : limit > 0 ? limit : 0;
+            run.stop_pc = opts->ckpt_stop_pc;
+        }
+        st.insns += run_phase(&run, opts->variant, opts->engine);
+    }
 
-            if (!running) break;
-            if (rd != 0) regs[rd] = res;
-            break;
+    if (opts->ckpt_file) {
+        if (run.event != SIM_EVENT_BUDGET) {
+            fprintf(stderr, "Program ended before the checkpoint\n");
+            exit(-1);
         }
+        struct checkpoint cp = { .pc = run.pc, .insns = st.insns };
+        if (opts->resume) cp.insns += opts->resume->insns;
+        for (int i = 0; i < 32; i++) cp.regs[i] = regs[i];
+        if (checkpoint_save(opts->ckpt_file, &cp, mem, predictor)) exit(-1);
+    }
+    return st;
+}
 
+// --- Resumable simulation --------------------------------------------------
 
-            // ----------------- SYSTEM / ECALL ---------------
-            case 0x73: { // SYSTEM
-                // We only care about ecall here (funct3=0, imm=0)
-                uint32_t funct12 = inst >> 20;
-                if (funct3 == 0 && funct12 == 0) {
-                    // ecall
-                    running = handle_ecall(regs);
-                } else {
-                    fprintf(stderr, "Unknown SYSTEM instruction at 0x%08x\n", addr);
-                    running = 0;
-                }
-                break;
-            }
+struct sim_cpu {
+    struct run run;
+    enum sim_variant variant;
+    enum sim_engine engine;
+    struct Stat st;
+    int32_t regs[NUM_REGS];
+};
+
+struct sim_cpu* sim_cpu_create(struct memory *mem, int start_addr,
+                               FILE *log_file, struct symbols* symbols,
+                               struct Predictor* predictor, struct BPStats* stats,
+                               const struct SimOptions* opts) {
+    // the tail of a slice may run on the switch engine, which collects no
+    // basic-block vectors
+    if (opts->bbv) return NULL;
+    struct sim_cpu* cpu = calloc(1, sizeof(struct sim_cpu));
+    if (!cpu) return NULL;
+    if (opts->resume) {
+        for (int i = 1; i < 32; i++) cpu->regs[i] = opts->resume->regs[i];
+        start_addr = (int) opts->resume->pc;
+    }
+    cpu->variant = opts->variant;
+    cpu->engine = opts->engine;
+    cpu->run = (struct run){
+        .pc = (uint32_t) start_addr,
+        .stop_pc = DECODE_NO_PC,
+        .mem = mem,
+        .regs = cpu->regs,
+        .predictor = predictor,
+        .stats = stats,
+        .fused = cpu->st.fused,
+        .fuse = opts->fuse && opts->variant != SIM_LOG,
+        .log_file = log_file,
+        .symbols = symbols,
+        .trace = opts->trace,
+        .btb = opts->btb,
+        .console = opts->console,
+    };
+    return cpu;
+}
 
-            // ----------------- Unknown opcode ---------------
-            default:
-                fprintf(stderr, "Unknown opcode 0x%x at 0x%08x\n", opcode, addr);
-                running = 0;
-                break;
-        }
+void sim_cpu_delete(struct sim_cpu* cpu) {
+    if (!cpu) return;
+    run_release(&cpu->run);
+    free(cpu);
+}
 
-        enforce_x0(regs);
+enum sim_event sim_step_n(struct sim_cpu* cpu, long budget) {
+    if (cpu->run.event == SIM_EVENT_BUDGET && budget > 0) {
+        cpu->run.limit = budget;
+        cpu->st.insns += run_slice(&cpu->run, cpu->variant, cpu->engine);
     }
+    return cpu->run.event;
+}
 
-    struct Stat st;
-    st.insns = insn_count;
-    return st;
+uint32_t sim_cpu_pc(const struct sim_cpu* cpu) {
+    return cpu->run.pc;
+}
+
+int32_t sim_cpu_reg(const struct sim_cpu* cpu, int r) {
+    return r == 0 ? 0 : cpu->regs[r];
+}
+
+const struct Stat* sim_cpu_stat(const struct sim_cpu* cpu) {
+    return &cpu->st;
 }
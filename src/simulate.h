@@ -4,10 +4,117 @@
 #include "memory.h"
 #include "read_elf.h"
 #include "predictor.h"
+#include "decode.h"
+#include "bbv.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "btb.h"
 #include <stdio.h>
 
 // Simuler RISC-V program i givet lager og fra given start adresse
-struct Stat { long int insns; };
+struct Stat {
+    long int insns;
+    long int fused[NUM_FUSED_OPS];  // executions per superinstruction, by op - OP_FUSED_FIRST
+    long int ff_insns;              // of insns, run in fast-forward
+};
+
+// Execution engines. The switch engine is the reference implementation;
+// the others must produce identical results and statistics.
+enum sim_engine {
+    ENGINE_SWITCH,      // one switch over the predecoded op per instruction
+    ENGINE_THREADED,    // direct-threaded dispatch (GCC labels-as-values)
+    ENGINE_BLOCK,       // chained basic blocks from a translation cache
+    ENGINE_JIT,         // block engine + x86-64 code for hot blocks
+};
+
+// Instrumentation variants. Each one is a separately compiled copy of the
+// engines, so a variant only pays for the instrumentation it has.
+enum sim_variant {
+    SIM_PLAIN,          // no predictor, no log
+    SIM_NT,             // built-in predictors, inlined
+    SIM_BTFNT,
+    SIM_BIMODAL,
+    SIM_GSHARE,
+    SIM_GENERIC,        // any predictor, through its function pointers
+    SIM_LOG,            // instruction log to log_file (switch engine only)
+    SIM_BBV,            // basic-block vectors (block engine, without JIT)
+    SIM_TRACE,          // branch trace, with or without a predictor
+    SIM_BTB,            // BTB and RAS, with or without a predictor
+};
+
+// Why a run stopped
+enum sim_event {
+    SIM_EVENT_BUDGET,   // instruction budget used up or stop pc reached: can continue
+    SIM_EVENT_EXIT,     // the program ended through an exit (or unknown) ecall
+    SIM_EVENT_ILLEGAL,  // illegal instruction (reported on stderr)
+};
+
+// One simulation point: interval 'interval' of SimOptions.interval
+// instructions, standing for 'weight' of the whole run
+struct SimSample {
+    long interval;
+    double weight;
+    // filled in by simulate
+    long insns;             // simulated in detail (less if the program ended)
+    struct BPStats stats;
+};
+
+// Console for the getchar (a7 = 1) and putchar (a7 = 2) ecalls
+struct sim_console {
+    int  (*getc)(void* user);           // next input byte, or -1 at end of input
+    void (*putc)(void* user, int ch);
+    void* user;
+};
+
+struct SimOptions {
+    enum sim_engine engine;
+    enum sim_variant variant;   // must match the predictor/log_file given to simulate
+    int fuse;           // fuse common instruction pairs (see decode.h)
+
+    // Fast-forward without instrumentation for ff_insns instructions (0 for
+    // no limit) or up to ff_stop_pc (DECODE_NO_PC for none), whichever
+    // comes first; no fast-forward if neither is set
+    long ff_insns;
+    uint32_t ff_stop_pc;
+
+    // Basic-block vectors, one per interval instructions (SIM_BBV only)
+    struct bbv* bbv;
+    long interval;
+
+    // Sampled simulation: with num_samples > 0 only the given intervals,
+    // sorted by interval, are simulated in detail. Before each one, up to
+    // 'warmup' instructions run with the predictor attached but not
+    // counted; everything else is fast-forwarded.
+    struct SimSample* samples;
+    int num_samples;
+    long warmup;
+
+    // Start from this state instead of start_addr with zeroed registers
+    // (memory and predictor are restored by the caller, see checkpoint.h)
+    const struct checkpoint* resume;
+
+    // With ckpt_file set, stop after ckpt_insns instructions (0 for no
+    // limit) or at ckpt_stop_pc (DECODE_NO_PC for none), whichever comes
+    // first, and write a checkpoint there
+    const char* ckpt_file;
+    long ckpt_insns;
+    uint32_t ckpt_stop_pc;
+
+    // Console I/O; NULL for the process's stdin and stdout
+    const struct sim_console* console;
+
+    // Branch trace of the detailed part of the run (SIM_TRACE only)
+    struct trace_writer* trace;
+
+    // Target prediction for the detailed part of the run (SIM_BTB only,
+    // and not with sampling: warm-up would count in its statistics)
+    struct btb* btb;
+};
+
+// The variant to use for this predictor, log file, BBV writer, branch
+// trace writer and BTB (each may be NULL)
+enum sim_variant sim_pick_variant(struct Predictor* predictor, FILE* log_file, struct bbv* bbv,
+                                  struct trace_writer* trace, struct btb* btb);
 
 // NOTE: Use of symbols provide for nicer disassembly, but is not required for A4.
 // Feel free to remove this parameter or pass in a NULL pointer and ignore it.
@@ -15,7 +122,36 @@ struct Stat { long int insns; };
 struct Stat simulate(struct memory *mem, int start_addr,
                      FILE *log_file, struct symbols* symbols,
                      struct Predictor* predictor,
-                     struct BPStats* bpstats);
+                     struct BPStats* bpstats,
+                     const struct SimOptions* opts);
+
+
+// --- Resumable simulation --------------------------------------------------
+//
+// A sim_cpu holds the state simulate() keeps on its stack (pc, registers,
+// statistics and the engine's caches), so a run can be advanced a budget of
+// instructions at a time. 'opts' picks the engine, variant and fusion,
+// opts->resume the starting state, and the branch trace and BTB of those
+// variants; its fast-forward, checkpoint and sampling settings are not used
+// here, and a BBV writer makes it return NULL. A slice continues with the
+// blocks and native code translated so far, so a run split into slices
+// gives the same results as one in one go.
+
+struct sim_cpu;
+
+struct sim_cpu* sim_cpu_create(struct memory *mem, int start_addr,
+                               FILE *log_file, struct symbols* symbols,
+                               struct Predictor* predictor,
+                               struct BPStats* bpstats,
+                               const struct SimOptions* opts);
+void sim_cpu_delete(struct sim_cpu* cpu);
+
+// Run at most 'budget' instructions. Returns SIM_EVENT_BUDGET if the program
+// can go on, or the event that ended it (again on every later call).
+enum sim_event sim_step_n(struct sim_cpu* cpu, long budget);
 
+uint32_t sim_cpu_pc(const struct sim_cpu* cpu);
+int32_t sim_cpu_reg(const struct sim_cpu* cpu, int r);     // x0..x31
+const struct Stat* sim_cpu_stat(const struct sim_cpu* cpu);
 
 #endif
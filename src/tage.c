@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "predictor.h"
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+/* ------------------ TAGE ------------------
+   A bimodal base table plus TAGE_TABLES partially tagged tables indexed
+   with the pc hashed with geometrically longer slices of global history
+   (Seznec and Michaud, "A case for (partially) TAgged GEometric history
+   length branch prediction", 2006).
+
+   The longest table whose tag matches provides the prediction; the next
+   one (or the base table) is the alternate, used instead while the
+   provider is a fresh, still weak entry if that has been paying off. A
+   misprediction allocates an entry in a longer table whose useful bits
+   are clear. Useful bits are aged every TAGE_RESET_PERIOD branches.
+
+   Storage: a tagged entry is 16 bits (3-bit counter, 2-bit useful,
+   11-bit tag) and a base entry 2 bits; the tables are sized to the
+   largest powers of two that fit the budget. Each tagged table is one
+   array of uint16_t, so a lookup touches one 2-byte entry per table, and
+   all index and tag hashes come from folded histories updated in O(1)
+   per branch. The per-table work (hashes, tag compares, history folds)
+   is laid out as one lane per table, and runs in AVX2 registers where
+   the host has them; the scalar loops give the same results.
+------------------------------------------------------*/
+
+#define TAGE_TABLES 7
+#define TAGE_LANES 8                /* TAGE_TABLES rounded up; lane 7 is idle */
+#define TAGE_TAG_BITS 11
+#define TAGE_HIST_BUF 256           /* power of two, > longest history */
+#define TAGE_RESET_PERIOD (1u << 18)
+
+static const int tage_hist_len[TAGE_TABLES] = { 4, 8, 15, 28, 52, 96, 180 };
+
+/* entry layout */
+#define CTR(e)    ((e) & 7u)                /* 0..7, >= 4 predicts taken */
+#define USEFUL(e) (((e) >> 3) & 3u)
+#define TAG(e)    ((uint32_t)(e) >> 5)
+#define ENTRY(ctr, u, tag) ((uint16_t)((ctr) | (u) << 3 | (tag) << 5))
+
+/* The folded histories: table i's slice of history, tage_hist_len[i]
+   bits, xored down to the index width and to two tag widths (the second
+   one bit shorter, so the two folds differ) */
+enum { FOLD_IDX, FOLD_TAG0, FOLD_TAG1, NUM_FOLDS };
+
+struct tage_state {
+    int kb;
+    int log_tagged;                 /* entries per tagged table, log2 */
+    int log_base;
+    uint8_t* base;                  /* 2-bit counters */
+    uint16_t* tagged;               /* table i at i << log_tagged */
+
+    uint8_t ghist[TAGE_HIST_BUF + 4];   /* newest outcome at ghist[head]; padded for gathers */
+    int head;
+    uint32_t path;                  /* one pc bit per branch, 16 branches */
+    int avx2;
+
+    /* per lane; the idle lane reads entry 0 of table 0 and never hits */
+    uint32_t fold[NUM_FOLDS][TAGE_LANES];
+    uint32_t fold_width[NUM_FOLDS];
+    uint32_t fold_out[NUM_FOLDS][TAGE_LANES];      /* len % width */
+    uint32_t hist_len[TAGE_LANES];
+    uint32_t pc_shift[TAGE_LANES];                 /* index hash constants */
+    uint32_t path_mask[TAGE_LANES];
+    uint32_t idx_mask[TAGE_LANES];
+    uint32_t table_base[TAGE_LANES];               /* i << log_tagged */
+    int use_alt;                    /* 0..15, >= 8 trusts the alternate for new entries */
+    uint32_t tick;
+    uint32_t rng;
+
+    /* lookup of the branch last predicted */
+    uint32_t pc;
+    int looked_up;
+    uint32_t idx[TAGE_LANES];
+    uint32_t tag[TAGE_LANES];
+    uint32_t base_idx;
+    int provider, alt;              /* table, or -1 for the base table */
+    int provider_pred, alt_pred, pred;
+    int fresh;                      /* provider is weak and not useful */
+};
+
+static int log2_floor(long x) {
+    int r = 0;
+    while (x > 1) { x >>= 1; r++; }
+    return r;
+}
+
+/* shift in the newest outcome and drop the one that falls out of the slice */
+static inline uint32_t fold_update(uint32_t comp, uint32_t width, uint32_t out_point,
+                                   uint32_t in, uint32_t out) {
+    comp = (comp << 1) | in;
+    comp ^= out << out_point;
+    comp ^= comp >> width;
+    return comp & ((1u << width) - 1);
+}
+
+static inline uint32_t base_pred(const struct tage_state* s, uint32_t idx) {
+    return s->base[idx] >= 2;
+}
+
+/* Indices and tags of every table for the branch; returns one bit per
+   table whose entry's tag matches, without a host branch per table */
+static uint32_t hash_tables(struct tage_state* s, uint32_t pcw) {
+    uint32_t hits = 0;
+    for (int i = 0; i < TAGE_TABLES; ++i) {
+        uint32_t p = s->path & s->path_mask[i];
+        p ^= p >> s->log_tagged;
+        s->idx[i] = (pcw ^ (pcw >> s->pc_shift[i]) ^ s->fold[FOLD_IDX][i] ^ p) & s->idx_mask[i];
+        s->tag[i] = (pcw ^ s->fold[FOLD_TAG0][i] ^ (s->fold[FOLD_TAG1][i] << 1))
+                    & ((1u << TAGE_TAG_BITS) - 1);
+        hits |= (uint32_t)(TAG(s->tagged[s->table_base[i] + s->idx[i]]) == s->tag[i]) << i;
+    }
+    return hits;
+}
+
+/* shift the newest outcome into every fold */
+static void fold_all(struct tage_state* s, uint32_t taken) {
+    uint32_t out[TAGE_TABLES];
+    for (int i = 0; i < TAGE_TABLES; ++i)
+        out[i] = s->ghist[(s->head + s->hist_len[i]) & (TAGE_HIST_BUF - 1)];
+    for (int f = 0; f < NUM_FOLDS; ++f) {
+        uint32_t width = s->fold_width[f];
+        for (int i = 0; i < TAGE_TABLES; ++i)
+            s->fold[f][i] = fold_update(s->fold[f][i], width, s->fold_out[f][i], taken, out[i]);
+    }
+}
+
+#ifdef __x86_64__
+#define LOAD(a) _mm256_loadu_si256((const __m256i*)(a))
+#define STORE(a, v) _mm256_storeu_si256((__m256i*)(a), v)
+
+__attribute__((target("avx2")))
+static uint32_t hash_tables_avx2(struct tage_state* s, uint32_t pcw) {
+    __m256i pc = _mm256_set1_epi32((int)pcw);
+    __m256i p = _mm256_and_si256(_mm256_set1_epi32((int)s->path), LOAD(s->path_mask));
+    p = _mm256_xor_si256(p, _mm256_srli_epi32(p, s->log_tagged));
+    __m256i idx = _mm256_xor_si256(pc, _mm256_srlv_epi32(pc, LOAD(s->pc_shift)));
+    idx = _mm256_xor_si256(idx, _mm256_xor_si256(LOAD(s->fold[FOLD_IDX]), p));
+    idx = _mm256_and_si256(idx, LOAD(s->idx_mask));
+    __m256i tag = _mm256_xor_si256(_mm256_xor_si256(pc, LOAD(s->fold[FOLD_TAG0])),
+                                   _mm256_slli_epi32(LOAD(s->fold[FOLD_TAG1]), 1));
+    tag = _mm256_and_si256(tag, _mm256_set1_epi32((1 << TAGE_TAG_BITS) - 1));
+    STORE(s->idx, idx);
+    STORE(s->tag, tag);
+    /* 4-byte gathers of 2-byte entries; the tables are padded at the end */
+    __m256i e = _mm256_i32gather_epi32((const int*)s->tagged, _mm256_add_epi32(LOAD(s->table_base), idx), 2);
+    __m256i etag = _mm256_srli_epi32(_mm256_and_si256(e, _mm256_set1_epi32(0xffff)), 5);
+    uint32_t hits = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(etag, tag)));
+    return hits & ((1u << TAGE_TABLES) - 1);
+}
+
+__attribute__((target("avx2")))
+static void fold_all_avx2(struct tage_state* s, uint32_t taken) {
+    __m256i pos = _mm256_and_si256(_mm256_add_epi32(_mm256_set1_epi32(s->head), LOAD(s->hist_len)),
+                                   _mm256_set1_epi32(TAGE_HIST_BUF - 1));
+    __m256i out = _mm256_and_si256(_mm256_i32gather_epi32((const int*)s->ghist, pos, 1), _mm256_set1_epi32(1));
+    __m256i in = _mm256_set1_epi32((int)taken);
+    for (int f = 0; f < NUM_FOLDS; ++f) {
+        int width = (int)s->fold_width[f];
+        __m256i c = _mm256_or_si256(_mm256_slli_epi32(LOAD(s->fold[f]), 1), in);
+        c = _mm256_xor_si256(c, _mm256_sllv_epi32(out, LOAD(s->fold_out[f])));
+        c = _mm256_xor_si256(c, _mm256_srli_epi32(c, width));
+        STORE(s->fold[f], _mm256_and_si256(c, _mm256_set1_epi32((1 << width) - 1)));
+    }
+}
+#endif
+
+static void tage_lookup(struct tage_state* s, uint32_t instr_pc) {
+    uint32_t pcw = instr_pc >> 2;
+    uint32_t hits;
+#ifdef __x86_64__
+    if (s->avx2) hits = hash_tables_avx2(s, pcw);
+    else
+#endif
+    hits = hash_tables(s, pcw);
+    s->base_idx = pcw & ((1u << s->log_base) - 1);
+
+    s->provider = hits ? 31 - __builtin_clz(hits) : -1;
+    hits &= ~(1u << (s->provider & 31));
+    s->alt = hits ? 31 - __builtin_clz(hits) : -1;
+    s->alt_pred = s->alt >= 0 ? CTR(s->tagged[((uint32_t)s->alt << s->log_tagged) + s->idx[s->alt]]) >= 4
+                              : (int)base_pred(s, s->base_idx);
+    if (s->provider < 0) {
+        s->provider_pred = s->pred = s->alt_pred;
+        s->fresh = 0;
+    } else {
+        uint16_t e = s->tagged[((uint32_t)s->provider << s->log_tagged) + s->idx[s->provider]];
+        s->provider_pred = CTR(e) >= 4;
+        s->fresh = (CTR(e) == 3 || CTR(e) == 4) && USEFUL(e) == 0;
+        s->pred = (s->fresh && s->use_alt >= 8) ? s->alt_pred : s->provider_pred;
+    }
+    s->pc = instr_pc;
+    s->looked_up = 1;
+}
+
+static int tage_predict(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc) {
+    struct tage_state* s = (struct tage_state*) self->state;
+    (void)target_pc;
+    tage_lookup(s, instr_pc);
+    return s->pred ? TAKEN : NOT_TAKEN;
+}
+
+static inline uint16_t* entry(struct tage_state* s, int i) {
+    return &s->tagged[((uint32_t)i << s->log_tagged) + s->idx[i]];
+}
+
+static inline uint16_t ctr_update(uint16_t e, int taken) {
+    uint32_t c = CTR(e);
+    if (taken) { if (c < 7) c++; }
+    else       { if (c > 0) c--; }
+    return (uint16_t)((e & ~7u) | c);
+}
+
+static void tage_update(struct Predictor* self, uint32_t instr_pc, uint32_t target_pc, int taken) {
+    struct tage_state* s = (struct tage_state*) self->state;
+    (void)target_pc;
+    if (!s->looked_up || s->pc != instr_pc) tage_lookup(s, instr_pc);
+    s->looked_up = 0;
+    taken = taken ? 1 : 0;
+
+    /* allocate in a longer table on a misprediction */
+    if (s->pred != taken && s->provider < TAGE_TABLES - 1) {
+        int first = -1, second = -1;
+        for (int i = s->provider + 1; i < TAGE_TABLES; ++i) {
+            if (USEFUL(*entry(s, i)) != 0) continue;
+            if (first < 0) first = i;
+            else { second = i; break; }
+        }
+        if (first >= 0) {
+            /* sometimes skip to the second candidate, so that entries do
+               not all pile up in the shortest free table */
+            s->rng = s->rng * 1103515245u + 12345u;
+            int i = (second >= 0 && (s->rng >> 16) % 3 == 0) ? second : first;
+            *entry(s, i) = ENTRY(taken ? 4u : 3u, 0u, s->tag[i]);
+        } else {
+            for (int i = s->provider + 1; i < TAGE_TABLES; ++i) {
+                uint16_t* e = entry(s, i);
+                *e = (uint16_t)(*e - (1u << 3));   /* useful > 0 here */
+            }
+        }
+    }
+
+    if (s->provider >= 0) {
+        uint16_t* e = entry(s, s->provider);
+        if (s->fresh && s->provider_pred != s->alt_pred) {
+            if (s->alt_pred == taken) { if (s->use_alt < 15) s->use_alt++; }
+            else                      { if (s->use_alt > 0) s->use_alt--; }
+        }
+        /* a fresh entry has not earned trust yet: train the alternate too */
+        if (s->fresh) {
+            if (s->alt >= 0) *entry(s, s->alt) = ctr_update(*entry(s, s->alt), taken);
+            else s->base[s->base_idx] = counter_next(s->base[s->base_idx], taken);
+        }
+        if (s->provider_pred != s->alt_pred) {
+            uint32_t u = USEFUL(*e);
+            if (s->provider_pred == taken) { if (u < 3) u++; }
+            else                           { if (u > 0) u--; }
+            *e = (uint16_t)((*e & ~(3u << 3)) | u << 3);
+        }
+        *e = ctr_update(*e, taken);
+    } else {
+        s->base[s->base_idx] = counter_next(s->base[s->base_idx], taken);
+    }
+
+    /* age the useful bits: clear the high bit, then the low bit */
+    if (++s->tick % TAGE_RESET_PERIOD == 0) {
+        uint16_t keep = (uint16_t)~((s->tick / TAGE_RESET_PERIOD) & 1 ? 2u << 3 : 1u << 3);
+        size_t n = (size_t)TAGE_TABLES << s->log_tagged;
+        for (size_t k = 0; k < n; ++k) s->tagged[k] &= keep;
+    }
+
+    /* histories */
+    s->head = (s->head - 1) & (TAGE_HIST_BUF - 1);
+    s->ghist[s->head] = (uint8_t)taken;
+    s->path = ((s->path << 1) | ((instr_pc >> 2) & 1u)) & 0xffffu;
+#ifdef __x86_64__
+    if (s->avx2) fold_all_avx2(s, (uint32_t)taken);
+    else
+#endif
+    fold_all(s, (uint32_t)taken);
+}
+
+static void tage_destroy(struct Predictor* self) {
+    if (!self) return;
+    struct tage_state* s = (struct tage_state*) self->state;
+    if (s) {
+        free(s->base);
+        free(s->tagged);
+        free(s);
+    }
+    free(self);
+}
+
+/* the whole state but the pointers: tables, histories and counters */
+static int tage_save(struct Predictor* self, FILE* f) {
+    struct tage_state* s = (struct tage_state*) self->state;
+    size_t tagged = (size_t)TAGE_TABLES << s->log_tagged;
+    size_t base = (size_t)1 << s->log_base;
+    if (fwrite(&s->kb, sizeof(s->kb), 1, f) != 1) return -1;
+    if (fwrite(s, sizeof(struct tage_state), 1, f) != 1) return -1;
+    if (fwrite(s->base, 1, base, f) != base) return -1;
+    return fwrite(s->tagged, sizeof(uint16_t), tagged, f) == tagged ? 0 : -1;
+}
+static int tage_load(struct Predictor* self, FILE* f) {
+    struct tage_state* s = (struct tage_state*) self->state;
+    int kb;
+    if (fread(&kb, sizeof(kb), 1, f) != 1 || kb != s->kb) return -1;
+    uint8_t* base_table = s->base;
+    uint16_t* tagged_table = s->tagged;
+    int avx2 = s->avx2;             /* a property of this host, not of the checkpoint */
+    if (fread(s, sizeof(struct tage_state), 1, f) != 1) return -1;
+    s->base = base_table;
+    s->tagged = tagged_table;
+    s->avx2 = avx2;
+    size_t tagged = (size_t)TAGE_TABLES << s->log_tagged;
+    size_t base = (size_t)1 << s->log_base;
+    if (fread(s->base, 1, base, f) != base) return -1;
+    return fread(s->tagged, sizeof(uint16_t), tagged, f) == tagged ? 0 : -1;
+}
+
+/* kb: storage budget in KB (1 .. 65536) */
+struct Predictor* predictor_tage(int kb) {
+    if (kb < 1 || kb > 65536) return NULL;
+    /* 2^T tagged entries of 2 bytes per table and 2^(T+1) 2-bit base
+       entries: 2^(T-1) * (4 * TAGE_TABLES + 1) bytes */
+    int log_tagged = log2_floor((long)kb * 1024 / (4 * TAGE_TABLES + 1)) + 1;
+    struct Predictor* p = malloc(sizeof(struct Predictor));
+    struct tage_state* s = calloc(1, sizeof(struct tage_state));
+    if (!p || !s) { free(p); free(s); return NULL; }
+    s->kb = kb;
+    s->log_tagged = log_tagged;
+    s->log_base = log_tagged + 1;
+    s->base = malloc((size_t)1 << s->log_base);
+    /* one spare entry for the AVX2 gathers */
+    s->tagged = calloc(((size_t)TAGE_TABLES << log_tagged) + 1, sizeof(uint16_t));
+    if (!s->base || !s->tagged) {
+        free(s->base); free(s->tagged); free(s); free(p);
+        return NULL;
+    }
+    memset(s->base, 2, (size_t)1 << s->log_base);   /* weakly taken */
+    s->fold_width[FOLD_IDX] = log_tagged;
+    s->fold_width[FOLD_TAG0] = TAGE_TAG_BITS;
+    s->fold_width[FOLD_TAG1] = TAGE_TAG_BITS - 1;
+    for (int i = 0; i < TAGE_TABLES; ++i) {
+        for (int f = 0; f < NUM_FOLDS; ++f) s->fold_out[f][i] = tage_hist_len[i] % s->fold_width[f];
+        s->hist_len[i] = tage_hist_len[i];
+        s->pc_shift[i] = abs(log_tagged - i) + 1;
+        s->path_mask[i] = (1u << (tage_hist_len[i] < 16 ? tage_hist_len[i] : 16)) - 1;
+        s->idx_mask[i] = (1u << log_tagged) - 1;
+        s->table_base[i] = (uint32_t)i << log_tagged;
+    }
+#ifdef __x86_64__
+    s->avx2 = __builtin_cpu_supports("avx2");
+#endif
+    s->use_alt = 8;
+    s->rng = 1;
+    p->predict = tage_predict;
+    p->update  = tage_update;
+    p->destroy = tage_destroy;
+    p->save    = tage_save;
+    p->load    = tage_load;
+    p->report  = NULL;
+    p->kind    = PREDICTOR_TAGE;
+    p->state   = s;
+    return p;
+}
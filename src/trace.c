@@ -0,0 +1,381 @@
+#include "trace.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// worst case per record: token, pc delta and target delta, 5 bytes each
+#define MAX_BLOCK_BYTES (TRACE_BLOCK_RECORDS * 15)
+
+#define HASH_BITS 17
+
+// The dictionary of one block; both sides keep the same one
+struct dictionary {
+    uint32_t size;
+    uint32_t pc[TRACE_BLOCK_RECORDS];
+    uint32_t target[TRACE_BLOCK_RECORDS];
+    int32_t next[TRACE_BLOCK_RECORDS];      // branch that followed last, or -1
+    uint8_t taken[TRACE_BLOCK_RECORDS];     // last outcome
+};
+
+struct trace_encoder {
+    struct dictionary dict;
+    // pc -> dictionary index; entries of older blocks have an older gen
+    struct {
+        uint32_t pc;
+        uint32_t idx;
+        uint32_t gen;
+    } hash[1 << HASH_BITS];
+    uint32_t gen;
+    uint8_t out[MAX_BLOCK_BYTES];
+    struct trace_block_entry* index;
+    uint64_t num_blocks;
+    uint64_t capacity;
+    uint64_t offset;            // of the next block in the file
+};
+
+struct trace_decoder {
+    struct dictionary dict;
+    struct trace_record buf[TRACE_BLOCK_RECORDS];
+};
+
+static void write_error(void) {
+    fprintf(stderr, "Could not write branch trace\n");
+    exit(-1);
+}
+
+static void write_header(struct trace_writer* w, uint64_t insns) {
+    struct trace_header h;
+    memcpy(h.magic, w->enc ? TRACE_ZMAGIC : TRACE_MAGIC, 4);
+    h.version = TRACE_VERSION;
+    h.count = w->count;
+    h.insns = insns;
+    if (fwrite(&h, sizeof(h), 1, w->f) != 1) write_error();
+    if (w->enc) {
+        struct trace_zheader z = { w->enc->offset, w->enc->num_blocks };
+        if (fwrite(&z, sizeof(z), 1, w->f) != 1) write_error();
+    }
+}
+
+struct trace_writer* trace_writer_create(const char* name, int compressed) {
+    struct trace_writer* w = malloc(sizeof(struct trace_writer));
+    struct trace_encoder* enc = compressed ? calloc(1, sizeof(struct trace_encoder)) : NULL;
+    if (!w || (compressed && !enc)) {
+        fprintf(stderr, "Out of memory for branch trace buffer\n");
+        free(w);
+        free(enc);
+        return NULL;
+    }
+    w->f = fopen(name, "wb");
+    if (!w->f) {
+        fprintf(stderr, "Could not create branch trace %s\n", name);
+        free(enc);
+        free(w);
+        return NULL;
+    }
+    w->enc = enc;
+    w->count = 0;
+    w->used = 0;
+    if (enc) enc->offset = sizeof(struct trace_header) + sizeof(struct trace_zheader);
+    // the counts are filled in by trace_writer_close
+    write_header(w, 0);
+    return w;
+}
+
+// --- Encoding --------------------------------------------------------------
+
+static inline uint8_t* put_varint(uint8_t* p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint32_t hash_pc(uint32_t pc) {
+    return ((pc >> 1) * 0x9e3779b1u) >> (32 - HASH_BITS);
+}
+
+// Dictionary index of pc in the current block, or -1 (leaving *slot at
+// the place to insert it)
+static int32_t lookup(struct trace_encoder* e, uint32_t pc, uint32_t* slot) {
+    uint32_t h = hash_pc(pc);
+    while (e->hash[h].gen == e->gen) {
+        if (e->hash[h].pc == pc) return (int32_t)e->hash[h].idx;
+        h = (h + 1) & ((1u << HASH_BITS) - 1);
+    }
+    *slot = h;
+    return -1;
+}
+
+static void encode_block(struct trace_writer* w, const struct trace_record* r, uint32_t n) {
+    struct trace_encoder* e = w->enc;
+    struct dictionary* d = &e->dict;
+    e->gen++;
+    d->size = 0;
+    uint8_t* p = e->out;
+    int32_t prev = -1;
+    uint32_t run = 0;
+    uint32_t last_new = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t pc = r[i].pc_taken & ~1u;
+        uint32_t taken = r[i].pc_taken & 1u;
+        uint32_t slot = 0;
+        int32_t idx = lookup(e, pc, &slot);
+        if (idx >= 0 && prev >= 0 && d->next[prev] == idx && d->taken[idx] == taken) {
+            run++;
+            prev = idx;
+            continue;
+        }
+        if (run) {
+            p = put_varint(p, (uint64_t)run << 1 | 1);
+            run = 0;
+        }
+        if (idx < 0) {
+            idx = (int32_t)d->size++;
+            e->hash[slot].pc = pc;
+            e->hash[slot].idx = (uint32_t)idx;
+            e->hash[slot].gen = e->gen;
+            d->pc[idx] = pc;
+            d->target[idx] = r[i].target;
+            d->next[idx] = -1;
+            p = put_varint(p, taken << 1);
+            p = put_varint(p, zigzag((int32_t)(pc - last_new) >> 1));
+            p = put_varint(p, zigzag((int32_t)(r[i].target - pc)));
+            last_new = pc;
+        } else {
+            p = put_varint(p, ((uint64_t)idx + 1) << 2 | taken << 1);
+        }
+        if (prev >= 0) d->next[prev] = idx;
+        d->taken[idx] = (uint8_t)taken;
+        prev = idx;
+    }
+    if (run) p = put_varint(p, (uint64_t)run << 1 | 1);
+
+    uint32_t bytes = (uint32_t)(p - e->out);
+    if (fwrite(e->out, 1, bytes, w->f) != bytes) write_error();
+    if (e->num_blocks == e->capacity) {
+        e->capacity = e->capacity ? 2 * e->capacity : 256;
+        e->index = realloc(e->index, e->capacity * sizeof(struct trace_block_entry));
+        if (!e->index) {
+            fprintf(stderr, "Out of memory for branch trace index\n");
+            exit(-1);
+        }
+    }
+    e->index[e->num_blocks++] = (struct trace_block_entry){ e->offset, w->count, n, bytes };
+    e->offset += bytes;
+    w->count += n;
+}
+
+void trace_writer_flush(struct trace_writer* w) {
+    if (w->enc) {
+        // whole blocks, except at the very end
+        for (uint32_t start = 0; start < w->used; start += TRACE_BLOCK_RECORDS) {
+            uint32_t n = w->used - start;
+            encode_block(w, w->buf + start, n < TRACE_BLOCK_RECORDS ? n : TRACE_BLOCK_RECORDS);
+        }
+        w->used = 0;
+        return;
+    }
+    if (w->used && fwrite(w->buf, sizeof(struct trace_record), w->used, w->f) != w->used) write_error();
+    w->count += w->used;
+    w->used = 0;
+}
+
+int trace_writer_close(struct trace_writer* w, uint64_t insns) {
+    trace_writer_flush(w);
+    struct trace_encoder* e = w->enc;
+    if (e && fwrite(e->index, sizeof(struct trace_block_entry), e->num_blocks, w->f) != e->num_blocks)
+        write_error();
+    int ok = fseek(w->f, 0, SEEK_SET) == 0;
+    if (ok) write_header(w, insns);
+    if (fclose(w->f) != 0) ok = 0;
+    if (e) free(e->index);
+    free(e);
+    free(w);
+    return ok ? 0 : -1;
+}
+
+// --- Reading ---------------------------------------------------------------
+
+// Checks the index of a compressed trace against the file
+static const char* check_index(struct trace_file* t) {
+    if (t->size < sizeof(struct trace_header) + sizeof(struct trace_zheader)) return "is truncated";
+    const struct trace_zheader* z = (const struct trace_zheader*)(t->base + sizeof(struct trace_header));
+    uint64_t start = sizeof(struct trace_header) + sizeof(struct trace_zheader);
+    if (z->index_offset < start || z->index_offset > t->size ||
+        z->num_blocks > (t->size - z->index_offset) / sizeof(struct trace_block_entry) ||
+        z->index_offset + z->num_blocks * sizeof(struct trace_block_entry) != t->size)
+        return "has a bad block index";
+    t->index = (const struct trace_block_entry*)(t->base + z->index_offset);
+    t->num_blocks = z->num_blocks;
+    uint64_t first = 0;
+    for (uint64_t k = 0; k < t->num_blocks; k++) {
+        const struct trace_block_entry* b = &t->index[k];
+        if (b->first != first || b->count == 0 || b->count > TRACE_BLOCK_RECORDS ||
+            b->offset < start || b->offset > z->index_offset || b->bytes > z->index_offset - b->offset)
+            return "has a bad block index";
+        first += b->count;
+    }
+    return first == t->header->count ? NULL : "has a bad block index";
+}
+
+int trace_open(const char* name, struct trace_file* t) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open branch trace %s\n", name);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(struct trace_header)) {
+        fprintf(stderr, "%s is not a branch trace\n", name);
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Could not map branch trace %s\n", name);
+        return -1;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+    memset(t, 0, sizeof(struct trace_file));
+    t->base = base;
+    t->header = base;
+    t->size = st.st_size;
+
+    const char* error = NULL;
+    int compressed = !memcmp(t->header->magic, TRACE_ZMAGIC, 4);
+    if (!compressed && memcmp(t->header->magic, TRACE_MAGIC, 4)) {
+        error = "is not a branch trace";
+    } else if (t->header->version != TRACE_VERSION) {
+        error = "has an unsupported trace version";
+    } else if (compressed) {
+        error = check_index(t);
+    } else if (t->size != sizeof(struct trace_header) + t->header->count * sizeof(struct trace_record)) {
+        error = "is truncated";
+    } else {
+        t->records = (const struct trace_record*)(t->base + sizeof(struct trace_header));
+        t->num_blocks = (t->header->count + TRACE_BLOCK_RECORDS - 1) / TRACE_BLOCK_RECORDS;
+    }
+    if (error) {
+        fprintf(stderr, "%s %s\n", name, error);
+        trace_close(t);
+        return -1;
+    }
+    return 0;
+}
+
+void trace_close(struct trace_file* t) {
+    munmap((void*)t->base, t->size);
+    memset(t, 0, sizeof(struct trace_file));
+}
+
+struct trace_decoder* trace_decoder_create(void) {
+    struct trace_decoder* d = malloc(sizeof(struct trace_decoder));
+    if (!d) {
+        fprintf(stderr, "Out of memory for branch trace decoder\n");
+        exit(-1);
+    }
+    return d;
+}
+
+void trace_decoder_delete(struct trace_decoder* d) {
+    free(d);
+}
+
+static void corrupt(uint64_t k) {
+    fprintf(stderr, "Branch trace block %lu is corrupt\n", (unsigned long)k);
+    exit(-1);
+}
+
+const struct trace_record* trace_block(const struct trace_file* t, uint64_t k,
+                                       struct trace_decoder* dec, uint32_t* n) {
+    if (t->records) {
+        uint64_t first = k * TRACE_BLOCK_RECORDS;
+        uint64_t left = t->header->count - first;
+        *n = left < TRACE_BLOCK_RECORDS ? (uint32_t)left : TRACE_BLOCK_RECORDS;
+        return t->records + first;
+    }
+    const struct trace_block_entry* b = &t->index[k];
+    const uint8_t* p = t->base + b->offset;
+    const uint8_t* end = p + b->bytes;
+    struct dictionary* d = &dec->dict;
+    struct trace_record* out = dec->buf;
+    uint32_t count = b->count;
+    uint32_t i = 0;
+    int32_t prev = -1;
+    uint32_t last_new = 0;
+    d->size = 0;
+
+#define GET_VARINT(v) do {                                              \
+        uint64_t v_ = 0;                                                \
+        int shift_ = 0;                                                 \
+        uint8_t byte_;                                                  \
+        do {                                                            \
+            if (p == end || shift_ > 35) corrupt(k);                    \
+            byte_ = *p++;                                               \
+            v_ |= (uint64_t)(byte_ & 0x7f) << shift_;                   \
+            shift_ += 7;                                                \
+        } while (byte_ & 0x80);                                         \
+        v = v_;                                                         \
+    } while (0)
+
+    while (i < count) {
+        uint64_t v;
+        GET_VARINT(v);
+        if (v & 1) {
+            // run of expected records
+            uint64_t run = v >> 1;
+            if (prev < 0 || run > count - i) corrupt(k);
+            for (; run; run--) {
+                int32_t idx = d->next[prev];
+                if (idx < 0) corrupt(k);
+                out[i].pc_taken = d->pc[idx] | d->taken[idx];
+                out[i].target = d->target[idx];
+                i++;
+                prev = idx;
+            }
+            continue;
+        }
+        uint32_t taken = (uint32_t)(v >> 1) & 1u;
+        int32_t idx;
+        if (v >> 2) {
+            if ((v >> 2) > d->size) corrupt(k);
+            idx = (int32_t)(v >> 2) - 1;
+        } else {
+            uint64_t pc_delta, target_delta;
+            GET_VARINT(pc_delta);
+            GET_VARINT(target_delta);
+            if (d->size == TRACE_BLOCK_RECORDS) corrupt(k);
+            idx = (int32_t)d->size++;
+            last_new += (uint32_t)unzigzag((uint32_t)pc_delta) << 1;
+            d->pc[idx] = last_new;
+            d->target[idx] = last_new + (uint32_t)unzigzag((uint32_t)target_delta);
+            d->next[idx] = -1;
+        }
+        if (prev >= 0) d->next[prev] = idx;
+        d->taken[idx] = (uint8_t)taken;
+        out[i].pc_taken = d->pc[idx] | taken;
+        out[i].target = d->target[idx];
+        i++;
+        prev = idx;
+    }
+#undef GET_VARINT
+    if (p != end) corrupt(k);
+    *n = count;
+    return out;
+}
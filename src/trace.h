@@ -0,0 +1,132 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// --- Branch traces ---------------------------------------------------------
+//
+// A branch trace records every conditional branch a run executes, in
+// order, so predictors can be evaluated later without simulating the
+// program again. The file is a header followed by 8-byte records:
+//
+//   header:  "RVBT", version (uint32), record count (uint64),
+//            instructions simulated while tracing (uint64)
+//   record:  pc | taken (uint32), target (uint32)
+//
+// pc is always word aligned, so its lowest bit holds the outcome. Fields
+// are in host byte order. The instruction count lets a replay (bpreplay)
+// report MPKI; version 1 files did not have it.
+//
+// Compressed traces ("RVBZ" in the header) hold the same records, coded
+// in independent blocks of TRACE_BLOCK_RECORDS:
+//
+//   header, index offset (uint64), block count (uint64),
+//   blocks..., index: one trace_block_entry per block
+//
+// Within a block each branch gets a dictionary index the first time it
+// shows up (coded with its pc and target as varint deltas), and is coded
+// by that index afterwards. Every dictionary entry remembers the branch
+// that followed it last and its own last outcome; a run of records that
+// all repeat those is coded as just its length, so a loop body that goes
+// the same way again costs a couple of bytes per iteration at most. All
+// numbers are LEB128 varints:
+//
+//   (length << 1) | 1                  run of expected records
+//   (index + 1) << 2 | taken << 1      known branch
+//   taken << 1, pc delta, target delta new branch (zigzag deltas from the
+//                                      previous new pc, and from pc)
+//
+// The dictionary starts out empty in every block, so blocks decode on
+// their own and several threads can decode different parts of a trace.
+
+#define TRACE_MAGIC   "RVBT"
+#define TRACE_ZMAGIC  "RVBZ"
+#define TRACE_VERSION 2
+
+struct trace_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    uint64_t insns;
+};
+
+struct trace_record {
+    uint32_t pc_taken;
+    uint32_t target;
+};
+
+// after the header of a compressed trace
+struct trace_zheader {
+    uint64_t index_offset;
+    uint64_t num_blocks;
+};
+
+// records per compressed block, and per block of a plain trace (512 KB)
+#define TRACE_BLOCK_RECORDS (1 << 16)
+
+struct trace_block_entry {
+    uint64_t offset;            // in the file
+    uint64_t first;             // record number
+    uint32_t count;             // records
+    uint32_t bytes;
+};
+
+// records buffered before each write (8 MB)
+#define TRACE_BUFFER_RECORDS (1 << 20)
+
+struct trace_encoder;
+
+struct trace_writer {
+    FILE* f;
+    struct trace_encoder* enc;  // NULL for a plain trace
+    uint64_t count;             // records written to f
+    uint32_t used;              // records in buf
+    struct trace_record buf[TRACE_BUFFER_RECORDS];
+};
+
+// NULL if the file cannot be created (reported on stderr)
+struct trace_writer* trace_writer_create(const char* name, int compressed);
+
+// Writes the rest of the buffer and the final counts, closes the file and
+// frees w. Returns 0 on success.
+int trace_writer_close(struct trace_writer* w, uint64_t insns);
+
+// slow path of trace_write: write out the full buffer
+void trace_writer_flush(struct trace_writer* w);
+
+// A trace mapped read-only into memory, for replaying it
+struct trace_file {
+    const struct trace_header* header;
+    const struct trace_record* records;     // plain traces only
+    const struct trace_block_entry* index;  // compressed traces only
+    uint64_t num_blocks;
+    const uint8_t* base;
+    size_t size;                            // of the mapping
+};
+
+// Maps the file and checks its header (and index). Returns 0 on success;
+// errors are reported on stderr.
+int trace_open(const char* name, struct trace_file* t);
+void trace_close(struct trace_file* t);
+
+// Per-thread scratch space for decoding blocks
+struct trace_decoder;
+struct trace_decoder* trace_decoder_create(void);
+void trace_decoder_delete(struct trace_decoder* d);
+
+// The records of block k (0 .. t->num_blocks-1) and their number in *n.
+// For a plain trace they are in the mapping; a compressed block is decoded
+// into d, and stays valid until its next use. Ends the process if the
+// block is corrupt.
+const struct trace_record* trace_block(const struct trace_file* t, uint64_t k,
+                                       struct trace_decoder* d, uint32_t* n);
+
+static inline void trace_write(struct trace_writer* w, uint32_t pc, uint32_t target, int taken) {
+    if (w->used == TRACE_BUFFER_RECORDS) trace_writer_flush(w);
+    struct trace_record* r = &w->buf[w->used++];
+    r->pc_taken = pc | (taken ? 1u : 0u);
+    r->target = target;
+}
+
+#endif
@@ -0,0 +1,88 @@
+// libsim_test - runs one program on two libsim machines at the same time
+//
+//   libsim_test prog.elf predictor size
+//
+// The machines run on threads of their own, one with the JIT and one with
+// the switch engine, in budgets of 1000 instructions. Each collects its
+// console output through its own callbacks. Both then print what the
+// program printed and their counts, for run_tests.sh to compare with sim.
+
+#include "libsim.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct job {
+  const char* elf;
+  const char* predictor;
+  int size;
+  enum sim_engine engine;
+  char output[4096];
+  int used;
+  int failed;
+  long insns;
+  long branches;
+  long mispredictions;
+};
+
+static int no_input(void* user)
+{
+  (void)user;
+  return -1;
+}
+
+static void collect(void* user, int ch)
+{
+  struct job* job = user;
+  if (job->used < (int)sizeof(job->output) - 1) job->output[job->used++] = (char)ch;
+}
+
+static void* run_job(void* arg)
+{
+  struct job* job = arg;
+  struct sim_console console = { no_input, collect, job };
+  struct sim_machine* m = sim_machine_create();
+  if (!m || sim_machine_load_elf(m, job->elf) || sim_machine_set_predictor(m, job->predictor, job->size) ||
+      sim_machine_set_engine(m, job->engine, 1) || sim_machine_set_console(m, &console)) {
+    job->failed = 1;
+    sim_machine_delete(m);
+    return NULL;
+  }
+  enum sim_event event;
+  while ((event = sim_machine_run(m, 1000)) == SIM_EVENT_BUDGET)
+    ;
+  job->failed = event != SIM_EVENT_EXIT;
+  job->insns = sim_machine_stat(m)->insns;
+  job->branches = sim_machine_bpstats(m)->total_branches;
+  job->mispredictions = sim_machine_bpstats(m)->mispredictions;
+  sim_machine_delete(m);
+  return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 4) {
+    printf("Usage: libsim_test prog.elf predictor size\n");
+    return 1;
+  }
+  struct job jobs[2] = {
+    { .elf = argv[1], .predictor = argv[2], .size = atoi(argv[3]), .engine = ENGINE_JIT },
+    { .elf = argv[1], .predictor = argv[2], .size = atoi(argv[3]), .engine = ENGINE_SWITCH },
+  };
+  pthread_t threads[2];
+  for (int i = 0; i < 2; i++) {
+    if (pthread_create(&threads[i], NULL, run_job, &jobs[i])) return 1;
+  }
+  for (int i = 0; i < 2; i++) pthread_join(threads[i], NULL);
+
+  int failed = 0;
+  for (int i = 0; i < 2; i++) {
+    jobs[i].output[jobs[i].used] = '\0';
+    printf("%s", jobs[i].output);
+    printf("Instructions: %ld\n", jobs[i].insns);
+    printf("Total branches: %ld\n", jobs[i].branches);
+    printf("Mispredictions: %ld\n", jobs[i].mispredictions);
+    failed |= jobs[i].failed;
+  }
+  return failed;
+}
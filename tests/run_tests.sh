@@ -29,6 +29,337 @@ for test in test_*.elf; do
     fi
 done
 
+# Counts one check: passed if $1 is 1
+result() {
+    if [ "$1" = 1 ]; then
+        echo -e "${GREEN}✓ PASSED${NC}"
+        PASSED=$((PASSED + 1))
+    else
+        echo -e "${RED}✗ FAILED${NC}"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# Output of a run without the timing line
+run() {
+    "$@" 2>&1 | grep -v "host ticks"
+}
+
+engines="switch threaded block jit"
+
+# Every engine must print the same and write the same profile
+for test in test_*.elf; do
+    base="${test%.elf}"
+    echo -n "Engines $base... "
+    ok=1
+    for engine in $engines; do
+        run ../sim "$test" -e $engine -b gshare 1024 -p "logs/$base.$engine.prof" > "logs/$base.$engine.out"
+        if ! cmp -s "logs/$base.switch.prof" "logs/$base.$engine.prof" ||
+           ! cmp -s "logs/$base.switch.out" "logs/$base.$engine.out"; then
+            ok=0
+        fi
+    done
+    result $ok
+done
+
+# With -f on, every engine must count the same fused pairs, the JIT
+# included, although it compiles each pair as its two halves
+for test in test_fusion.elf test_predict.elf; do
+    base="${test%.elf}"
+    echo -n "Fusion counts $base... "
+    ok=1
+    for engine in $engines; do
+        run ../sim "$test" -e $engine -f on -p "logs/$base.$engine.fused.prof" > /dev/null
+        cmp -s "logs/$base.switch.fused.prof" "logs/$base.$engine.fused.prof" || ok=0
+    done
+    grep -q "^Fused .*: [1-9]" "logs/$base.switch.fused.prof" || ok=0
+    result $ok
+done
+
+# Value of a "Name: value" line of a profile
+field() {
+    grep "^$1:" "$2" | cut -d' ' -f"$(($(echo "$1" | wc -w) + 1))"
+}
+
+# Basic-block vectors must count every instruction once
+echo -n "BBV test_predict... "
+run ../sim test_predict.elf -b gshare 1024 -p logs/bbv.full.prof > logs/bbv.full.out
+run ../sim test_predict.elf -bbv logs/predict.bb -interval 1000 > /dev/null
+counted=$(tr ' ' '\n' < logs/predict.bb | awk -F: 'NF == 3 { n += $3 } END { print n }')
+[ "$counted" = "$(field Instructions logs/bbv.full.prof)" ] && result 1 || result 0
+
+# The simulation points must weigh 1 in all
+echo -n "SimPoint test_predict... "
+ok=1
+../simpoint logs/predict.bb -k 4 -o logs/predict.points > /dev/null 2>&1 || ok=0
+[ "$(awk '{ w += $2 } END { printf "%.3f", w }' logs/predict.points)" = "1.000" ] || ok=0
+result $ok
+
+# A sampled run must print what the whole run prints, simulate every
+# point and weigh their MPKIs by the points' weights
+echo -n "Samples test_predict... "
+ok=1
+run ../sim test_predict.elf -sample logs/predict.points -interval 1000 -warmup 500 \
+    -b gshare 1024 > logs/sample.out
+grep -v "^Sample\|^Weighted" logs/sample.out | cmp -s logs/bbv.full.out - || ok=0
+grep -q "^Samples simulated: \([0-9]*\) of \1 " logs/sample.out || ok=0
+awk 'NR == FNR { weight[$1] = $2; next }
+     /^Sample / { sub(":", "", $2); mpki += weight[$2] * $NF }
+     /^Weighted MPKI:/ { printed = $3 }
+     END { exit !(printed != "" && mpki - printed < 0.001 && printed - mpki < 0.001) }' \
+    logs/predict.points logs/sample.out || ok=0
+result $ok
+
+# Saving a checkpoint part of the way and resuming from it must print
+# what the whole run prints and predict the same branches, the tables
+# coming with the checkpoint
+for test in test_predict.elf test_btb.elf; do
+    base="${test%.elf}"
+    for predictor in gshare tage; do
+        echo -n "Checkpoint $base $predictor... "
+        run ../sim "$test" -b $predictor 1024 -p "logs/$base.full.prof" > "logs/$base.full.out"
+        run ../sim "$test" -b $predictor 1024 -p "logs/$base.ckpt.prof" -ckpt "logs/$base.ckpt" 2000 \
+            | grep -v "^Checkpoint written" > "logs/$base.ckpt.out"
+        run ../sim "$test" -b $predictor 1024 -p "logs/$base.resume.prof" -resume "logs/$base.ckpt" \
+            >> "logs/$base.ckpt.out"
+        ok=1
+        # the line breaks differ: each run ends its output with one
+        [ "$(tr -d '\n' < "logs/$base.full.out")" = "$(tr -d '\n' < "logs/$base.ckpt.out")" ] || ok=0
+        for name in "Total branches" "Mispredictions"; do
+            whole=$(field "$name" "logs/$base.full.prof")
+            first=$(field "$name" "logs/$base.ckpt.prof")
+            rest=$(field "$name" "logs/$base.resume.prof")
+            parts=$((${first:-0} + ${rest:-0}))
+            [ "$whole" = "$parts" ] || ok=0
+        done
+        result $ok
+    done
+done
+
+# Tables saved by one predictor must not load into another of the same
+# size
+echo -n "Checkpoint bimode into agree... "
+run ../sim test_predict.elf -b bimode 1024 -ckpt logs/bimode.ckpt 2000 > /dev/null
+if ../sim test_predict.elf -b agree 1024 -resume logs/bimode.ckpt > /dev/null 2>&1; then
+    result 0
+else
+    result 1
+fi
+
+# Running in slices must not change what a run prints, its profile or
+# its branch trace
+for engine in $engines; do
+    echo -n "Slices $engine... "
+    ok=1
+    run ../sim test_predict.elf -e $engine -b gshare 1024 -p logs/slice.prof -trace logs/slice.bt > logs/slice.out
+    for slice in 1 50 777 100000; do
+        run ../sim test_predict.elf -e $engine -slice $slice -b gshare 1024 -p "logs/slice.$slice.prof" -trace "logs/slice.$slice.bt" \
+            > "logs/slice.$slice.out"
+        cmp -s logs/slice.prof "logs/slice.$slice.prof" || ok=0
+        cmp -s logs/slice.out "logs/slice.$slice.out" || ok=0
+        cmp -s logs/slice.bt "logs/slice.$slice.bt" || ok=0
+    done
+    result $ok
+done
+
+# Basic-block vectors need the block engine for the whole run, which a
+# slice does not keep to, so -slice must refuse -bbv
+echo -n "Slices with -bbv... "
+if ../sim test_predict.elf -slice 50 -bbv logs/slice.bb > /dev/null 2>&1; then
+    result 0
+else
+    result 1
+fi
+
+# Two libsim machines running at once on two threads must each run the
+# program like sim does
+echo -n "libsim two machines... "
+ok=1
+if gcc -std=gnu11 -pthread -I.. libsim_test.c ../libsim.a -o logs/libsim_test; then
+    run ../sim test_predict.elf -b gshare 1024 -p logs/libsim.prof | head -n -1 > logs/libsim.one
+    grep -E "^(Instructions|Total branches|Mispredictions):" logs/libsim.prof >> logs/libsim.one
+    cat logs/libsim.one logs/libsim.one > logs/libsim.expected
+    logs/libsim_test test_predict.elf gshare 1024 > logs/libsim.out || ok=0
+    cmp -s logs/libsim.expected logs/libsim.out || ok=0
+else
+    ok=0
+fi
+result $ok
+
+# A batch must report each job as a run of it alone does, in job file
+# order, and a job whose ELF cannot be loaded as an error
+cat > logs/jobs.txt << 'EOF'
+test_predict.elf gshare 1024
+# a comment
+test_branches.elf bimodal 256
+
+logs/missing.elf gshare 1024
+test_predict.elf nt
+EOF
+single() {
+    run ../sim "$1" -b $2 -p logs/batch.prof > /dev/null
+    echo "exit,$(field Instructions logs/batch.prof),$(field "Total branches" logs/batch.prof),$(field Mispredictions logs/batch.prof)"
+}
+{
+    single test_predict.elf "gshare 1024"
+    single test_branches.elf "bimodal 256"
+    echo "error,0,0,0"
+    single test_predict.elf nt
+} > logs/batch.expected
+for format in csv json; do
+    echo -n "Batch $format... "
+    run ../sim --batch logs/jobs.txt -j 3 -o "logs/batch.$format" > /dev/null
+    if [ $format = csv ]; then
+        tail -n +2 logs/batch.csv | cut -d, -f7,9-11 > logs/batch.got
+    else
+        sed -n 's/.*"status": "\([a-z]*\)".*"instructions": \([0-9]*\), "branches": \([0-9]*\), "mispredictions": \([0-9]*\).*/\1,\2,\3,\4/p' \
+            logs/batch.json > logs/batch.got
+    fi
+    cmp -s logs/batch.expected logs/batch.got && result 1 || result 0
+done
+
+# Each row of a -b list must match a run with that predictor alone
+echo -n "Predictor list... "
+ok=1
+run ../sim test_predict.elf -b bimodal:256,gshare:1024,nt -p logs/list.prof > /dev/null
+for spec in bimodal:256 gshare:1024 nt; do
+    name="${spec%%:*}"
+    size="${spec#$name}"
+    run ../sim test_predict.elf -b $name ${size#:} -p logs/list.one.prof > /dev/null
+    [ "$(awk -v spec=$spec '$1 == spec { print $2 }' logs/list.prof)" = \
+      "$(field Mispredictions logs/list.one.prof)" ] || ok=0
+done
+result $ok
+
+# Every engine must write the same branch trace, and replaying it, plain
+# or compressed,
+# must give the profile of the run that wrote it
+for test in test_*.elf; do
+    base="${test%.elf}"
+    echo -n "Trace $base... "
+    ok=1
+    for engine in $engines; do
+        run ../sim "$test" -e $engine -trace "logs/$base.$engine.bt" > /dev/null
+        cmp -s "logs/$base.switch.bt" "logs/$base.$engine.bt" || ok=0
+    done
+    for ext in bt btz; do
+        run ../sim "$test" -trace "logs/$base.$ext" > /dev/null
+        run ../bpreplay "logs/$base.$ext" -b gshare 1024 -p "logs/$base.$ext.prof" > /dev/null
+        cmp -s "logs/$base.switch.prof" "logs/$base.$ext.prof" || ok=0
+    done
+    result $ok
+done
+
+# A sweep must give what replays of its configs one at a time give, on
+# any number of threads, and sim -sweep what bpreplay -sweep gives,
+# with the counter banks in AVX2 or scalar code (the 11 bimodal and
+# gshare configs fill two 8 lane groups on one thread)
+printf 'bimodal:256 gshare:1024\ngshare:4096\nnt\n' > logs/specs.txt
+printf 'bimodal:16,bimodal:64,bimodal:1024,bimodal:4096\ngshare:16,gshare:64,gshare:256,gshare:16384\n' \
+    >> logs/specs.txt
+echo -n "Sweep... "
+ok=1
+run ../sim test_predict.elf -trace logs/sweep.bt -sweep logs/specs.txt logs/sweep.sim.csv > /dev/null
+run ../bpreplay logs/sweep.bt -sweep logs/specs.txt -j 1 -o logs/sweep.1.csv > /dev/null
+run ../bpreplay logs/sweep.bt -sweep logs/specs.txt -j 3 -o logs/sweep.3.csv > /dev/null
+run ../bpreplay logs/sweep.bt -sweep logs/specs.txt -j 1 -scalar -o logs/sweep.scalar.csv > /dev/null
+cmp -s logs/sweep.1.csv logs/sweep.3.csv || ok=0
+cmp -s logs/sweep.1.csv logs/sweep.scalar.csv || ok=0
+cmp -s logs/sweep.1.csv logs/sweep.sim.csv || ok=0
+for spec in bimodal:256 gshare:1024 gshare:4096 nt; do
+    name="${spec%%:*}"
+    size="${spec#$name}"
+    run ../bpreplay logs/sweep.bt -b $name ${size#:} -p logs/sweep.prof > /dev/null
+    [ "$(awk -F, -v spec=$spec '$1 == spec { print $5 }' logs/sweep.1.csv)" = \
+      "$(field Mispredictions logs/sweep.prof)" ] || ok=0
+done
+result $ok
+
+# Every predictor must predict the same under every engine and when
+# replaying a trace, and the ones that learn must beat btfnt
+run ../sim test_predict.elf -trace logs/predict.btz > /dev/null
+run ../sim test_predict.elf -b btfnt -p logs/predict.btfnt.prof > /dev/null
+static=$(field Mispredictions logs/predict.btfnt.prof)
+for predictor in "nt" "bimodal 1024" "bimode 1024" "agree 1024" "yags 1024" "tage 8" \
+                 "perceptron 64" "perceptron/16 64" "local 1024" "local/8/256 1024" \
+                 "tournament 1024" "tournament/local/8+gshare=4096 1024" \
+                 "tournament/perceptron/16=64+local/8/256 1024" \
+                 "bimodal:256,gshare:4096,tage:8"; do
+    echo -n "Predictor $predictor... "
+    ok=1
+    for engine in $engines; do
+        run ../sim test_predict.elf -e $engine -b $predictor -p "logs/predict.$engine.prof" > /dev/null
+        cmp -s logs/predict.switch.prof "logs/predict.$engine.prof" || ok=0
+    done
+    run ../bpreplay logs/predict.btz -b $predictor -p logs/predict.replay.prof > /dev/null
+    cmp -s logs/predict.switch.prof logs/predict.replay.prof || ok=0
+    if [ "$predictor" != nt ] && [ "${predictor#*,}" = "$predictor" ]; then
+        [ "$(field Mispredictions logs/predict.switch.prof)" -lt "$static" ] || ok=0
+    fi
+    result $ok
+done
+
+# A predictor that cannot be built must stop sim, not run it without one
+for predictor in "nosuch 64" "gshare 1000" "tage 0" "tournament/bimodal/gshare 1024" \
+                 "tournament/bimodal+tournament 1024"; do
+    echo -n "Bad predictor $predictor... "
+    if ../sim test_predict.elf -b $predictor > /dev/null 2>&1; then
+        result 0
+    else
+        result 1
+    fi
+done
+
+# Bi-mode, agree and YAGS of one size must report the same aliasing for
+# the gshare table they are compared with, as the same branches train it
+echo -n "Aliasing reports... "
+ok=1
+for predictor in bimode agree yags; do
+    run ../sim test_predict.elf -b $predictor 1024 -p "logs/alias.$predictor.prof" > /dev/null
+    grep "^gshare table" "logs/alias.$predictor.prof" > "logs/alias.$predictor.gshare" || ok=0
+    cmp -s logs/alias.bimode.gshare "logs/alias.$predictor.gshare" || ok=0
+done
+result $ok
+
+# Whether a profile has all the lines given after it
+expect() {
+    local prof="$1"
+    shift
+    for line in "$@"; do
+        grep -qxF "$line" "$prof" || return 1
+    done
+}
+
+# Target prediction of test_btb, whose 100 iterations each call a leaf,
+# make 7 nested calls and jump indirectly to one of two targets in turn.
+# The profile must be the same under every engine and have these lines:
+# - 9 transfer sites, so a BTB big enough misses each once
+# - the indirect jump alternates, so the BTB's last target is always wrong
+# - a 4 entry RAS overflows 3 times per iteration and then mispredicts
+#   the 3 outermost returns
+# - with a path of one target, the target cache learns the alternation
+btb_test() {
+    local name="$1" options="$2"
+    shift 2
+    echo -n "BTB $name... "
+    local ok=1
+    for engine in $engines; do
+        run ../sim test_btb.elf -e $engine $options -p "logs/btb.$engine.prof" > /dev/null
+        cmp -s logs/btb.switch.prof "logs/btb.$engine.prof" || ok=0
+    done
+    expect logs/btb.switch.prof "$@" || ok=0
+    result $ok
+}
+btb_test "hits" "-btb 64 2 -ras 16" \
+    "BTB lookups: 1949" "BTB hits: 1940 (99.54%)" "BTB wrong targets: 99" \
+    "Indirect correct, BTB target: 0 (0.00%)"
+btb_test "RAS" "-btb 64 2 fifo -ras 16" \
+    "RAS returns: 800" "RAS correct: 800 (100.00%)" "RAS overflows: 0"
+btb_test "RAS overflow" "-btb 64 2 random -ras 4" \
+    "RAS returns: 800" "RAS correct: 500 (62.50%)" "RAS overflows: 300"
+btb_test "indirect" "-btb 64 2 -ras 16 -indirect 64 1" \
+    "Indirect jumps and calls: 100" "Indirect correct, target cache: 97 (97.00%)"
+
 echo ""
 echo "========================================"
 echo "Passed: $PASSED"
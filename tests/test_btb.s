@@ -0,0 +1,64 @@
+# test_btb.s - Calls, returns and indirect jumps for the BTB and RAS
+# Each iteration makes one call to a leaf, 7 nested calls and an indirect
+# jump that alternates between two targets.
+.globl _start
+_start:
+    la      sp, stack_top
+    li      s0, 0               # iteration
+    li      s1, 100
+    li      s2, 0               # checksum
+loop:
+    jal     ra, leaf
+    li      a0, 6
+    jal     ra, recurse
+    andi    t0, s0, 1
+    slli    t0, t0, 2
+    la      t1, table
+    add     t1, t1, t0
+    lw      t1, 0(t1)
+    jr      t1
+target0:
+    addi    s2, s2, 1
+    j       next
+target1:
+    addi    s2, s2, 2
+next:
+    addi    s0, s0, 1
+    blt     s0, s1, loop
+    li      t0, 26
+    remu    a0, s2, t0
+    addi    a0, a0, 97          # 'a'
+    li      a7, 2
+    ecall
+    li      a0, 10              # '\n'
+    li      a7, 2
+    ecall
+    li      a7, 93
+    ecall
+
+leaf:
+    addi    s2, s2, 3
+    ret
+
+# a0 + 1 nested calls
+recurse:
+    addi    sp, sp, -16
+    sw      ra, 0(sp)
+    beqz    a0, recurse_done
+    addi    a0, a0, -1
+    jal     ra, recurse
+recurse_done:
+    lw      ra, 0(sp)
+    addi    sp, sp, 16
+    ret
+
+.data
+.align 4
+table:
+    .word   target0, target1
+
+.bss
+.align 4
+stack:
+    .space  256
+stack_top:
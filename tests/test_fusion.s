@@ -0,0 +1,59 @@
+# test_fusion.s - Test instruction pairs the simulator fuses
+.globl _start
+_start:
+    # lui + addi (li with a large constant)
+    li      x1, 0x12345678
+    lui     x2, 0x12345
+    addi    x2, x2, 0x678
+    bne     x1, x2, fail
+
+    # auipc + addi (la)
+    la      x3, data
+    lw      x4, 0(x3)
+    li      x5, 0x600D
+    bne     x4, x5, fail
+
+    # auipc + jalr (call)
+    call    func
+    li      x6, 42
+    bne     x10, x6, fail
+
+    # slt + bnez / sltu + beqz
+    li      x7, -1
+    li      x8, 1
+    slt     x9, x7, x8
+    bnez    x9, lt_ok
+    j       fail
+lt_ok:
+    sltu    x9, x7, x8
+    beqz    x9, ltu_ok
+    j       fail
+ltu_ok:
+
+    # addi + bne loop back-edge
+    li      x11, 0
+    li      x12, 10
+    li      x13, 0
+loop:
+    add     x13, x13, x11
+    addi    x11, x11, 1
+    bne     x11, x12, loop
+    li      x14, 45
+    bne     x13, x14, fail
+    j       success
+
+func:
+    li      x10, 42
+    ret
+
+fail:
+    li      x31, 0xDEAD
+    li      a7, 93
+    ecall
+success:
+    li      x31, 0x600D
+    li      a7, 93
+    ecall
+
+data:
+    .word   0x600D
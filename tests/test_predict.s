@@ -0,0 +1,53 @@
+# test_predict.s - Loops with branches for the predictors to learn
+# Prints a letter every 25 iterations, so runs can be compared.
+.globl _start
+_start:
+    li      s0, 0               # iteration
+    li      s1, 500
+    li      s2, 0x1234          # LFSR state
+    li      s3, 0               # checksum
+outer:
+    # taken two times out of three
+    li      t0, 3
+    rem     t1, s0, t0
+    bnez    t1, not_third
+    addi    s3, s3, 3
+not_third:
+    # pseudo-random, from a 16-bit Galois LFSR
+    andi    t2, s2, 1
+    srli    s2, s2, 1
+    beqz    t2, no_tap
+    li      t3, 0xB400
+    xor     s2, s2, t3
+    addi    s3, s3, 1
+no_tap:
+    # inner loop of s0 % 8 iterations
+    andi    t4, s0, 7
+inner:
+    beqz    t4, inner_done
+    addi    s3, s3, 2
+    addi    t4, t4, -1
+    j       inner
+inner_done:
+    # goes the same way as the first branch
+    li      t0, 3
+    rem     t1, s0, t0
+    bnez    t1, same
+    addi    s3, s3, -1
+same:
+    li      t0, 25
+    rem     t1, s0, t0
+    bnez    t1, no_print
+    li      t0, 26
+    remu    a0, s3, t0
+    addi    a0, a0, 97          # 'a'
+    li      a7, 2
+    ecall
+no_print:
+    addi    s0, s0, 1
+    blt     s0, s1, outer
+    li      a0, 10              # '\n'
+    li      a7, 2
+    ecall
+    li      a7, 93
+    ecall